@@ -0,0 +1,218 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A chunk of the MSH file (4 character header, 4 byte size, then payload)
+class Chunk
+{
+private:
+
+	// 4 character header of the chunk (HEDR, MODL, POSL...)
+	std::string Header;
+
+	// Position of the chunk size (header is 4 bytes before this, payload 4 bytes after)
+	size_t Position = 0;
+
+	// Size of the payload as recorded in the file
+	uint32_t Size = 0;
+
+	// Child chunks if this chunk is a container
+	std::vector<Chunk> Children;
+
+	// Payload of a leaf built or edited in memory, used instead of the file data when Owned
+	std::vector<unsigned char> Payload;
+	bool Owned = false;
+
+	// Returns whether chunks with this header hold other chunks
+	static inline bool IsContainer(const std::string& Header)
+	{
+		return Header == "HEDR" || Header == "MSH2" || Header == "SINF" || Header == "CAMR"
+			|| Header == "MATL" || Header == "MATD" || Header == "MODL" || Header == "GEOM"
+			|| Header == "SEGM" || Header == "CLTH" || Header == "ANM2";
+	}
+
+	// Which chunks belong directly inside which container ("" for the top of the file)
+	static inline const std::vector<std::pair<std::string, std::vector<std::string>>>& Grammar()
+	{
+		static const std::vector<std::pair<std::string, std::vector<std::string>>> Rules =
+		{
+			{ "", { "HEDR" } },
+			{ "HEDR", { "MSH2", "BLN2", "SKL2", "ANM2", "CL1L" } },
+			{ "MSH2", { "SINF", "CAMR", "MATL", "MODL" } },
+			{ "SINF", { "NAME", "FRAM", "BBOX" } },
+			{ "CAMR", { "NAME", "DATA" } },
+			{ "MATL", { "MATD" } },
+			{ "MATD", { "NAME", "DATA", "ATRB", "TX0D", "TX1D", "TX2D", "TX3D" } },
+			{ "MODL", { "MTYP", "MNDX", "NAME", "PRNT", "FLGS", "TRAN", "GEOM", "SWCI" } },
+			{ "GEOM", { "BBOX", "SEGM", "ENVL", "CLTH" } },
+			{ "SEGM", { "MATI", "POSL", "WGHT", "NRML", "CLRL", "CLRB", "UV0L", "NDXL", "NDXT", "STRP", "SHDW" } },
+			{ "CLTH", { "CTEX", "CPOS", "CUV0", "FIDX", "FWGT", "SPRS", "CPRS", "BPRS", "COLL" } },
+			{ "ANM2", { "CYCL", "KFR3" } }
+		};
+
+		return Rules;
+	}
+
+	// Returns whether the header appears anywhere in the grammar
+	static inline bool IsKnown(const std::string& Header)
+	{
+		for (auto& Rule : Grammar())
+			if (std::find(Rule.second.begin(), Rule.second.end(), Header) != Rule.second.end())
+				return true;
+
+		return false;
+	}
+
+	// Returns whether a chunk with this header belongs directly inside Parent
+	// Headers we don't know about are kept wherever they turn up (except at the top)
+	static inline bool Accepts(const std::string& Parent, const std::string& Header)
+	{
+		for (auto& Rule : Grammar())
+			if (Rule.first == Parent)
+				return std::find(Rule.second.begin(), Rule.second.end(), Header) != Rule.second.end()
+					|| (!Parent.empty() && !IsKnown(Header));
+
+		// Parent is itself unknown, so it can't be a container
+		return false;
+	}
+
+	// Returns how many bytes of a container payload come before its first child
+	static inline size_t PrefixSize(const std::string& Header)
+	{
+		// MATL holds the material count before the MATD chunks
+		if (Header == "MATL")
+			return 4;
+
+		return 0;
+	}
+
+	// So that MSH can build and walk the tree
+	friend class MSH;
+
+	// So that View can walk the tree
+	friend class View;
+};
+
+// 64 bit FNV-1a hash of a block of bytes
+inline uint64_t HashBytes(const unsigned char* Bytes, size_t Count, uint64_t Hash = 0xcbf29ce484222325ULL)
+{
+	for (size_t C = 0; C < Count; C++)
+	{
+		Hash ^= Bytes[C];
+		Hash *= 0x100000001b3ULL;
+	}
+
+	return Hash;
+}
+
+// Writes a plain value to a binary stream
+template <typename T>
+inline void WriteValue(std::ostream& Out, const T& Value)
+{
+	Out.write(reinterpret_cast<const char*>(&Value), sizeof(T));
+}
+
+// Reads a plain value from a binary stream
+template <typename T>
+inline void ReadValue(std::istream& In, T& Value)
+{
+	In.read(reinterpret_cast<char*>(&Value), sizeof(T));
+}
+
+// Writes a length prefixed string to a binary stream
+inline void WriteString(std::ostream& Out, const std::string& Str)
+{
+	uint32_t Length = static_cast<uint32_t>(Str.size());
+	WriteValue(Out, Length);
+	Out.write(Str.data(), Length);
+}
+
+// Reads a length prefixed string from a binary stream, false if it looks corrupt
+inline bool ReadString(std::istream& In, std::string& Str, uint32_t MaxLength = 0xFFFF)
+{
+	uint32_t Length = 0;
+	ReadValue(In, Length);
+	if (!In || Length > MaxLength)
+		return false;
+
+	Str.resize(Length);
+	In.read(&Str[0], Length);
+	return bool(In);
+}
+
+// Bytes of MSH files attributed to the chunk paths that hold them (HEDR/MSH2/MODL/GEOM/SEGM/UV0L...)
+class SizeReport
+{
+public:
+
+	// Bytes each path holds itself (header, size and any payload not in a child) and how many chunks had it
+	std::map<std::string, std::pair<uint64_t, uint64_t>> Paths;
+
+	// Bytes of all the files, and how many files were added
+	uint64_t Total = 0;
+	size_t Files = 0;
+
+	// Adds the numbers of another file (or set of files) to these
+	inline void Add(const SizeReport& Other)
+	{
+		for (auto& Path : Other.Paths)
+		{
+			Paths[Path.first].first += Path.second.first;
+			Paths[Path.first].second += Path.second.second;
+		}
+
+		Total += Other.Total;
+		Files += Other.Files;
+	}
+
+	// Bytes of the path and everything under it
+	inline uint64_t Inclusive(const std::string& Path) const
+	{
+		uint64_t Bytes = 0;
+		for (auto It = Paths.lower_bound(Path); It != Paths.end() && It->first.compare(0, Path.size(), Path) == 0; ++It)
+			if (It->first.size() == Path.size() || It->first.at(Path.size()) == '/')
+				Bytes += It->second.first;
+
+		return Bytes;
+	}
+
+	// Table of the paths, largest first, with their own and inclusive bytes
+	inline std::string Table() const
+	{
+		std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> Sorted(Paths.begin(), Paths.end());
+		std::stable_sort(Sorted.begin(), Sorted.end(), [](const auto& A, const auto& B) { return A.second.first > B.second.first; });
+
+		std::ostringstream Out;
+		Out << std::left << std::setw(40) << " PATH" << std::right << std::setw(9) << "CHUNKS" << std::setw(13) << "BYTES"
+			<< std::setw(8) << "%" << std::setw(13) << "INCLUSIVE";
+		for (auto& Path : Sorted)
+			Out << "\n " << std::left << std::setw(39) << Path.first << std::right << std::setw(9) << Path.second.second
+				<< std::setw(13) << Path.second.first << std::setw(8) << std::fixed << std::setprecision(2)
+				<< (Total > 0 ? 100.0 * Path.second.first / Total : 0.0) << std::setw(13) << Inclusive(Path.first);
+		Out << "\n " << std::left << std::setw(39) << "TOTAL" << std::right << std::setw(9) << Files << std::setw(13) << Total;
+
+		return Out.str();
+	}
+
+	// Folded stacks for flamegraph.pl and similar tools ("HEDR;MSH2;MODL 1234" per line)
+	inline std::string Folded() const
+	{
+		std::string Out;
+		for (auto& Path : Paths)
+		{
+			if (Path.second.first == 0)
+				continue;
+
+			std::string Stack = Path.first;
+			std::replace(Stack.begin(), Stack.end(), '/', ';');
+			Out += Stack + " " + std::to_string(Path.second.first) + "\n";
+		}
+
+		return Out;
+	}
+};
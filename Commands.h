@@ -0,0 +1,1261 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <set>
+#include <streambuf>
+#include "ThreadPool.h"
+
+// Collects what the current thread prints to std::cout while it's alive, other threads print as usual
+// (swapping the cout buffer would take every thread's output with it)
+class ConsoleCapture
+{
+public:
+
+    ConsoleCapture(std::string& Str) : Previous(Target())
+    {
+        static Router Installed;
+        Target() = &Str;
+    }
+
+    ~ConsoleCapture()
+    {
+        std::cout.flush();
+        Target() = Previous;
+    }
+
+    ConsoleCapture(const ConsoleCapture&) = delete;
+    ConsoleCapture& operator=(const ConsoleCapture&) = delete;
+
+private:
+
+    // Where this thread's output goes, nullptr for the console
+    static inline std::string*& Target()
+    {
+        thread_local std::string* Str = nullptr;
+        return Str;
+    }
+
+    // Sits in front of the console buffer and hands each thread's output to its target
+    class Router : public std::streambuf
+    {
+    public:
+
+        Router() : Console(std::cout.rdbuf(this)) {}
+        ~Router() { std::cout.rdbuf(Console); }
+
+    protected:
+
+        int overflow(int ch) override
+        {
+            if (ch == traits_type::eof())
+                return traits_type::not_eof(ch);
+
+            char Char = static_cast<char>(ch);
+            return xsputn(&Char, 1) == 1 ? ch : traits_type::eof();
+        }
+
+        std::streamsize xsputn(const char* Str, std::streamsize Count) override
+        {
+            if (Target() != nullptr)
+            {
+                Target()->append(Str, static_cast<size_t>(Count));
+                return Count;
+            }
+
+            std::lock_guard<std::mutex> Lock(Mutex);
+            return Console->sputn(Str, Count);
+        }
+
+        int sync() override
+        {
+            if (Target() != nullptr)
+                return 0;
+
+            std::lock_guard<std::mutex> Lock(Mutex);
+            return Console->pubsync();
+        }
+
+    private:
+
+        std::streambuf* Console;
+        std::mutex Mutex;
+    };
+
+    std::string* Previous;
+};
+
+// Static functions that run the commandline operations and standalone modes
+class Commands
+{
+public:
+
+    // What one operation of Execute did, for callers that want results rather than console text
+    class OpResult
+    {
+    public:
+
+        // The MSH filename or -option, and the arguments it took
+        std::string Op;
+        std::vector<std::string> Args;
+
+        // Whether it went through, and why not if it didn't
+        bool Ok = true;
+        std::string Error;
+
+        // Everything it printed
+        std::string Output;
+
+        // What it found as JSON (-stats, -validate, -diff), empty for the rest
+        std::string Data;
+    };
+
+    // Runs a list of batch operations (MSH filenames and -options) in order
+    // Filenames are read with Load if given, otherwise straight from disk
+    // With Results, each operation's output and data is collected there instead of printed
+    static inline void Execute(std::vector<MSH>& MSHARGS, const std::vector<std::string>& Args, bool& out,
+        std::function<bool(MSH&)> Load = nullptr, std::vector<OpResult>* Results = nullptr)
+    {
+        unsigned short mati = 0;
+        unsigned short mshi = 0;
+        unsigned short clus = 0;
+        unsigned short modl = 0;
+
+        // For batch MSH file operations -----------------------------
+        for (size_t arg = 0; arg < Args.size(); arg++)
+        {
+            size_t First = arg;
+            std::unique_ptr<ConsoleCapture> Capture;
+            if (Results)
+            {
+                Results->emplace_back();
+                Results->back().Op = Args.at(arg);
+                Capture = std::make_unique<ConsoleCapture>(Results->back().Output);
+            }
+
+            // Possible commands
+            // Note: Flag commands toggle, everything else 'sets'
+            if (Args.at(arg)[0] != '-') // Interpret as MSH file
+            {
+                MSH MSHFile;
+                MSHFile.SetMSHFilename(Args.at(arg));
+                bool Read = Load ? Load(MSHFile) : MSHFile.ReadMSH();
+                if (Read)
+                {
+                    MSHARGS.push_back(MSHFile);
+                    mshi = static_cast<unsigned short>(MSHARGS.size()) - 1;
+                }
+                else
+                {
+                    std::cout << " Could not read " << Args.at(arg) << "!\n";
+                    if (Results)
+                    {
+                        Results->back().Ok = false;
+                        Results->back().Error = "could not be read";
+                    }
+                }
+            }
+            else if (Args.at(arg) == "-help") // Output list of commands
+            {
+                ;
+            }
+            else if (Args.at(arg) == "-listmaterials")
+            {
+                MSHARGS.at(mshi).ListMaterials();
+            }
+            else if (Args.at(arg) == "-listmodels")
+            {
+                MSHARGS.at(mshi).ListModels();
+            }
+            else if (Args.at(arg) == "-msh") // If multiple MSHs, select MSH index to operate on
+            {
+                mshi = std::stoi(Args.at(arg + 1));
+                arg++;
+            }
+            else if (Args.at(arg) == "-material") // If multiple materials, select material index to operate on
+            {
+                mati = std::stoi(Args.at(arg + 1));
+                arg++;
+            }
+            else if (Args.at(arg) == "-model")
+            {
+                modl = std::stoi(Args.at(arg + 1));
+                arg++;
+            }
+            else if (Args.at(arg) == "-cluster")
+            {
+                clus = std::stoi(Args.at(arg + 1));
+                arg++;
+            }
+            else if (Args.at(arg) == "-out")
+            {
+                std::string OutFile = Args.at(arg + 1);
+                MSHARGS.at(mshi).SetMSHFilename(OutFile);
+                arg++;
+                out = true;
+            }
+            else if (Args.at(arg) == "-modelname")
+            {
+                std::string NewName = Args.at(arg + 1);
+                MSHARGS.at(mshi).RenameModel(modl, NewName);
+                arg++;
+            }
+            else if (Args.at(arg) == "-materialname")
+            {
+                std::string NewName = Args.at(arg + 1);
+                MSHARGS.at(mshi).RenameMaterial(mati, NewName);
+                arg++;
+            }
+            else if (Args.at(arg) == "-modelparent")
+            {
+                unsigned short NewPrnt = std::stoi(Args.at(arg + 1));
+                MSHARGS.at(mshi).SetModelParent(modl, NewPrnt);
+                arg++;
+            }
+            else if (Args.at(arg) == "-modelvisibility")
+            {
+                unsigned short vis = std::stoi(Args.at(arg + 1));
+                MSHARGS.at(mshi).SetModelVisibility(modl, vis);
+                arg++;
+            }
+            else if (Args.at(arg) == "-remove_subtree") // Removes the selected model and everything under it
+            {
+                MSHARGS.at(mshi).RemoveSubtree(modl);
+            }
+            else if (Args.at(arg) == "-reparent_subtree") // New parent model index, -1 for none
+            {
+                long long NewPrnt = std::stoll(Args.at(arg + 1));
+                MSHARGS.at(mshi).ReparentSubtree(modl, NewPrnt);
+                arg++;
+            }
+            else if (Args.at(arg) == "-hide_subtree") // Hides the selected model and everything under it
+            {
+                MSHARGS.at(mshi).HideSubtree(modl);
+            }
+            else if (Args.at(arg) == "-flatten") // Folds unused null models into their children
+            {
+                MSHARGS.at(mshi).Flatten();
+            }
+            else if (Args.at(arg) == "-limit_weights") // Bones per vertex, optionally followed by -weight_epsilon <smallest weight kept>
+            {
+                size_t Limit = std::stoul(Args.at(arg + 1));
+                arg++;
+
+                float Epsilon = 0.0f;
+                if (arg + 2 < Args.size() && Args.at(arg + 1) == "-weight_epsilon")
+                {
+                    Epsilon = std::stof(Args.at(arg + 2));
+                    arg += 2;
+                }
+
+                MSHARGS.at(mshi).LimitWeights(Limit, Epsilon);
+            }
+            else if (Args.at(arg) == "-perpixel") // Toggle flag for material or mat 0 if not specified
+            {
+                MSHARGS.at(mshi).SetFlag(mati, 3);
+            }
+            else if (Args.at(arg) == "-specular") // Toggle flag for material or mat 0 if not specified
+            {
+                MSHARGS.at(mshi).SetFlag(mati, 1);
+            }
+            else if (Args.at(arg) == "-emissive") // Toggle flag for material or mat 0 if not specified
+            {
+                MSHARGS.at(mshi).SetFlag(mati, 8);
+            }
+            else if (Args.at(arg) == "-glow") // Toggle flag for material or mat 0 if not specified
+            {
+                MSHARGS.at(mshi).SetFlag(mati, 7);
+            }
+            else if (Args.at(arg) == "-single") // Toggle flag for material or mat 0 if not specified
+            {
+                MSHARGS.at(mshi).SetFlag(mati, 6);
+            }
+            else if (Args.at(arg) == "-double") // Toggle flag for material or mat 0 if not specified
+            {
+                MSHARGS.at(mshi).SetFlag(mati, 5);
+            }
+            else if (Args.at(arg) == "-hard") // Toggle flag for material or mat 0 if not specified
+            {
+                MSHARGS.at(mshi).SetFlag(mati, 4);
+            }
+            else if (Args.at(arg) == "-additive") // Toggle flag for material or mat 0 if not specified
+            {
+                MSHARGS.at(mshi).SetFlag(mati, 2);
+            }
+            else if (Args.at(arg) == "-clustermaterial")
+            {
+                unsigned short mat = std::stoi(Args.at(arg + 1));
+                MSHARGS.at(mshi).SetClusterMaterial(modl, clus, mat);
+                arg++;
+            }
+            else if (Args.at(arg) == "-rt") // Set rendertype for material or mat 0 if not specified
+            {
+                unsigned short NewRT = std::stoi(Args.at(arg + 1));
+                MSHARGS.at(mshi).SetRT(mati, NewRT);
+                arg++;
+            }
+            else if (Args.at(arg) == "-tx0d") // Set TX0D for material or mat 0 if not specified
+            {
+                std::string NewTex = Args.at(arg + 1);
+                MSHARGS.at(mshi).SetTX0D(mati, NewTex);
+                arg++;
+            }
+            else if (Args.at(arg) == "-tx1d") // Set TX1D for material or mat 0 if not specified
+            {
+                std::string NewTex = Args.at(arg + 1);
+                MSHARGS.at(mshi).SetTX1D(mati, NewTex);
+                arg++;
+            }
+            else if (Args.at(arg) == "-tx2d") // Set TX2D for material or mat 0 if not specified
+            {
+                std::string NewTex = Args.at(arg + 1);
+                MSHARGS.at(mshi).SetTX2D(mati, NewTex);
+                arg++;
+            }
+            else if (Args.at(arg) == "-tx3d") // Set TX3D for material or mat 0 if not specified
+            {
+                std::string NewTex = Args.at(arg + 1);
+                MSHARGS.at(mshi).SetTX3D(mati, NewTex);
+                arg++;
+            }
+            else if (Args.at(arg) == "-data0") // Set Data0 for material or mat 0 if not specified
+            {
+                unsigned short NewVal = std::stoi(Args.at(arg + 1));
+                MSHARGS.at(mshi).SetData0(mati, NewVal);
+                arg++;
+            }
+            else if (Args.at(arg) == "-data1") // Set Data1 for material or mat 0 if not specified
+            {
+                unsigned short NewVal = std::stoi(Args.at(arg + 1));
+                MSHARGS.at(mshi).SetData1(mati, NewVal);
+                arg++;
+            }
+            else if (Args.at(arg) == "-clothtexture")
+            {
+                std::string NewClothTex = Args.at(arg + 1);
+                MSHARGS.at(mshi).SetClothTex(modl, NewClothTex);
+                arg++;
+            }
+            else if (Args.at(arg) == "-speculardecay")
+            {
+                unsigned int NewVal = std::stoi(Args.at(arg + 1));
+                MSHARGS.at(mshi).SetSpecularDecay(mati, NewVal);
+                arg++;
+            }
+            else if (Args.at(arg) == "-diffuse_bgra")
+            {
+                float B = std::stof(Args.at(arg + 1));
+                arg++;
+                float G = std::stof(Args.at(arg + 1));
+                arg++;
+                float R = std::stof(Args.at(arg + 1));
+                arg++;
+                float A = std::stof(Args.at(arg + 1));
+                arg++;
+                float RGBA[4] = { R, G, B, A };
+                MSHARGS.at(mshi).SetDiffuseGBRA(mati, RGBA);
+
+            }
+            else if (Args.at(arg) == "-ambient_bgra")
+            {
+                float B = std::stof(Args.at(arg + 1));
+                arg++;
+                float G = std::stof(Args.at(arg + 1));
+                arg++;
+                float R = std::stof(Args.at(arg + 1));
+                arg++;
+                float A = std::stof(Args.at(arg + 1));
+                arg++;
+                float RGBA[4] = { R, G, B, A };
+
+                MSHARGS.at(mshi).SetAmbientGBRA(mati, RGBA);
+            }
+            else if (Args.at(arg) == "-specular_bgra")
+            {
+                float B = std::stof(Args.at(arg + 1));
+                arg++;
+                float G = std::stof(Args.at(arg + 1));
+                arg++;
+                float R = std::stof(Args.at(arg + 1));
+                arg++;
+                float A = std::stof(Args.at(arg + 1));
+                arg++;
+                float RGBA[4] = { R, G, B, A };
+
+                MSHARGS.at(mshi).SetSpecularGBRA(mati, RGBA);
+            }
+            else if (Args.at(arg) == "-dedupe_materials")
+            {
+                MSHARGS.at(mshi).DedupeMaterials();
+            }
+            else if (Args.at(arg) == "-prune_materials")
+            {
+                MSHARGS.at(mshi).PruneMaterials();
+            }
+            else if (Args.at(arg) == "-merge_segments")
+            {
+                MSHARGS.at(mshi).MergeSegments();
+            }
+            else if (Args.at(arg) == "-batch_static")
+            {
+                MSHARGS.at(mshi).BatchStatic();
+            }
+            else if (Args.at(arg) == "-optimize_cache")
+            {
+                MSHARGS.at(mshi).OptimizeCache(false);
+            }
+            else if (Args.at(arg) == "-optimize_overdraw")
+            {
+                MSHARGS.at(mshi).OptimizeCache(true);
+            }
+            else if (Args.at(arg) == "-stripify")
+            {
+                MSHARGS.at(mshi).Stripify();
+            }
+            else if (Args.at(arg) == "-weld") // Position, normal, UV and color (0-255) tolerances
+            {
+                float Position = std::stof(Args.at(arg + 1));
+                arg++;
+                float Normal = std::stof(Args.at(arg + 1));
+                arg++;
+                float UV = std::stof(Args.at(arg + 1));
+                arg++;
+                float Color = std::stof(Args.at(arg + 1));
+                arg++;
+
+                MSHARGS.at(mshi).Weld(Position, Normal, UV, Color);
+            }
+            else if (Args.at(arg) == "-gen_lod") // Fraction of triangles to keep
+            {
+                float Ratio = std::stof(Args.at(arg + 1));
+                arg++;
+
+                MSHARGS.at(mshi).GenerateLOD(Ratio);
+            }
+            else if (Args.at(arg) == "-simplify_collision") // Triangle budget per collision model
+            {
+                size_t Budget = std::stoul(Args.at(arg + 1));
+                arg++;
+
+                MSHARGS.at(mshi).SimplifyCollision(Budget);
+            }
+            else if (Args.at(arg) == "-fit_primitives") // Spare volume allowed, as a fraction of the mesh
+            {
+                float Tolerance = std::stof(Args.at(arg + 1));
+                arg++;
+
+                if (ADVANCEDMODELS)
+                    MSHARGS.at(mshi).FitPrimitives(Tolerance);
+                else
+                    std::cout << "\n -fit_primitives needs ADVANCEDMODELS turned on";
+            }
+            else if (Args.at(arg) == "-stats")
+            {
+                MSHARGS.at(mshi).PrintStats();
+                if (Results)
+                    Results->back().Data = StatsJson(MSHARGS.at(mshi).GetRenderStats());
+            }
+            else if (Args.at(arg) == "-validate")
+            {
+                auto Problems = MSHARGS.at(mshi).ValidateMSH();
+                std::cout << "\n Validate: " << MSHARGS.at(mshi).GetMSHFilename() << ": " << Problems.size() << " problem(s)";
+                for (auto& Problem : Problems)
+                    std::cout << "\n " << std::get<1>(Problem) << " at " << std::get<0>(Problem) << ": " << std::get<2>(Problem);
+                if (Results)
+                    Results->back().Data = ProblemsJson(Problems);
+            }
+            else if (Args.at(arg) == "-diff") // MSH to compare the selected one with
+            {
+                MSH Other;
+                Other.SetMSHFilename(Args.at(arg + 1));
+                arg++;
+
+                if (Load ? Load(Other) : Other.ReadMSH())
+                {
+                    MSHARGS.at(mshi).DiffMSH(Other);
+                    if (Results)
+                    {
+                        std::vector<std::string> Changes = MSHARGS.at(mshi).GetChanges(Other);
+                        Results->back().Data = "[";
+                        for (size_t C = 0; C < Changes.size(); C++)
+                            Results->back().Data += (C > 0 ? ",\"" : "\"") + JsonEscape(Changes.at(C)) + "\"";
+                        Results->back().Data += "]";
+                    }
+                    Other.CloseMSH();
+                }
+                else
+                {
+                    std::cout << " Could not read " << Other.GetMSHFilename() << "!\n";
+                    if (Results)
+                    {
+                        Results->back().Ok = false;
+                        Results->back().Error = "could not read " + Other.GetMSHFilename();
+                    }
+                }
+            }
+            else if (Args.at(arg) == "-size_report") // Folded stacks go next to the MSH (name.msh -> name_size.folded)
+            {
+                std::filesystem::path Folded(MSHARGS.at(mshi).GetMSHFilename());
+                Folded.replace_filename(Folded.stem().string() + "_size.folded");
+
+                MSHARGS.at(mshi).PrintSizeReport(Folded.string());
+            }
+            else if (Args.at(arg) == "-optimize_shadows")
+            {
+                MSHARGS.at(mshi).OptimizeShadows();
+            }
+            else if (Args.at(arg) == "-gen_shadows") // Fraction of the render triangles to keep
+            {
+                float Ratio = std::stof(Args.at(arg + 1));
+                arg++;
+
+                MSHARGS.at(mshi).GenerateShadows(Ratio);
+            }
+            //else if (Args.at(arg) == "-vertexcolor_bgra")
+            //{
+            //    unsigned short B = std::stoi(Args.at(arg + 1));
+            //    arg++;
+            //    unsigned short G = std::stoi(Args.at(arg + 1));
+            //    arg++;
+            //    unsigned short R = std::stoi(Args.at(arg + 1));
+            //    arg++;
+            //    unsigned short A = std::stoi(Args.at(arg + 1));
+            //    arg++;
+            //    unsigned short RGBA[4] = { R, G, B, A };
+            //
+            //    MSHARGS.at(mshi).SetCLRB(modl, clus, RGBA);
+            //}
+            //else if (Args.at(arg) == "-removecolors")
+            //{
+            //    MSHARGS.at(mshi).RemoveColors(modl);
+            //}
+
+            if (Results)
+                Results->back().Args.assign(Args.begin() + First + 1, Args.begin() + arg + 1);
+        }
+    }
+
+    // Writes every changed MSH, returns the filenames written
+    static inline std::vector<std::string> Export(std::vector<MSH>& MSHARGS, bool out)
+    {
+        std::vector<std::string> Written;
+
+        // Export the MSHs
+        for (unsigned short mshs = 0; mshs < MSHARGS.size(); mshs++)
+        {
+            if (MSHARGS.at(mshs).MSHChanged())
+            {
+                // To prevent accidental overwriting
+                if (!out)
+                    MSHARGS.at(mshs).SetMSHFilename(NewFilename(MSHARGS.at(mshs).GetMSHFilename()));
+
+                MSHARGS.at(mshs).PrepMSHForWrite();
+                if (MSHARGS.at(mshs).WriteMSH())
+                    Written.push_back(MSHARGS.at(mshs).GetMSHFilename());
+            }
+        }
+
+        return Written;
+    }
+
+    // Returns the name edits are saved under unless -out is given (name.msh -> name_new.msh)
+    static inline std::string NewFilename(std::string Name)
+    {
+        //if (std::regex_match(NewName, std::regex("(.*)(\\.msh)")))
+        Name.at(Name.size() - 4) = '_';
+        Name.at(Name.size() - 3) = 'n';
+        Name.at(Name.size() - 2) = 'e';
+        Name.at(Name.size() - 1) = 'w';
+        Name.push_back('.');
+        Name.push_back('m');
+        Name.push_back('s');
+        Name.push_back('h');
+
+        return Name;
+    }
+
+    // Splits a line into whitespace separated arguments ("quoted" arguments may hold spaces)
+    static inline std::vector<std::string> Tokenize(const std::string& Line)
+    {
+        std::vector<std::string> Tokens;
+        std::string Current;
+        bool Quoted = false;
+        bool HasToken = false;
+
+        for (char ch : Line)
+        {
+            if (ch == '"')
+            {
+                Quoted = !Quoted;
+                HasToken = true;
+            }
+            else if (!Quoted && std::isspace(static_cast<unsigned char>(ch)))
+            {
+                if (HasToken)
+                    Tokens.push_back(Current);
+                Current.clear();
+                HasToken = false;
+            }
+            else
+            {
+                Current.push_back(ch);
+                HasToken = true;
+            }
+        }
+
+        if (HasToken)
+            Tokens.push_back(Current);
+
+        return Tokens;
+    }
+
+    // Escapes a string so it can be placed between quotes in JSON output
+    static inline std::string JsonEscape(const std::string& Str)
+    {
+        std::string Escaped;
+        Escaped.reserve(Str.size());
+
+        for (unsigned char ch : Str)
+        {
+            if (ch == 0) // Padded MSH names carry trailing NULLs
+                continue;
+            else if (ch == '"' || ch == '\\')
+            {
+                Escaped.push_back('\\');
+                Escaped.push_back(ch);
+            }
+            else if (ch == '\n')
+                Escaped += "\\n";
+            else if (ch == '\t')
+                Escaped += "\\t";
+            else if (ch < 0x20)
+            {
+                char Code[8];
+                std::snprintf(Code, sizeof(Code), "\\u%04x", ch);
+                Escaped += Code;
+            }
+            else
+                Escaped.push_back(ch);
+        }
+
+        return Escaped;
+    }
+
+    // Returns whether the first argument names a standalone mode instead of a MSH file
+    static inline bool IsMode(const std::string& Arg)
+    {
+        return Arg == "serve" || Arg == "watch" || Arg == "diff" || Arg == "validate" || Arg == "repair" || Arg == "merge" || Arg == "split"
+            || Arg == "stats" || Arg == "size_report";
+    }
+
+    // Finds the MSH files in a list of files and directories (searched recursively)
+    static inline std::vector<std::string> FindMSHFiles(const std::vector<std::string>& Paths)
+    {
+        std::vector<std::string> Files;
+        auto IsMSH = [](const std::filesystem::path& Path)
+        {
+            std::string Extension = Path.extension().string();
+            for (char& ch : Extension)
+                ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+            return Extension == ".msh";
+        };
+
+        for (const std::string& Path : Paths)
+        {
+            std::error_code Error;
+            if (std::filesystem::is_directory(Path, Error))
+            {
+                for (auto& Entry : std::filesystem::recursive_directory_iterator(Path, Error))
+                    if (Entry.is_regular_file(Error) && IsMSH(Entry.path()))
+                        Files.push_back(Entry.path().string());
+            }
+            else
+                Files.push_back(Path);
+        }
+
+        std::sort(Files.begin(), Files.end());
+        return Files;
+    }
+
+    // Checks every MSH in Paths on all cores and prints one line of JSON per file, then a summary
+    static inline int Validate(const std::vector<std::string>& Paths)
+    {
+        std::vector<std::string> Files = FindMSHFiles(Paths);
+        std::vector<std::string> Reports(Files.size());
+        std::vector<char> Valid(Files.size(), 0);
+
+        {
+            ThreadPool Pool(std::thread::hardware_concurrency());
+            for (size_t F = 0; F < Files.size(); F++)
+            {
+                Pool.Submit([&Files, &Reports, &Valid, F]
+                {
+                    std::string Report = "{\"file\":\"" + JsonEscape(Files.at(F)) + "\"";
+                    try
+                    {
+                        MSH MSHFile;
+                        MSHFile.SetMSHFilename(Files.at(F));
+                        if (!MSHFile.LoadMSH())
+                        {
+                            Reports.at(F) = Report + ",\"ok\":false,\"error\":\"could not be read\"}";
+                            return;
+                        }
+
+                        auto Problems = MSHFile.ValidateMSH();
+                        MSHFile.CloseMSH();
+
+                        Valid.at(F) = Problems.empty();
+                        Report += Problems.empty() ? ",\"ok\":true,\"problems\":" : ",\"ok\":false,\"problems\":";
+                        Reports.at(F) = Report + ProblemsJson(Problems) + "}";
+                    }
+                    catch (const std::exception& e)
+                    {
+                        // One bad file must not take down the whole run
+                        Valid.at(F) = 0;
+                        Reports.at(F) = "{\"file\":\"" + JsonEscape(Files.at(F)) + "\",\"ok\":false,\"error\":\"" + JsonEscape(e.what()) + "\"}";
+                    }
+                });
+            }
+        }
+
+        size_t Invalid = 0;
+        for (size_t F = 0; F < Files.size(); F++)
+        {
+            std::cout << Reports.at(F) << "\n";
+            if (!Valid.at(F))
+                Invalid++;
+        }
+
+        std::cout << "{\"files\":" << Files.size() << ",\"invalid\":" << Invalid << "}\n";
+        return Invalid > 0 ? 1 : 0;
+    }
+
+    // Repairs every MSH in Paths on all cores, saving fixed files as _new.msh (or over the original with -overwrite)
+    // Prints one line of JSON per file, then a summary
+    static inline int Repair(const std::vector<std::string>& Paths, bool Overwrite)
+    {
+        std::vector<std::string> Files = FindMSHFiles(Paths);
+        std::vector<std::string> Reports(Files.size());
+        std::vector<char> Failed(Files.size(), 0);
+        std::vector<char> Repaired(Files.size(), 0);
+
+        {
+            ThreadPool Pool(std::thread::hardware_concurrency());
+            for (size_t F = 0; F < Files.size(); F++)
+            {
+                Pool.Submit([&Files, &Reports, &Failed, &Repaired, Overwrite, F]
+                {
+                    std::string Report = "{\"file\":\"" + JsonEscape(Files.at(F)) + "\"";
+                    try
+                    {
+                        MSH MSHFile;
+                        MSHFile.SetMSHFilename(Files.at(F));
+                        if (!MSHFile.LoadMSH())
+                        {
+                            Failed.at(F) = 1;
+                            Reports.at(F) = Report + ",\"ok\":false,\"error\":\"could not be read\"}";
+                            return;
+                        }
+
+                        std::vector<std::string> Fixes = MSHFile.RepairMSH();
+                        bool Valid = MSHFile.ValidateMSH().empty();
+
+                        // Only write files that actually changed
+                        std::string Written;
+                        if (MSHFile.MSHChanged())
+                        {
+                            if (!Overwrite)
+                                MSHFile.SetMSHFilename(NewFilename(MSHFile.GetMSHFilename()));
+
+                            // Quiet, as the console is shared by every job and the report says what was written
+                            if (MSHFile.WriteMSH(true))
+                                Written = MSHFile.GetMSHFilename();
+                        }
+                        MSHFile.CloseMSH();
+
+                        Repaired.at(F) = !Written.empty();
+                        Failed.at(F) = !Valid || (!Fixes.empty() && Written.empty());
+
+                        Report += Failed.at(F) ? ",\"ok\":false" : ",\"ok\":true";
+                        Report += Valid ? ",\"valid\":true" : ",\"valid\":false";
+                        Report += ",\"written\":\"" + JsonEscape(Written) + "\",\"fixes\":[";
+                        for (size_t X = 0; X < Fixes.size(); X++)
+                            Report += (X > 0 ? ",\"" : "\"") + JsonEscape(Fixes.at(X)) + "\"";
+                        Reports.at(F) = Report + "]}";
+                    }
+                    catch (const std::exception& e)
+                    {
+                        Failed.at(F) = 1;
+                        Reports.at(F) = "{\"file\":\"" + JsonEscape(Files.at(F)) + "\",\"ok\":false,\"error\":\"" + JsonEscape(e.what()) + "\"}";
+                    }
+                });
+            }
+        }
+
+        size_t FailedCount = 0;
+        size_t RepairedCount = 0;
+        for (size_t F = 0; F < Files.size(); F++)
+        {
+            std::cout << Reports.at(F) << "\n";
+            FailedCount += Failed.at(F) ? 1 : 0;
+            RepairedCount += Repaired.at(F) ? 1 : 0;
+        }
+
+        std::cout << "{\"files\":" << Files.size() << ",\"repaired\":" << RepairedCount << ",\"failed\":" << FailedCount << "}\n";
+        return FailedCount > 0 ? 1 : 0;
+    }
+
+    // Returns the problems ValidateMSH found as a JSON array
+    static inline std::string ProblemsJson(const std::vector<std::tuple<size_t, std::string, std::string>>& Problems)
+    {
+        std::string Json = "[";
+        for (size_t P = 0; P < Problems.size(); P++)
+        {
+            Json += (P > 0 ? "," : "");
+            Json += "{\"offset\":" + std::to_string(std::get<0>(Problems.at(P)));
+            Json += ",\"chunk\":\"" + JsonEscape(std::get<1>(Problems.at(P))) + "\"";
+            Json += ",\"message\":\"" + JsonEscape(std::get<2>(Problems.at(P))) + "\"}";
+        }
+
+        return Json + "]";
+    }
+
+    // Returns the render stats of each model and their total as a JSON object
+    static inline std::string StatsJson(const std::vector<RenderStats>& Models)
+    {
+        RenderStats Total;
+        Total.Name = "TOTAL";
+
+        std::string Json = "{\"models\":[";
+        for (size_t M = 0; M < Models.size(); M++)
+        {
+            Json += (M > 0 ? "," : "") + StatsJson(Models.at(M));
+            Total.Add(Models.at(M));
+        }
+
+        return Json + "],\"total\":" + StatsJson(Total) + "}";
+    }
+
+    // Returns the render stats as a JSON object
+    static inline std::string StatsJson(const RenderStats& Stats)
+    {
+        std::ostringstream Out;
+        Out << "{\"name\":\"" << JsonEscape(Stats.Name) << "\",\"segments\":" << Stats.Segments
+            << ",\"draw_calls\":" << Stats.DrawCalls << ",\"vertices\":" << Stats.Vertices << ",\"triangles\":" << Stats.Triangles
+            << ",\"acmr\":" << Stats.ACMR() << ",\"vertex_bytes\":" << Stats.VertexBytes << ",\"index_bytes\":" << Stats.IndexBytes
+            << ",\"clrl_bytes\":" << Stats.ColorBytes << ",\"wght_bytes\":" << Stats.WeightBytes << "}";
+        return Out.str();
+    }
+
+    // Reports the render cost of every MSH in Paths on all cores, per model and per file, then over all of them
+    // Prints tables, or one line of JSON per file and a summary line with Json
+    static inline int Stats(const std::vector<std::string>& Paths, bool Json)
+    {
+        std::vector<std::string> Files = FindMSHFiles(Paths);
+        std::vector<std::string> Reports(Files.size());
+        std::vector<RenderStats> Totals(Files.size());
+        std::vector<char> Failed(Files.size(), 0);
+
+        {
+            ThreadPool Pool(std::thread::hardware_concurrency());
+            for (size_t F = 0; F < Files.size(); F++)
+            {
+                Pool.Submit([&Files, &Reports, &Totals, &Failed, Json, F]
+                {
+                    try
+                    {
+                        MSH MSHFile;
+                        MSHFile.SetMSHFilename(Files.at(F));
+                        Totals.at(F).Name = Files.at(F);
+                        if (!MSHFile.ReadMSH())
+                        {
+                            Failed.at(F) = 1;
+                            Reports.at(F) = Json ? "{\"file\":\"" + JsonEscape(Files.at(F)) + "\",\"ok\":false,\"error\":\"could not be read\"}"
+                                : " Stats: could not read " + Files.at(F);
+                            return;
+                        }
+
+                        std::vector<RenderStats> Models = MSHFile.GetRenderStats();
+                        MSHFile.CloseMSH();
+
+                        std::string Report = Json ? "{\"file\":\"" + JsonEscape(Files.at(F)) + "\",\"ok\":true,\"models\":["
+                            : " Stats: " + Files.at(F) + "\n" + RenderStats::Heading();
+                        for (size_t M = 0; M < Models.size(); M++)
+                        {
+                            Report += Json ? (M > 0 ? "," : "") + StatsJson(Models.at(M)) : "\n" + Models.at(M).Row();
+                            Totals.at(F).Add(Models.at(M));
+                        }
+
+                        RenderStats Total = Totals.at(F);
+                        Total.Name = "TOTAL";
+                        Reports.at(F) = Report + (Json ? "],\"total\":" + StatsJson(Total) + "}" : "\n" + Total.Row());
+                    }
+                    catch (const std::exception& e)
+                    {
+                        // A file that failed halfway adds nothing to the sums
+                        Failed.at(F) = 1;
+                        Totals.at(F) = RenderStats();
+                        Totals.at(F).Name = Files.at(F);
+                        Reports.at(F) = Json ? "{\"file\":\"" + JsonEscape(Files.at(F)) + "\",\"ok\":false,\"error\":\"" + JsonEscape(e.what()) + "\"}"
+                            : " Stats: could not read " + Files.at(F) + ": " + e.what();
+                    }
+                });
+            }
+        }
+
+        RenderStats Corpus;
+        Corpus.Name = "ALL FILES";
+        size_t FailedCount = 0;
+        for (size_t F = 0; F < Files.size(); F++)
+        {
+            std::cout << Reports.at(F) << "\n";
+            FailedCount += Failed.at(F);
+            Corpus.Add(Totals.at(F));
+        }
+
+        if (Json)
+            std::cout << "{\"files\":" << Files.size() << ",\"failed\":" << FailedCount << ",\"total\":" << StatsJson(Corpus) << "}\n";
+        else
+            std::cout << "\n" << RenderStats::Heading() << "\n" << Corpus.Row() << "\n";
+
+        return FailedCount > 0 ? 1 : 0;
+    }
+
+    // Attributes the bytes of every MSH in Paths to chunk paths on all cores and prints the sizes over all of them
+    // Writes the same as folded stacks to FoldedFile (if given) for flamegraph tools
+    static inline int SizeReports(const std::vector<std::string>& Paths, const std::string& FoldedFile)
+    {
+        std::vector<std::string> Files = FindMSHFiles(Paths);
+        std::vector<SizeReport> Reports(Files.size());
+        std::vector<char> Failed(Files.size(), 0);
+        std::vector<std::string> Errors(Files.size());
+
+        {
+            ThreadPool Pool(std::thread::hardware_concurrency());
+            for (size_t F = 0; F < Files.size(); F++)
+            {
+                Pool.Submit([&Files, &Reports, &Failed, &Errors, F]
+                {
+                    try
+                    {
+                        MSH MSHFile;
+                        MSHFile.SetMSHFilename(Files.at(F));
+                        if (!MSHFile.ReadMSH())
+                        {
+                            Failed.at(F) = 1;
+                            return;
+                        }
+
+                        Reports.at(F) = MSHFile.GetSizeReport();
+                        MSHFile.CloseMSH();
+                    }
+                    catch (const std::exception& e)
+                    {
+                        // A file that failed halfway adds nothing to the sums
+                        Failed.at(F) = 1;
+                        Errors.at(F) = e.what();
+                        Reports.at(F) = SizeReport();
+                    }
+                });
+            }
+        }
+
+        SizeReport Corpus;
+        size_t FailedCount = 0;
+        for (size_t F = 0; F < Files.size(); F++)
+        {
+            if (Failed.at(F))
+                std::cout << " Size report: could not read " << Files.at(F) << (Errors.at(F).empty() ? "" : ": " + Errors.at(F)) << "\n";
+
+            FailedCount += Failed.at(F);
+            Corpus.Add(Reports.at(F));
+        }
+
+        std::cout << " Size report: " << Corpus.Files << " file(s)\n" << Corpus.Table() << "\n";
+
+        if (!FoldedFile.empty())
+        {
+            std::ofstream Out(FoldedFile, std::ios::out | std::ios::binary);
+            if (!Out.is_open())
+            {
+                std::cout << " Could not write " << FoldedFile << "!\n";
+                return 1;
+            }
+
+            Out << Corpus.Folded();
+            std::cout << " Folded stacks written to " << FoldedFile << "\n";
+        }
+
+        return FailedCount > 0 ? 1 : 0;
+    }
+
+    // Writes each root hierarchy (or each model) of an MSH to its own file, all at once
+    static inline int Split(const std::string& FileName, bool PerModel, std::string OutDirectory)
+    {
+        MSH MSHFile;
+        MSHFile.SetMSHFilename(FileName);
+        if (!MSHFile.ReadMSH())
+        {
+            std::cout << " Could not read " << FileName << "!\n";
+            return 1;
+        }
+
+        std::filesystem::path Source(FileName);
+        if (OutDirectory.empty())
+            OutDirectory = Source.parent_path().string();
+
+        std::error_code Error;
+        if (!OutDirectory.empty())
+            std::filesystem::create_directories(OutDirectory, Error);
+
+        std::vector<std::vector<size_t>> Groups = MSHFile.GetModelGroups(PerModel);
+        std::vector<std::string> Results(Groups.size());
+        std::vector<char> Failed(Groups.size(), 0);
+
+        // Named after the file and the group's first model (root)
+        // Names can repeat (or clean up to the same thing), so later ones get _2, _3... and no two jobs write one file
+        std::vector<std::filesystem::path> OutFiles;
+        std::set<std::string> Taken;
+        for (size_t G = 0; G < Groups.size(); G++)
+        {
+            std::string Name = MSHFile.GetModelName(Groups.at(G).front());
+            for (char& ch : Name)
+                if (!std::isalnum(static_cast<unsigned char>(ch)) && ch != '_' && ch != '-')
+                    ch = '_';
+
+            std::string Stem = Source.stem().string() + "_" + Name;
+            std::string Unique = Stem;
+            for (size_t N = 2; true; N++)
+            {
+                // Compared without case, as on Windows
+                std::string Key;
+                for (unsigned char ch : Unique)
+                    Key.push_back(static_cast<char>(std::tolower(ch)));
+                if (Taken.insert(Key).second)
+                    break;
+
+                Unique = Stem + "_" + std::to_string(N);
+            }
+
+            OutFiles.push_back(std::filesystem::path(OutDirectory) / (Unique + ".msh"));
+        }
+
+        {
+            ThreadPool Pool(std::thread::hardware_concurrency());
+            for (size_t G = 0; G < Groups.size(); G++)
+            {
+                std::filesystem::path OutFile = OutFiles.at(G);
+                Pool.Submit([&MSHFile, &Groups, &Results, &Failed, G, OutFile]
+                {
+                    try
+                    {
+                        std::vector<unsigned char> Bytes = MSHFile.ExtractModels(Groups.at(G));
+
+                        std::ofstream Out(OutFile, std::ios::out | std::ios::binary);
+                        if (Bytes.empty() || !Out.is_open())
+                        {
+                            Failed.at(G) = 1;
+                            Results.at(G) = " Split: could not write " + OutFile.string();
+                            return;
+                        }
+
+                        Out.write(reinterpret_cast<const char*>(Bytes.data()), Bytes.size());
+                        Results.at(G) = " Split: " + OutFile.string() + " (" + std::to_string(Groups.at(G).size()) + " model(s))";
+                    }
+                    catch (const std::exception& e)
+                    {
+                        Failed.at(G) = 1;
+                        Results.at(G) = " Split: could not write " + OutFile.string() + ": " + e.what();
+                    }
+                });
+            }
+        }
+
+        MSHFile.CloseMSH();
+
+        size_t FailedCount = 0;
+        for (size_t G = 0; G < Groups.size(); G++)
+        {
+            std::cout << Results.at(G) << "\n";
+            FailedCount += Failed.at(G);
+        }
+
+        return FailedCount > 0 ? 1 : 0;
+    }
+
+    // Runs the standalone mode named by the first argument
+    static int RunMode(int argc, char* argv[]);
+};
+
+// The modes call back into Commands, so they come after it
+#include "Daemon.h"
+
+// Runs the standalone mode named by the first argument
+inline int Commands::RunMode(int argc, char* argv[])
+{
+    std::string Mode = argv[1];
+    std::vector<std::string> Args(argv + 2, argv + argc);
+
+    if (Mode == "serve")
+    {
+        if (Args.empty())
+        {
+            std::cout << " Usage: serve <socket path> [cache size]\n";
+            return 1;
+        }
+
+        size_t Capacity = Args.size() > 1 ? std::stoul(Args.at(1)) : 16;
+        return Daemon::Serve(Args.at(0), Capacity);
+    }
+    else if (Mode == "watch")
+    {
+        if (Args.size() < 2)
+        {
+            std::cout << " Usage: watch <directory> <script> [output directory]\n";
+            return 1;
+        }
+
+        return Daemon::Watch(Args.at(0), Args.at(1), Args.size() > 2 ? Args.at(2) : "");
+    }
+    else if (Mode == "diff")
+    {
+        if (Args.size() < 2)
+        {
+            std::cout << " Usage: diff <old msh> <new msh>\n";
+            return 2;
+        }
+
+        MSH Old;
+        MSH New;
+        Old.SetMSHFilename(Args.at(0));
+        New.SetMSHFilename(Args.at(1));
+        if (!Old.ReadMSH() || !New.ReadMSH())
+        {
+            std::cout << " Could not read both files!\n";
+            return 2;
+        }
+
+        // Like diff: 0 when the same, 1 when there are differences
+        size_t Differences = Old.DiffMSH(New);
+        Old.CloseMSH();
+        New.CloseMSH();
+        return Differences > 0 ? 1 : 0;
+    }
+    else if (Mode == "validate")
+    {
+        if (Args.empty())
+        {
+            std::cout << " Usage: validate <msh files or directories...>\n";
+            return 2;
+        }
+
+        return Validate(Args);
+    }
+    else if (Mode == "repair")
+    {
+        bool Overwrite = std::find(Args.begin(), Args.end(), "-overwrite") != Args.end();
+        Args.erase(std::remove(Args.begin(), Args.end(), "-overwrite"), Args.end());
+        if (Args.empty())
+        {
+            std::cout << " Usage: repair <msh files or directories...> [-overwrite]\n";
+            return 2;
+        }
+
+        return Repair(Args, Overwrite);
+    }
+    else if (Mode == "merge")
+    {
+        if (Args.size() < 3)
+        {
+            std::cout << " Usage: merge <output msh> <msh> <msh> [more msh...]\n";
+            return 1;
+        }
+
+        MSH Merged;
+        Merged.SetMSHFilename(Args.at(1));
+        if (!Merged.ReadMSH())
+        {
+            std::cout << " Could not read " << Args.at(1) << "!\n";
+            return 1;
+        }
+
+        for (size_t F = 2; F < Args.size(); F++)
+        {
+            MSH MSHFile;
+            MSHFile.SetMSHFilename(Args.at(F));
+            if (!MSHFile.ReadMSH())
+            {
+                std::cout << " Could not read " << Args.at(F) << "!\n";
+                Merged.CloseMSH();
+                return 1;
+            }
+
+            Merged.MergeMSH(MSHFile);
+            MSHFile.CloseMSH();
+        }
+
+        // MergeMSH rebuilt Data with consistent sizes, so there are no pending edits for PrepMSHForWrite to bake in
+        Merged.SetMSHFilename(Args.at(0));
+        Merged.PrepMSHForWrite();
+        bool Written = Merged.WriteMSH();
+        Merged.CloseMSH();
+        std::cout << "\n";
+        return Written ? 0 : 1;
+    }
+    else if (Mode == "split")
+    {
+        bool PerModel = false;
+        std::string OutDirectory;
+        std::string FileName;
+        for (size_t A = 0; A < Args.size(); A++)
+        {
+            if (Args.at(A) == "-models")
+                PerModel = true;
+            else if (Args.at(A) == "-out" && A + 1 < Args.size())
+                OutDirectory = Args.at(++A);
+            else
+                FileName = Args.at(A);
+        }
+
+        if (FileName.empty())
+        {
+            std::cout << " Usage: split <msh> [-models] [-out directory]\n";
+            return 1;
+        }
+
+        return Split(FileName, PerModel, OutDirectory);
+    }
+    else if (Mode == "stats")
+    {
+        bool Json = std::find(Args.begin(), Args.end(), "-json") != Args.end();
+        Args.erase(std::remove(Args.begin(), Args.end(), "-json"), Args.end());
+        if (Args.empty())
+        {
+            std::cout << " Usage: stats <msh files or directories...> [-json]\n";
+            return 2;
+        }
+
+        return Stats(Args, Json);
+    }
+    else if (Mode == "size_report")
+    {
+        std::string FoldedFile;
+        std::vector<std::string> Paths;
+        for (size_t A = 0; A < Args.size(); A++)
+        {
+            if (Args.at(A) == "-folded" && A + 1 < Args.size())
+                FoldedFile = Args.at(++A);
+            else
+                Paths.push_back(Args.at(A));
+        }
+
+        if (Paths.empty())
+        {
+            std::cout << " Usage: size_report <msh files or directories...> [-folded output file]\n";
+            return 2;
+        }
+
+        return SizeReports(Paths, FoldedFile);
+    }
+
+    return 1;
+}
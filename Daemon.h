@@ -0,0 +1,631 @@
+#pragma once
+#include <list>
+#include <unordered_map>
+#include <csignal>
+#include <cerrno>
+#include <chrono>
+#include <map>
+#include <set>
+#include "ThreadPool.h"
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Static functions for the long running modes
+class Daemon
+{
+public:
+
+    // Seconds a client may stay silent before serve hangs up on it
+    static const int ClientTimeout = 10;
+
+    // Listens on a Unix domain socket and runs batch requests against recently used MSHs
+    // Each request is one line in the commandline vocabulary, e.g.
+    //   props/crate.msh -listmodels -model 2 -modelname crate_top -out props/crate.msh
+    // and is answered with one line of JSON: overall ok, the files written, and under "ops" each op's
+    // arguments, ok/error, the file its MSH was written to (for filenames), its data (-stats, -validate, -diff) and output
+    static inline int Serve(const std::string& SocketPath, size_t Capacity)
+    {
+#ifdef _WIN32
+        std::cout << " serve mode needs Unix domain sockets and isn't available on Windows yet\n";
+        return 1;
+#else
+        sockaddr_un Address;
+        std::memset(&Address, 0, sizeof(Address));
+        Address.sun_family = AF_UNIX;
+        if (SocketPath.size() >= sizeof(Address.sun_path))
+        {
+            std::cout << " Socket path is too long!\n";
+            return 1;
+        }
+        std::strncpy(Address.sun_path, SocketPath.c_str(), sizeof(Address.sun_path) - 1);
+
+        int Server = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (Server < 0)
+        {
+            std::cout << " Could not create socket!\n";
+            return 1;
+        }
+
+        // Clear out a socket left behind by a previous run
+        unlink(SocketPath.c_str());
+        if (bind(Server, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) != 0 || listen(Server, 16) != 0)
+        {
+            std::cout << " Could not listen on " << SocketPath << "!\n";
+            close(Server);
+            return 1;
+        }
+
+        // A client hanging up early shouldn't take the daemon down with it
+        std::signal(SIGPIPE, SIG_IGN);
+
+        if (Capacity == 0)
+            Capacity = 1;
+
+        // Most recently used MSH at the front
+        std::list<CachedMSH> Cache;
+        std::unordered_map<std::string, std::list<CachedMSH>::iterator> Index;
+
+        std::cout << " MSH Console serving on " << SocketPath << " (keeping up to " << Capacity << " MSHs)\n";
+
+        bool Running = true;
+        while (Running)
+        {
+            int Client = accept(Server, nullptr, nullptr);
+            if (Client < 0)
+                continue;
+
+            // Clients are served one at a time, so one that goes quiet (or stops reading) is dropped instead of blocking the rest
+            timeval Timeout = { ClientTimeout, 0 };
+            setsockopt(Client, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+            setsockopt(Client, SOL_SOCKET, SO_SNDTIMEO, &Timeout, sizeof(Timeout));
+
+            // Read requests line by line until the client hangs up
+            std::string Pending;
+            char Buffer[4096];
+            ssize_t Received = 0;
+            while (Running && (Received = recv(Client, Buffer, sizeof(Buffer), 0)) > 0)
+            {
+                Pending.append(Buffer, static_cast<size_t>(Received));
+
+                size_t LineEnd = 0;
+                while (Running && (LineEnd = Pending.find('\n')) != std::string::npos)
+                {
+                    std::string Line = Pending.substr(0, LineEnd);
+                    Pending.erase(0, LineEnd + 1);
+
+                    std::vector<std::string> Args = Commands::Tokenize(Line);
+                    if (Args.empty())
+                        continue;
+
+                    std::string Response;
+                    if (Args.at(0) == "shutdown")
+                    {
+                        Response = "{\"ok\":true,\"shutdown\":true}";
+                        Running = false;
+                    }
+                    else
+                        Response = HandleRequest(Args, Cache, Index, Capacity);
+
+                    Response.push_back('\n');
+                    if (!SendAll(Client, Response))
+                        break;
+                }
+            }
+
+            close(Client);
+        }
+
+        // Free everything still cached
+        for (CachedMSH& Entry : Cache)
+            Entry.File.CloseMSH();
+
+        close(Server);
+        unlink(SocketPath.c_str());
+        return 0;
+#endif
+    }
+
+    // Watches a directory (and its subdirectories) and runs an op script on every MSH written there
+    // The script holds the same -options as the commandline, # starts a comment
+    // Results go next to the source as _new.msh, or into OutDirectory if given
+    static inline int Watch(const std::string& Directory, const std::string& ScriptPath, const std::string& OutDirectory)
+    {
+#ifdef _WIN32
+        std::cout << " watch mode needs inotify and isn't available on Windows yet\n";
+        return 1;
+#else
+        std::vector<std::string> Script;
+        if (!ReadScript(ScriptPath, Script))
+        {
+            std::cout << " Could not read script " << ScriptPath << "!\n";
+            return 1;
+        }
+
+        int Notify = inotify_init1(IN_CLOEXEC);
+        if (Notify < 0)
+        {
+            std::cout << " Could not start inotify!\n";
+            return 1;
+        }
+
+        // Watch descriptor to the directory it watches
+        std::unordered_map<int, std::string> Watched;
+        AddWatches(Notify, Directory, Watched);
+        if (Watched.empty())
+        {
+            std::cout << " Could not watch " << Directory << "!\n";
+            close(Notify);
+            return 1;
+        }
+
+        if (!OutDirectory.empty())
+        {
+            std::error_code Error;
+            std::filesystem::create_directories(OutDirectory, Error);
+        }
+
+        // Files that changed, and when they count as finished (writes come in bursts)
+        std::map<std::string, std::chrono::steady_clock::time_point> Pending;
+        const std::chrono::milliseconds Settle(250);
+
+        WatchState State;
+        ThreadPool Pool(std::thread::hardware_concurrency());
+
+        std::cout << " MSH Console watching " << Directory << " with " << Script.size() << " script arguments" << std::endl;
+
+        alignas(inotify_event) char Buffer[16384];
+        while (true)
+        {
+            // Sleep until something happens, or until the next pending file settles
+            int Timeout = -1;
+            if (!Pending.empty())
+            {
+                auto Next = Pending.begin()->second;
+                for (auto& Entry : Pending)
+                    Next = std::min(Next, Entry.second);
+
+                auto Wait = std::chrono::duration_cast<std::chrono::milliseconds>(Next - std::chrono::steady_clock::now());
+                Timeout = static_cast<int>(std::max<long long>(0, Wait.count()));
+            }
+
+            pollfd Poll = { Notify, POLLIN, 0 };
+            int Ready = poll(&Poll, 1, Timeout);
+            if (Ready < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+
+            if (Ready > 0)
+            {
+                ssize_t Length = read(Notify, Buffer, sizeof(Buffer));
+                if (Length <= 0)
+                    continue;
+
+                for (ssize_t Offset = 0; Offset < Length;)
+                {
+                    const inotify_event* Event = reinterpret_cast<const inotify_event*>(Buffer + Offset);
+                    Offset += sizeof(inotify_event) + Event->len;
+
+                    // Directory went away
+                    if (Event->mask & IN_IGNORED)
+                    {
+                        Watched.erase(Event->wd);
+                        continue;
+                    }
+
+                    auto Dir = Watched.find(Event->wd);
+                    if (Event->len == 0 || Dir == Watched.end())
+                        continue;
+
+                    std::string Path = Dir->second + "/" + Event->name;
+
+                    // Pick up new subdirectories
+                    if (Event->mask & IN_ISDIR)
+                    {
+                        if (Event->mask & (IN_CREATE | IN_MOVED_TO))
+                            AddWatches(Notify, Path, Watched);
+                        continue;
+                    }
+
+                    if (IsSourceMSH(Path))
+                        Pending[Path] = std::chrono::steady_clock::now() + Settle;
+                }
+            }
+
+            // Hand the settled files to the workers
+            auto Now = std::chrono::steady_clock::now();
+            for (auto Entry = Pending.begin(); Entry != Pending.end();)
+            {
+                if (Entry->second <= Now)
+                {
+                    Queue(Pool, State, Entry->first, Script, OutDirectory);
+                    Entry = Pending.erase(Entry);
+                }
+                else
+                    Entry++;
+            }
+        }
+
+        close(Notify);
+        return 1;
+#endif
+    }
+
+private:
+
+    // A parsed MSH kept around between requests
+    class CachedMSH
+    {
+    public:
+
+        // Absolute path the MSH was read from
+        std::string Path;
+
+        // The parsed MSH, never edited directly (requests work on clones)
+        MSH File;
+
+        // File size and time when it was read, to notice changes on disk
+        uint64_t FileSize = 0;
+        int64_t FileTime = 0;
+    };
+
+    // Shared between the watch loop and its workers
+    class WatchState
+    {
+    public:
+
+        // Guards everything below (and keeps result lines whole)
+        std::mutex Mutex;
+
+        // Files a worker is on right now
+        std::set<std::string> Busy;
+
+        // Busy files that changed again and need another pass
+        std::set<std::string> Again;
+
+        // Files we wrote ourselves and their size and time, so our own output isn't processed again
+        std::map<std::string, std::pair<uint64_t, int64_t>> Written;
+    };
+
+    // Reads the op script into arguments, dropping # comments
+    static inline bool ReadScript(const std::string& ScriptPath, std::vector<std::string>& Script)
+    {
+        std::ifstream In(ScriptPath);
+        if (!In.is_open())
+            return false;
+
+        std::string Line;
+        while (std::getline(In, Line))
+        {
+            size_t Comment = Line.find('#');
+            if (Comment != std::string::npos)
+                Line.erase(Comment);
+
+            for (const std::string& Arg : Commands::Tokenize(Line))
+                Script.push_back(Arg);
+        }
+
+        return true;
+    }
+
+    // Returns whether a path is an MSH to process (and not one of our _new.msh outputs)
+    static inline bool IsSourceMSH(const std::string& Path)
+    {
+        std::string Lower;
+        for (unsigned char ch : Path)
+            Lower.push_back(std::tolower(ch));
+
+        if (Lower.size() < 4 || Lower.compare(Lower.size() - 4, 4, ".msh") != 0)
+            return false;
+
+        return Lower.size() < 8 || Lower.compare(Lower.size() - 8, 8, "_new.msh") != 0;
+    }
+
+#ifndef _WIN32
+    // Watches a directory and everything below it
+    static inline void AddWatches(int Notify, const std::string& Directory, std::unordered_map<int, std::string>& Watched)
+    {
+        const uint32_t Mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+        int Descriptor = inotify_add_watch(Notify, Directory.c_str(), Mask);
+        if (Descriptor < 0)
+            return;
+        Watched[Descriptor] = Directory;
+
+        std::error_code Error;
+        for (auto& Entry : std::filesystem::recursive_directory_iterator(Directory, Error))
+        {
+            if (Entry.is_directory(Error))
+            {
+                Descriptor = inotify_add_watch(Notify, Entry.path().string().c_str(), Mask);
+                if (Descriptor >= 0)
+                    Watched[Descriptor] = Entry.path().string();
+            }
+        }
+    }
+#endif
+
+    // Hands a file to the workers, unless it's our own output or already being worked on
+    static inline void Queue(ThreadPool& Pool, WatchState& State, const std::string& Path,
+        const std::vector<std::string>& Script, const std::string& OutDirectory)
+    {
+        {
+            std::lock_guard<std::mutex> Lock(State.Mutex);
+
+            auto Ours = State.Written.find(Path);
+            if (Ours != State.Written.end())
+            {
+                uint64_t FileSize = 0;
+                int64_t FileTime = 0;
+                bool Same = GetFileStamp(Path, FileSize, FileTime) && Ours->second == std::make_pair(FileSize, FileTime);
+                State.Written.erase(Ours);
+                if (Same)
+                    return;
+            }
+
+            // The running worker will take another pass when it's done
+            if (State.Busy.count(Path))
+            {
+                State.Again.insert(Path);
+                return;
+            }
+
+            State.Busy.insert(Path);
+        }
+
+        Pool.Submit([&State, Path, &Script, &OutDirectory]
+        {
+            while (true)
+            {
+                ApplyScript(State, Path, Script, OutDirectory);
+
+                std::lock_guard<std::mutex> Lock(State.Mutex);
+                if (State.Again.erase(Path) == 0)
+                {
+                    State.Busy.erase(Path);
+                    return;
+                }
+            }
+        });
+    }
+
+    // Runs the op script on one file and writes the result
+    static inline void ApplyScript(WatchState& State, const std::string& Path,
+        const std::vector<std::string>& Script, const std::string& OutDirectory)
+    {
+        std::vector<std::string> Args;
+        Args.push_back(Path);
+        Args.insert(Args.end(), Script.begin(), Script.end());
+
+        std::vector<MSH> MSHARGS;
+        std::vector<std::string> Written;
+        std::string Failure;
+        std::string Output;
+        bool out = false;
+
+        try
+        {
+            // Other workers print at the same time, so this file's output is held back and printed in one piece
+            ConsoleCapture Capture(Output);
+            Commands::Execute(MSHARGS, Args, out);
+
+            // Send everything to the output directory under the original name
+            if (!OutDirectory.empty())
+            {
+                for (MSH& MSHFile : MSHARGS)
+                {
+                    std::filesystem::path Name = std::filesystem::path(MSHFile.GetMSHFilename()).filename();
+                    MSHFile.SetMSHFilename((std::filesystem::path(OutDirectory) / Name).string());
+                }
+                out = true;
+            }
+
+            Written = Commands::Export(MSHARGS, out);
+        }
+        catch (const std::exception& e)
+        {
+            Failure = e.what();
+        }
+
+        for (MSH& MSHFile : MSHARGS)
+            MSHFile.CloseMSH();
+
+        std::lock_guard<std::mutex> Lock(State.Mutex);
+        std::cout << Output;
+        if (!Failure.empty())
+            std::cout << "\n Watch: " << Path << " failed: " << Failure << "\n";
+        else if (MSHARGS.empty())
+            std::cout << "\n Watch: " << Path << " could not be read!\n";
+        else if (Written.empty())
+            std::cout << "\n Watch: " << Path << " needed no changes\n";
+
+        for (const std::string& File : Written)
+        {
+            std::cout << "\n Watch: " << Path << " -> " << File << "\n";
+
+            uint64_t FileSize = 0;
+            int64_t FileTime = 0;
+            if (GetFileStamp(File, FileSize, FileTime))
+                State.Written[File] = std::make_pair(FileSize, FileTime);
+        }
+
+        std::cout.flush();
+    }
+
+    // Gets the size and time of a file, false if it can't be found
+    static inline bool GetFileStamp(const std::string& Path, uint64_t& FileSize, int64_t& FileTime)
+    {
+        std::error_code Error;
+        FileSize = std::filesystem::file_size(Path, Error);
+        if (Error)
+            return false;
+
+        auto Time = std::filesystem::last_write_time(Path, Error);
+        if (Error)
+            return false;
+
+        FileTime = static_cast<int64_t>(Time.time_since_epoch().count());
+        return true;
+    }
+
+    // Runs one request and returns its JSON result
+    static inline std::string HandleRequest(const std::vector<std::string>& Args, std::list<CachedMSH>& Cache,
+        std::unordered_map<std::string, std::list<CachedMSH>::iterator>& Index, size_t Capacity)
+    {
+        unsigned int Hits = 0;
+        unsigned int Misses = 0;
+
+        // Hands out clones of cached MSHs, reading (and caching) any that are missing or stale
+        auto Load = [&](MSH& MSHFile) -> bool
+        {
+            std::error_code Error;
+            std::string Path = std::filesystem::absolute(MSHFile.GetMSHFilename(), Error).string();
+
+            uint64_t FileSize = 0;
+            int64_t FileTime = 0;
+            if (Error || !GetFileStamp(Path, FileSize, FileTime))
+                return false;
+
+            auto Found = Index.find(Path);
+            if (Found != Index.end() && Found->second->FileSize == FileSize && Found->second->FileTime == FileTime)
+            {
+                // Still good, just mark it as most recently used
+                Cache.splice(Cache.begin(), Cache, Found->second);
+                Hits++;
+            }
+            else
+            {
+                // Drop the stale copy if the file changed on disk
+                if (Found != Index.end())
+                {
+                    Found->second->File.CloseMSH();
+                    Cache.erase(Found->second);
+                    Index.erase(Found);
+                }
+
+                CachedMSH Entry;
+                Entry.Path = Path;
+                Entry.FileSize = FileSize;
+                Entry.FileTime = FileTime;
+                Entry.File.SetMSHFilename(MSHFile.GetMSHFilename());
+                if (!Entry.File.ReadMSH())
+                    return false;
+
+                Cache.push_front(Entry);
+                Index[Path] = Cache.begin();
+                Misses++;
+
+                // Evict the least recently used
+                while (Cache.size() > Capacity)
+                {
+                    Cache.back().File.CloseMSH();
+                    Index.erase(Cache.back().Path);
+                    Cache.pop_back();
+                }
+            }
+
+            MSHFile = Cache.front().File.Clone();
+            return true;
+        };
+
+        std::vector<MSH> MSHARGS;
+        std::vector<Commands::OpResult> Results;
+        std::vector<std::string> Written;
+        std::string Failure;
+        std::string Output;
+        bool out = false;
+
+        try
+        {
+            // Each op keeps its own output, this gets whatever is printed outside of them (writing the files)
+            ConsoleCapture Capture(Output);
+            Commands::Execute(MSHARGS, Args, out, Load, &Results);
+            Written = Commands::Export(MSHARGS, out);
+        }
+        catch (const std::exception& e)
+        {
+            Failure = e.what();
+
+            // Whatever op was running is the one that failed, the rest never ran
+            if (!Results.empty())
+            {
+                Results.back().Ok = false;
+                Results.back().Error = Failure;
+            }
+        }
+
+        // Build the result, one entry per op with what it found and the file each MSH went to
+        bool Ok = Failure.empty();
+        size_t Read = 0;
+        std::string Ops;
+        for (size_t R = 0; R < Results.size(); R++)
+        {
+            const Commands::OpResult& Result = Results.at(R);
+            Ok = Ok && Result.Ok;
+
+            Ops += R > 0 ? ",{" : "{";
+            Ops += "\"op\":\"" + Commands::JsonEscape(Result.Op) + "\",\"args\":[";
+            for (size_t A = 0; A < Result.Args.size(); A++)
+                Ops += (A > 0 ? ",\"" : "\"") + Commands::JsonEscape(Result.Args.at(A)) + "\"";
+            Ops += "],\"ok\":";
+            Ops += Result.Ok ? "true" : "false";
+            if (!Result.Ok)
+                Ops += ",\"error\":\"" + Commands::JsonEscape(Result.Error) + "\"";
+
+            // Files that were read line up with MSHARGS
+            if (Result.Op.at(0) != '-' && Result.Ok && Read < MSHARGS.size())
+            {
+                const std::string& Name = MSHARGS.at(Read++).GetMSHFilename();
+                bool WasWritten = std::find(Written.begin(), Written.end(), Name) != Written.end();
+                Ops += ",\"written\":" + (WasWritten ? "\"" + Commands::JsonEscape(Name) + "\"" : std::string("null"));
+            }
+
+            if (!Result.Data.empty())
+                Ops += ",\"data\":" + Result.Data;
+            Ops += ",\"output\":\"" + Commands::JsonEscape(Result.Output) + "\"}";
+        }
+
+        // The clones are done with
+        for (MSH& MSHFile : MSHARGS)
+            MSHFile.CloseMSH();
+
+        std::string Response = "{\"ok\":";
+        Response += Ok ? "true" : "false";
+        if (!Failure.empty())
+            Response += ",\"error\":\"" + Commands::JsonEscape(Failure) + "\"";
+        Response += ",\"files\":" + std::to_string(MSHARGS.size());
+        Response += ",\"cache_hits\":" + std::to_string(Hits);
+        Response += ",\"cache_misses\":" + std::to_string(Misses);
+        Response += ",\"written\":[";
+        for (size_t W = 0; W < Written.size(); W++)
+            Response += (W > 0 ? ",\"" : "\"") + Commands::JsonEscape(Written.at(W)) + "\"";
+        Response += "],\"ops\":[" + Ops + "],\"output\":\"" + Commands::JsonEscape(Output) + "\"}";
+
+        return Response;
+    }
+
+#ifndef _WIN32
+    // Sends the whole string, false if the client went away
+    static inline bool SendAll(int Client, const std::string& Str)
+    {
+        size_t Sent = 0;
+        while (Sent < Str.size())
+        {
+            ssize_t Count = send(Client, Str.data() + Sent, Str.size() - Sent, 0);
+            if (Count <= 0)
+                return false;
+            Sent += static_cast<size_t>(Count);
+        }
+
+        return true;
+    }
+#endif
+};
@@ -0,0 +1,2161 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <queue>
+#include <map>
+#include <sstream>
+#include <iomanip>
+#include <tuple>
+
+// SSE is always there on x64 (and wherever the compiler is told to use it), otherwise plain math is used
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GEOMETRY_SSE 1
+#else
+#define GEOMETRY_SSE 0
+#endif
+
+// A vertex of a segment with everything the SEGM lists can hold
+class Vertex
+{
+public:
+
+	// POSL
+	float Position[3] = { 0.0f, 0.0f, 0.0f };
+
+	// NRML
+	float Normal[3] = { 0.0f, 0.0f, 0.0f };
+
+	// UV0L
+	float UV[2] = { 0.0f, 0.0f };
+
+	// CLRL (BGRA as stored)
+	unsigned char Color[4] = { 255, 255, 255, 255 };
+
+	// WGHT, index into the model's ENVL and weight for up to four bones
+	uint32_t Bones[4] = { 0, 0, 0, 0 };
+	float Weights[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+};
+
+// Affine transform, 4x4 row major (scale and rotation in the first three columns, translation in the last)
+// The last row is always 0 0 0 1, it's only there so rows line up for SSE
+class alignas(16) Matrix
+{
+public:
+
+	float M[4][4] = { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 0.0f, 1.0f } };
+
+	// Builds the transform in a TRAN payload (scale, rotation quaternion as XYZW, translation)
+	static inline Matrix FromTRAN(std::string_view Payload)
+	{
+		float T[10] = { 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f };
+		if (Payload.size() >= sizeof(T))
+			std::memcpy(T, Payload.data(), sizeof(T));
+
+		return FromTRAN(T);
+	}
+
+	// Builds the transform from decoded TRAN values
+	static inline Matrix FromTRAN(const float T[10])
+	{
+		Matrix Result;
+		float X = T[3], Y = T[4], Z = T[5], W = T[6];
+		float Rotation[3][3] =
+		{
+			{ 1 - 2 * (Y * Y + Z * Z), 2 * (X * Y - Z * W), 2 * (X * Z + Y * W) },
+			{ 2 * (X * Y + Z * W), 1 - 2 * (X * X + Z * Z), 2 * (Y * Z - X * W) },
+			{ 2 * (X * Z - Y * W), 2 * (Y * Z + X * W), 1 - 2 * (X * X + Y * Y) }
+		};
+
+		// Scale is applied first, so it scales the columns
+		for (size_t R = 0; R < 3; R++)
+		{
+			for (size_t C = 0; C < 3; C++)
+				Result.M[R][C] = Rotation[R][C] * T[C];
+			Result.M[R][3] = T[7 + R];
+		}
+
+		return Result;
+	}
+
+	// Splits the transform back into TRAN values, false if it shears or mirrors (TRAN can't hold that)
+	inline bool ToTRAN(float T[10]) const
+	{
+		float R[3][3];
+		for (size_t C = 0; C < 3; C++)
+		{
+			T[C] = std::sqrt(M[0][C] * M[0][C] + M[1][C] * M[1][C] + M[2][C] * M[2][C]);
+			if (T[C] < 1e-8f)
+				return false;
+
+			for (size_t Row = 0; Row < 3; Row++)
+				R[Row][C] = M[Row][C] / T[C];
+		}
+
+		// What's left has to be a rotation: perpendicular columns, not mirrored
+		for (size_t A = 0; A < 3; A++)
+			for (size_t B = A + 1; B < 3; B++)
+				if (std::fabs(R[0][A] * R[0][B] + R[1][A] * R[1][B] + R[2][A] * R[2][B]) > 1e-4f)
+					return false;
+
+		if (R[0][0] * (R[1][1] * R[2][2] - R[1][2] * R[2][1]) - R[0][1] * (R[1][0] * R[2][2] - R[1][2] * R[2][0])
+			+ R[0][2] * (R[1][0] * R[2][1] - R[1][1] * R[2][0]) < 0.0f)
+			return false;
+
+		Quaternion(R, T + 3);
+		for (size_t Row = 0; Row < 3; Row++)
+			T[7 + Row] = M[Row][3];
+
+		return true;
+	}
+
+	// Converts a rotation matrix to a quaternion (XYZW)
+	static inline void Quaternion(const float (&M)[3][3], float Q[4])
+	{
+		float Trace = M[0][0] + M[1][1] + M[2][2];
+		if (Trace > 0.0f)
+		{
+			float S = std::sqrt(Trace + 1.0f) * 2.0f;
+			Q[3] = 0.25f * S;
+			Q[0] = (M[2][1] - M[1][2]) / S;
+			Q[1] = (M[0][2] - M[2][0]) / S;
+			Q[2] = (M[1][0] - M[0][1]) / S;
+		}
+		else if (M[0][0] > M[1][1] && M[0][0] > M[2][2])
+		{
+			float S = std::sqrt(1.0f + M[0][0] - M[1][1] - M[2][2]) * 2.0f;
+			Q[3] = (M[2][1] - M[1][2]) / S;
+			Q[0] = 0.25f * S;
+			Q[1] = (M[0][1] + M[1][0]) / S;
+			Q[2] = (M[0][2] + M[2][0]) / S;
+		}
+		else if (M[1][1] > M[2][2])
+		{
+			float S = std::sqrt(1.0f + M[1][1] - M[0][0] - M[2][2]) * 2.0f;
+			Q[3] = (M[0][2] - M[2][0]) / S;
+			Q[0] = (M[0][1] + M[1][0]) / S;
+			Q[1] = 0.25f * S;
+			Q[2] = (M[1][2] + M[2][1]) / S;
+		}
+		else
+		{
+			float S = std::sqrt(1.0f + M[2][2] - M[0][0] - M[1][1]) * 2.0f;
+			Q[3] = (M[1][0] - M[0][1]) / S;
+			Q[0] = (M[0][2] + M[2][0]) / S;
+			Q[1] = (M[1][2] + M[2][1]) / S;
+			Q[2] = 0.25f * S;
+		}
+	}
+
+	// Returns this transform applied after Other
+	inline Matrix operator*(const Matrix& Other) const
+	{
+		Matrix Result;
+#if GEOMETRY_SSE
+		// Each row of the result is this row's entries times the rows of Other
+		__m128 Row0 = _mm_load_ps(Other.M[0]);
+		__m128 Row1 = _mm_load_ps(Other.M[1]);
+		__m128 Row2 = _mm_load_ps(Other.M[2]);
+		__m128 Row3 = _mm_load_ps(Other.M[3]);
+		for (size_t R = 0; R < 3; R++)
+		{
+			__m128 Sum = _mm_mul_ps(_mm_set1_ps(M[R][0]), Row0);
+			Sum = _mm_add_ps(Sum, _mm_mul_ps(_mm_set1_ps(M[R][1]), Row1));
+			Sum = _mm_add_ps(Sum, _mm_mul_ps(_mm_set1_ps(M[R][2]), Row2));
+			Sum = _mm_add_ps(Sum, _mm_mul_ps(_mm_set1_ps(M[R][3]), Row3));
+			_mm_store_ps(Result.M[R], Sum);
+		}
+#else
+		for (size_t R = 0; R < 3; R++)
+			for (size_t C = 0; C < 4; C++)
+				Result.M[R][C] = M[R][0] * Other.M[0][C] + M[R][1] * Other.M[1][C] + M[R][2] * Other.M[2][C] + M[R][3] * Other.M[3][C];
+#endif
+
+		return Result;
+	}
+
+	// Determinant of the 3x3 part, negative when the transform mirrors
+	inline float Determinant() const
+	{
+		return M[0][0] * (M[1][1] * M[2][2] - M[1][2] * M[2][1])
+			- M[0][1] * (M[1][0] * M[2][2] - M[1][2] * M[2][0])
+			+ M[0][2] * (M[1][0] * M[2][1] - M[1][1] * M[2][0]);
+	}
+
+	// Returns the inverse transform (identity if this one collapses to a plane)
+	inline Matrix Inverse() const
+	{
+		Matrix Result;
+		float Det = Determinant();
+		if (std::fabs(Det) < 1e-12f)
+			return Result;
+
+		// Inverse of the 3x3 part from its cofactors
+		for (size_t R = 0; R < 3; R++)
+		{
+			for (size_t C = 0; C < 3; C++)
+			{
+				size_t R1 = (C + 1) % 3, R2 = (C + 2) % 3;
+				size_t C1 = (R + 1) % 3, C2 = (R + 2) % 3;
+				Result.M[R][C] = (M[R1][C1] * M[R2][C2] - M[R1][C2] * M[R2][C1]) / Det;
+			}
+		}
+
+		// Then undo the translation
+		for (size_t R = 0; R < 3; R++)
+			Result.M[R][3] = -(Result.M[R][0] * M[0][3] + Result.M[R][1] * M[1][3] + Result.M[R][2] * M[2][3]);
+
+		return Result;
+	}
+
+	// Transforms a point
+	inline void TransformPoint(float P[3]) const
+	{
+		float X = P[0], Y = P[1], Z = P[2];
+		for (size_t R = 0; R < 3; R++)
+			P[R] = M[R][0] * X + M[R][1] * Y + M[R][2] * Z + M[R][3];
+	}
+
+	// Returns the transform for normals (the inverse transpose, so non-uniform scale keeps them perpendicular)
+	inline Matrix NormalMatrix() const
+	{
+		Matrix Inv = Inverse();
+		Matrix Result;
+		for (size_t R = 0; R < 3; R++)
+			for (size_t C = 0; C < 3; C++)
+				Result.M[R][C] = Inv.M[C][R];
+
+		return Result;
+	}
+
+	// Transforms a direction by the 3x3 part and renormalizes it
+	inline void TransformNormal(float N[3]) const
+	{
+		float X = N[0], Y = N[1], Z = N[2];
+		for (size_t R = 0; R < 3; R++)
+			N[R] = M[R][0] * X + M[R][1] * Y + M[R][2] * Z;
+
+		float Length = std::sqrt(N[0] * N[0] + N[1] * N[1] + N[2] * N[2]);
+		if (Length > 0.0f)
+			for (size_t R = 0; R < 3; R++)
+				N[R] /= Length;
+	}
+};
+
+// The decoded contents of a SEGM chunk
+class Geometry
+{
+public:
+
+	// Material index
+	uint32_t MATI = 0;
+
+	// Vertices (the POSL count decides how many)
+	std::vector<Vertex> Vertices;
+
+	// Triangle list, three vertex indices per triangle
+	std::vector<uint32_t> Triangles;
+
+	// Which lists the SEGM had, so it's written back the same way
+	bool HasNormals = false;
+	bool HasUVs = false;
+	bool HasColors = false;
+	bool HasWeights = false;
+	bool HasNDXL = false;
+	bool HasNDXT = false;
+	bool HasSTRP = false;
+
+	// Chunks that aren't decoded (CLRB, SHDW...), kept as they were
+	std::vector<std::pair<std::string, std::vector<unsigned char>>> Extra;
+
+	// The order the SEGM had its children in, so they're written back the same way
+	std::vector<std::string> Order;
+
+	// NDXL and STRP as read (polygons and strips don't survive decoding) and the triangles decoded,
+	// so both lists are written back untouched while the triangles haven't changed
+	std::vector<unsigned char> SourceNDXL;
+	std::vector<unsigned char> SourceSTRP;
+	std::vector<uint32_t> SourceTriangles;
+
+	// Strips follow the triangle order (once it's been optimized), instead of being made as long as possible
+	bool StripsInOrder = false;
+
+	// Indices are 16 bit, and STRP uses the top bit to mark strip starts
+	static const size_t MaxVertices = 0x8000;
+
+	// Whether every vertex can be reached by the 16 bit index lists (STRP only has 15 bits)
+	inline bool FitsIndices() const
+	{
+		return Vertices.size() <= 0x10000 && (!HasSTRP || Vertices.size() <= MaxVertices);
+	}
+
+	// Decodes the children of a SEGM (header and payload of each), false if a list is malformed
+	inline bool Decode(const std::vector<std::pair<std::string, std::string_view>>& Children)
+	{
+		std::vector<uint32_t> FromNDXL;
+		std::vector<uint32_t> FromSTRP;
+		bool Valid = true;
+
+		for (auto& Child : Children)
+		{
+			const std::string& Header = Child.first;
+			std::string_view Payload = Child.second;
+			Order.push_back(Header);
+
+			uint32_t Count = 0;
+			if (Payload.size() >= 4)
+				std::memcpy(&Count, Payload.data(), 4);
+			const char* List = Payload.data() + 4;
+
+			// Fixed size lists must hold what they claim
+			auto Fits = [&](size_t EntrySize)
+			{
+				return Payload.size() >= 4 && (Payload.size() - 4) / EntrySize >= Count;
+			};
+
+			if (Header == "MATI" && Payload.size() >= 4)
+				MATI = Count;
+			else if (Header == "POSL" && (Valid = Valid && Fits(12)))
+			{
+				Grow(Count);
+				for (uint32_t V = 0; V < Count; V++)
+					std::memcpy(Vertices.at(V).Position, List + 12 * size_t(V), 12);
+			}
+			else if (Header == "NRML" && (Valid = Valid && Fits(12)))
+			{
+				Grow(Count);
+				HasNormals = true;
+				for (uint32_t V = 0; V < Count; V++)
+					std::memcpy(Vertices.at(V).Normal, List + 12 * size_t(V), 12);
+			}
+			else if (Header == "UV0L" && (Valid = Valid && Fits(8)))
+			{
+				Grow(Count);
+				HasUVs = true;
+				for (uint32_t V = 0; V < Count; V++)
+					std::memcpy(Vertices.at(V).UV, List + 8 * size_t(V), 8);
+			}
+			else if (Header == "CLRL" && (Valid = Valid && Fits(4)))
+			{
+				Grow(Count);
+				HasColors = true;
+				for (uint32_t V = 0; V < Count; V++)
+					std::memcpy(Vertices.at(V).Color, List + 4 * size_t(V), 4);
+			}
+			else if (Header == "WGHT" && (Valid = Valid && Fits(32)))
+			{
+				Grow(Count);
+				HasWeights = true;
+				for (uint32_t V = 0; V < Count; V++)
+				{
+					for (size_t W = 0; W < 4; W++)
+					{
+						std::memcpy(&Vertices.at(V).Bones[W], List + 32 * size_t(V) + 8 * W, 4);
+						std::memcpy(&Vertices.at(V).Weights[W], List + 32 * size_t(V) + 8 * W + 4, 4);
+					}
+				}
+			}
+			else if (Header == "NDXT" && (Valid = Valid && Fits(6)))
+			{
+				HasNDXT = true;
+				Triangles.clear();
+				for (size_t I = 0; I < 3 * size_t(Count); I++)
+				{
+					uint16_t Index = 0;
+					std::memcpy(&Index, List + 2 * I, 2);
+					Triangles.push_back(Index);
+				}
+			}
+			else if (Header == "STRP" && (Valid = Valid && Fits(2)))
+			{
+				HasSTRP = true;
+				std::vector<uint16_t> Strip(Count);
+				if (Count > 0)
+					std::memcpy(Strip.data(), List, 2 * size_t(Count));
+				FromSTRP = StripsToTriangles(Strip);
+				SourceSTRP.assign(Payload.begin(), Payload.end());
+			}
+			else if (Header == "NDXL" && Payload.size() >= 4)
+			{
+				// Polygons are fanned into triangles
+				HasNDXL = true;
+				size_t pos = 4;
+				for (uint32_t P = 0; P < Count && Valid; P++)
+				{
+					uint16_t Corners = 0;
+					if (pos + 2 > Payload.size())
+					{
+						Valid = false;
+						break;
+					}
+					std::memcpy(&Corners, Payload.data() + pos, 2);
+					pos += 2;
+
+					if (pos + 2 * size_t(Corners) > Payload.size())
+					{
+						Valid = false;
+						break;
+					}
+
+					std::vector<uint16_t> Polygon(Corners);
+					if (Corners > 0)
+						std::memcpy(Polygon.data(), Payload.data() + pos, 2 * size_t(Corners));
+					pos += 2 * size_t(Corners);
+
+					for (size_t C = 2; C < Polygon.size(); C++)
+					{
+						FromNDXL.push_back(Polygon.at(0));
+						FromNDXL.push_back(Polygon.at(C - 1));
+						FromNDXL.push_back(Polygon.at(C));
+					}
+				}
+
+				SourceNDXL.assign(Payload.begin(), Payload.end());
+			}
+			else if (Header != "MATI" && Header != "POSL" && Header != "NRML" && Header != "UV0L" && Header != "CLRL"
+				&& Header != "WGHT" && Header != "NDXT" && Header != "STRP" && Header != "NDXL")
+				Extra.emplace_back(Header, std::vector<unsigned char>(Payload.begin(), Payload.end()));
+		}
+
+		// NDXT is the plain triangle list, otherwise use the strips or polygons
+		if (!HasNDXT)
+			Triangles = HasSTRP ? FromSTRP : FromNDXL;
+		SourceTriangles = Triangles;
+
+		// Every index has to point at a vertex
+		for (uint32_t Index : Triangles)
+			if (Index >= Vertices.size())
+				Valid = false;
+
+		return Valid;
+	}
+
+	// Encodes the WGHT payload (count, then bone and weight pairs)
+	inline std::vector<unsigned char> EncodeWeights() const
+	{
+		std::vector<unsigned char> Payload;
+		uint32_t Count = static_cast<uint32_t>(Vertices.size());
+		Payload.reserve(4 + 32 * size_t(Count));
+		Append(Payload, &Count, 4);
+		for (auto& V : Vertices)
+		{
+			for (size_t W = 0; W < 4; W++)
+			{
+				Append(Payload, &V.Bones[W], 4);
+				Append(Payload, &V.Weights[W], 4);
+			}
+		}
+
+		return Payload;
+	}
+
+	// Encodes the SEGM children (header and payload of each) in the order they were read, new ones in the usual order after them
+	// Only the triangles are kept for NDXL and STRP, so they're rebuilt as triangles and greedy strips once those change
+	// Returns nothing if the indices don't fit (see FitsIndices) rather than cutting them down
+	inline std::vector<std::pair<std::string, std::vector<unsigned char>>> Encode() const
+	{
+		std::vector<std::pair<std::string, std::vector<unsigned char>>> Children;
+		if (!FitsIndices())
+			return Children;
+		uint32_t Count = static_cast<uint32_t>(Vertices.size());
+
+		auto Add = [&](const std::string& Header, uint32_t Leading)
+		{
+			Children.emplace_back(Header, std::vector<unsigned char>());
+			Append(Children.back().second, &Leading, 4);
+			return &Children.back().second;
+		};
+
+		Add("MATI", MATI);
+
+		std::vector<unsigned char>* List = Add("POSL", Count);
+		for (auto& V : Vertices)
+			Append(*List, V.Position, 12);
+
+		if (HasWeights)
+			Children.emplace_back("WGHT", EncodeWeights());
+
+		if (HasNormals)
+		{
+			List = Add("NRML", Count);
+			for (auto& V : Vertices)
+				Append(*List, V.Normal, 12);
+		}
+
+		if (HasColors)
+		{
+			List = Add("CLRL", Count);
+			for (auto& V : Vertices)
+				Append(*List, V.Color, 4);
+		}
+
+		if (HasUVs)
+		{
+			List = Add("UV0L", Count);
+			for (auto& V : Vertices)
+				Append(*List, V.UV, 8);
+		}
+
+		for (auto& Chunk : Extra)
+			Children.push_back(Chunk);
+
+		uint32_t TriangleCount = static_cast<uint32_t>(Triangles.size() / 3);
+		bool Unchanged = Triangles == SourceTriangles;
+		if (HasNDXL && Unchanged && !SourceNDXL.empty())
+			Children.emplace_back("NDXL", SourceNDXL);
+		else if (HasNDXL)
+		{
+			List = Add("NDXL", TriangleCount);
+			for (size_t T = 0; T < Triangles.size(); T += 3)
+			{
+				uint16_t Polygon[4] = { 3, uint16_t(Triangles.at(T)), uint16_t(Triangles.at(T + 1)), uint16_t(Triangles.at(T + 2)) };
+				Append(*List, Polygon, 8);
+			}
+		}
+
+		if (HasNDXT)
+		{
+			List = Add("NDXT", TriangleCount);
+			for (size_t T = 0; T < Triangles.size(); T++)
+			{
+				uint16_t Index = uint16_t(Triangles.at(T));
+				Append(*List, &Index, 2);
+			}
+		}
+
+		if (HasSTRP && Unchanged && !SourceSTRP.empty())
+			Children.emplace_back("STRP", SourceSTRP);
+		else if (HasSTRP)
+		{
+			std::vector<uint16_t> Strip = EncodeStrips();
+			List = Add("STRP", static_cast<uint32_t>(Strip.size()));
+			if (!Strip.empty())
+				Append(*List, Strip.data(), 2 * Strip.size());
+		}
+
+		// Payloads are padded to 4 bytes
+		for (auto& Child : Children)
+			while (Child.second.size() % 4 != 0)
+				Child.second.push_back(0);
+
+		if (Order.empty())
+			return Children;
+
+		std::vector<std::pair<std::string, std::vector<unsigned char>>> Ordered;
+		std::vector<bool> Placed(Children.size(), false);
+		for (auto& Header : Order)
+		{
+			for (size_t C = 0; C < Children.size(); C++)
+			{
+				if (!Placed.at(C) && Children.at(C).first == Header)
+				{
+					Ordered.push_back(std::move(Children.at(C)));
+					Placed.at(C) = true;
+					break;
+				}
+			}
+		}
+
+		for (size_t C = 0; C < Children.size(); C++)
+			if (!Placed.at(C))
+				Ordered.push_back(std::move(Children.at(C)));
+
+		return Ordered;
+	}
+
+	// Moves the vertices by T, keeping triangles facing outwards if T mirrors
+	inline void Transform(const Matrix& T)
+	{
+		Matrix Normals = T.NormalMatrix();
+		for (auto& V : Vertices)
+		{
+			T.TransformPoint(V.Position);
+			if (HasNormals)
+				Normals.TransformNormal(V.Normal);
+		}
+
+		if (T.Determinant() < 0.0f)
+			for (size_t I = 0; I + 2 < Triangles.size(); I += 3)
+				std::swap(Triangles.at(I + 1), Triangles.at(I + 2));
+	}
+
+	// Average cache miss ratio (vertex transforms per triangle) of the triangle order with a FIFO cache
+	inline float CacheMissRatio(size_t CacheSize = 16) const
+	{
+		size_t TriangleCount = Triangles.size() / 3;
+		if (TriangleCount == 0)
+			return 0.0f;
+
+		return static_cast<float>(SimulateCache(CacheSize, nullptr)) / TriangleCount;
+	}
+
+	// Average cache miss ratio of what's drawn: the STRP as it would be written when the segment has one, else the triangles
+	inline float DrawnCacheMissRatio(size_t CacheSize = 16) const
+	{
+		if (!HasSTRP)
+			return CacheMissRatio(CacheSize);
+
+		std::vector<uint16_t> Strip;
+		uint32_t Count = 0;
+		if (Triangles == SourceTriangles && SourceSTRP.size() >= 4)
+		{
+			std::memcpy(&Count, SourceSTRP.data(), 4);
+			Strip.resize(std::min(size_t(Count), (SourceSTRP.size() - 4) / 2));
+			if (!Strip.empty())
+				std::memcpy(Strip.data(), SourceSTRP.data() + 4, 2 * Strip.size());
+		}
+		else
+			Strip = EncodeStrips();
+
+		Geometry Drawn;
+		Drawn.Vertices.resize(Vertices.size());
+		Drawn.Triangles = StripsToTriangles(Strip);
+		return Drawn.CacheMissRatio(CacheSize);
+	}
+
+	// Reorders the triangles so their vertices stay in the post-transform cache (Forsyth's linear-speed method)
+	inline void OptimizeVertexCache()
+	{
+		const size_t CacheSize = 32;
+		size_t TriangleCount = Triangles.size() / 3;
+		if (TriangleCount < 2)
+			return;
+
+		// Triangles still to be drawn around each vertex
+		std::vector<std::vector<uint32_t>> VertexTriangles(Vertices.size());
+		for (size_t T = 0; T < TriangleCount; T++)
+			for (size_t K = 0; K < 3; K++)
+				VertexTriangles.at(Triangles.at(3 * T + K)).push_back(static_cast<uint32_t>(T));
+
+		std::vector<int> CachePosition(Vertices.size(), -1);
+		auto Score = [&](uint32_t V)
+		{
+			size_t Remaining = VertexTriangles.at(V).size();
+			if (Remaining == 0)
+				return -1.0f;
+
+			// Vertices of the last triangle get a fixed score so the next one doesn't just reuse all three
+			float Result = 0.0f;
+			int Position = CachePosition.at(V);
+			if (Position >= 0 && Position < 3)
+				Result = 0.75f;
+			else if (Position >= 3)
+				Result = std::pow(1.0f - float(Position - 3) / (CacheSize - 3), 1.5f);
+
+			// Vertices with few triangles left are worth finishing off
+			return Result + 2.0f / std::sqrt(float(Remaining));
+		};
+
+		std::vector<float> VertexScores(Vertices.size());
+		for (uint32_t V = 0; V < Vertices.size(); V++)
+			VertexScores.at(V) = Score(V);
+
+		std::vector<float> TriangleScores(TriangleCount, 0.0f);
+		for (size_t T = 0; T < TriangleCount; T++)
+			for (size_t K = 0; K < 3; K++)
+				TriangleScores.at(T) += VertexScores.at(Triangles.at(3 * T + K));
+
+		std::vector<bool> Added(TriangleCount, false);
+		std::vector<uint32_t> Cache;
+		std::vector<uint32_t> Ordered;
+		Ordered.reserve(Triangles.size());
+
+		size_t Next = 0;
+		long long Best = -1;
+		for (size_t Emitted = 0; Emitted < TriangleCount; Emitted++)
+		{
+			// Nothing in the cache has triangles left, so carry on from the first one not drawn yet
+			if (Best < 0)
+			{
+				while (Added.at(Next))
+					Next++;
+				Best = static_cast<long long>(Next);
+			}
+
+			size_t T = static_cast<size_t>(Best);
+			Added.at(T) = true;
+
+			std::vector<uint32_t> NewCache;
+			for (size_t K = 0; K < 3; K++)
+			{
+				uint32_t V = Triangles.at(3 * T + K);
+				Ordered.push_back(V);
+
+				std::vector<uint32_t>& Around = VertexTriangles.at(V);
+				auto Found = std::find(Around.begin(), Around.end(), static_cast<uint32_t>(T));
+				if (Found != Around.end())
+				{
+					*Found = Around.back();
+					Around.pop_back();
+				}
+
+				if (std::find(NewCache.begin(), NewCache.end(), V) == NewCache.end())
+					NewCache.push_back(V);
+			}
+
+			for (uint32_t V : Cache)
+				if (std::find(NewCache.begin(), NewCache.end(), V) == NewCache.end())
+					NewCache.push_back(V);
+
+			// Vertices pushed out of the cache lose their position
+			for (size_t C = CacheSize; C < NewCache.size(); C++)
+				CachePosition.at(NewCache.at(C)) = -1;
+			for (size_t C = 0; C < NewCache.size() && C < CacheSize; C++)
+				CachePosition.at(NewCache.at(C)) = static_cast<int>(C);
+
+			// Rescore what moved and pick the best triangle around the cache
+			for (uint32_t V : NewCache)
+			{
+				float NewScore = Score(V);
+				float Delta = NewScore - VertexScores.at(V);
+				VertexScores.at(V) = NewScore;
+				for (uint32_t Around : VertexTriangles.at(V))
+					TriangleScores.at(Around) += Delta;
+			}
+
+			if (NewCache.size() > CacheSize)
+				NewCache.resize(CacheSize);
+			Cache = NewCache;
+
+			Best = -1;
+			float BestScore = -1.0f;
+			for (uint32_t V : Cache)
+			{
+				for (uint32_t Around : VertexTriangles.at(V))
+				{
+					if (TriangleScores.at(Around) > BestScore)
+					{
+						BestScore = TriangleScores.at(Around);
+						Best = Around;
+					}
+				}
+			}
+		}
+
+		Triangles = Ordered;
+	}
+
+	// Reorders clusters of triangles so outward facing ones are drawn first, as long as the
+	// cache miss ratio stays within Threshold times what it was (Sander et al.'s overdraw pass)
+	inline void OptimizeOverdraw(float Threshold)
+	{
+		size_t TriangleCount = Triangles.size() / 3;
+		if (TriangleCount < 2)
+			return;
+
+		// Clusters start where the cache had none of the triangle's vertices, so moving them costs nothing extra
+		std::vector<size_t> Starts;
+		size_t Misses = SimulateCache(16, &Starts);
+
+		// Area weighted center and normal of each cluster and of the whole segment
+		std::vector<std::array<float, 6>> Clusters(Starts.size(), std::array<float, 6>{});
+		std::vector<float> Areas(Starts.size(), 0.0f);
+		float Center[3] = { 0.0f, 0.0f, 0.0f };
+		float TotalArea = 0.0f;
+		for (size_t C = 0; C < Starts.size(); C++)
+		{
+			size_t End = C + 1 < Starts.size() ? Starts.at(C + 1) : TriangleCount;
+			for (size_t T = Starts.at(C); T < End; T++)
+			{
+				const float* A = Vertices.at(Triangles.at(3 * T)).Position;
+				const float* B = Vertices.at(Triangles.at(3 * T + 1)).Position;
+				const float* D = Vertices.at(Triangles.at(3 * T + 2)).Position;
+				float U[3] = { B[0] - A[0], B[1] - A[1], B[2] - A[2] };
+				float W[3] = { D[0] - A[0], D[1] - A[1], D[2] - A[2] };
+				float N[3] = { U[1] * W[2] - U[2] * W[1], U[2] * W[0] - U[0] * W[2], U[0] * W[1] - U[1] * W[0] };
+				float Area = std::sqrt(N[0] * N[0] + N[1] * N[1] + N[2] * N[2]);
+
+				for (size_t A3 = 0; A3 < 3; A3++)
+				{
+					float Mid = (A[A3] + B[A3] + D[A3]) / 3.0f;
+					Clusters.at(C)[A3] += Mid * Area;
+					Clusters.at(C)[3 + A3] += N[A3];
+					Center[A3] += Mid * Area;
+				}
+				Areas.at(C) += Area;
+				TotalArea += Area;
+			}
+		}
+
+		if (TotalArea <= 0.0f)
+			return;
+
+		std::vector<float> Keys(Starts.size(), 0.0f);
+		for (size_t C = 0; C < Starts.size(); C++)
+		{
+			if (Areas.at(C) <= 0.0f)
+				continue;
+
+			for (size_t A3 = 0; A3 < 3; A3++)
+				Keys.at(C) += (Clusters.at(C)[A3] / Areas.at(C) - Center[A3] / TotalArea) * Clusters.at(C)[3 + A3];
+		}
+
+		std::vector<size_t> Order(Starts.size());
+		for (size_t C = 0; C < Order.size(); C++)
+			Order.at(C) = C;
+		std::stable_sort(Order.begin(), Order.end(), [&](size_t A, size_t B) { return Keys.at(A) > Keys.at(B); });
+
+		std::vector<uint32_t> Reordered;
+		Reordered.reserve(Triangles.size());
+		for (size_t C : Order)
+		{
+			size_t End = C + 1 < Starts.size() ? Starts.at(C + 1) : TriangleCount;
+			Reordered.insert(Reordered.end(), Triangles.begin() + 3 * Starts.at(C), Triangles.begin() + 3 * End);
+		}
+
+		std::vector<uint32_t> Original = Triangles;
+		Triangles = Reordered;
+		if (SimulateCache(16, nullptr) > Misses * Threshold)
+			Triangles = Original;
+	}
+
+	// Renumbers the vertices in the order the triangles first use them, unused ones last
+	inline void OptimizeVertexFetch()
+	{
+		std::vector<uint32_t> Remap(Vertices.size(), UINT32_MAX);
+		std::vector<Vertex> Ordered;
+		Ordered.reserve(Vertices.size());
+		for (uint32_t& Index : Triangles)
+		{
+			if (Remap.at(Index) == UINT32_MAX)
+			{
+				Remap.at(Index) = static_cast<uint32_t>(Ordered.size());
+				Ordered.push_back(Vertices.at(Index));
+			}
+			Index = Remap.at(Index);
+		}
+
+		for (size_t V = 0; V < Vertices.size(); V++)
+			if (Remap.at(V) == UINT32_MAX)
+				Ordered.push_back(Vertices.at(V));
+
+		Vertices = Ordered;
+	}
+
+	// Merges vertices whose lists all match within the tolerances (colors in 0-255 steps, weights exactly),
+	// dropping triangles that collapse, returns how many vertices went
+	inline size_t Weld(float PositionTolerance, float NormalTolerance, float UVTolerance, float ColorTolerance)
+	{
+		// Vertices within the tolerance are at most one cell apart
+		double Cell = std::max(double(PositionTolerance), 1e-6);
+		auto CellOf = [&](const Vertex& V, size_t Axis, int Offset)
+		{
+			return static_cast<long long>(std::floor(V.Position[Axis] / Cell)) + Offset;
+		};
+		auto Key = [](long long X, long long Y, long long Z)
+		{
+			return uint64_t(X * 73856093LL) ^ uint64_t(Y * 19349663LL) ^ uint64_t(Z * 83492791LL);
+		};
+
+		auto Close = [&](const Vertex& A, const Vertex& B)
+		{
+			for (size_t C = 0; C < 3; C++)
+				if (std::fabs(A.Position[C] - B.Position[C]) > PositionTolerance
+					|| (HasNormals && std::fabs(A.Normal[C] - B.Normal[C]) > NormalTolerance))
+					return false;
+
+			for (size_t C = 0; C < 2; C++)
+				if (HasUVs && std::fabs(A.UV[C] - B.UV[C]) > UVTolerance)
+					return false;
+
+			for (size_t C = 0; C < 4; C++)
+				if (HasColors && std::abs(int(A.Color[C]) - int(B.Color[C])) > ColorTolerance)
+					return false;
+
+			return !HasWeights || (std::memcmp(A.Bones, B.Bones, sizeof(A.Bones)) == 0
+				&& std::memcmp(A.Weights, B.Weights, sizeof(A.Weights)) == 0);
+		};
+
+		// Each vertex joins the first kept vertex close enough to it, found through the neighbouring cells
+		std::unordered_map<uint64_t, std::vector<uint32_t>> Grid;
+		std::vector<uint32_t> Remap(Vertices.size());
+		std::vector<Vertex> Kept;
+		for (size_t V = 0; V < Vertices.size(); V++)
+		{
+			const Vertex& Vert = Vertices.at(V);
+			long long Match = -1;
+			for (int X = -1; X <= 1 && Match < 0; X++)
+				for (int Y = -1; Y <= 1 && Match < 0; Y++)
+					for (int Z = -1; Z <= 1 && Match < 0; Z++)
+					{
+						auto Found = Grid.find(Key(CellOf(Vert, 0, X), CellOf(Vert, 1, Y), CellOf(Vert, 2, Z)));
+						if (Found == Grid.end())
+							continue;
+
+						for (uint32_t K : Found->second)
+							if (Close(Kept.at(K), Vert))
+							{
+								Match = K;
+								break;
+							}
+					}
+
+			if (Match < 0)
+			{
+				Match = static_cast<long long>(Kept.size());
+				Grid[Key(CellOf(Vert, 0, 0), CellOf(Vert, 1, 0), CellOf(Vert, 2, 0))].push_back(static_cast<uint32_t>(Match));
+				Kept.push_back(Vert);
+			}
+			Remap.at(V) = static_cast<uint32_t>(Match);
+		}
+
+		size_t Removed = Vertices.size() - Kept.size();
+		if (Removed == 0)
+			return 0;
+
+		std::vector<uint32_t> Remapped;
+		Remapped.reserve(Triangles.size());
+		for (size_t T = 0; T + 2 < Triangles.size(); T += 3)
+		{
+			uint32_t A = Remap.at(Triangles.at(T)), B = Remap.at(Triangles.at(T + 1)), C = Remap.at(Triangles.at(T + 2));
+			if (A != B && B != C && A != C)
+				Remapped.insert(Remapped.end(), { A, B, C });
+		}
+
+		Vertices = Kept;
+		Triangles = Remapped;
+		return Removed;
+	}
+
+	// Collapses edges by quadric error (Garland and Heckbert) until Ratio of the triangles are left,
+	// or the next collapse would cost more than MaxError
+	// Open edges are never moved, so segment borders (where the material changes) and UV seams stay put,
+	// and collapses that would stretch UVs or blend colors cost more
+	inline void Simplify(float Ratio, double MaxError = INFINITY)
+	{
+		size_t TriangleCount = Triangles.size() / 3;
+		size_t Target = std::max<size_t>(1, static_cast<size_t>(TriangleCount * Ratio));
+		if (TriangleCount <= Target)
+			return;
+
+		// Error quadric of each vertex from the planes of its triangles, weighted by area
+		std::vector<std::array<double, 10>> Quadrics(Vertices.size(), std::array<double, 10>{});
+		std::vector<std::vector<uint32_t>> Around(Vertices.size());
+		std::unordered_map<uint64_t, int> EdgeUses;
+		auto EdgeKey = [](uint32_t A, uint32_t B) { return A < B ? (uint64_t(A) << 32) | B : (uint64_t(B) << 32) | A; };
+
+		auto Normal = [&](uint32_t A, uint32_t B, uint32_t C, double N[3])
+		{
+			const float* P = Vertices.at(A).Position;
+			const float* Q = Vertices.at(B).Position;
+			const float* R = Vertices.at(C).Position;
+			double U[3] = { Q[0] - P[0], Q[1] - P[1], Q[2] - P[2] };
+			double W[3] = { R[0] - P[0], R[1] - P[1], R[2] - P[2] };
+			N[0] = U[1] * W[2] - U[2] * W[1];
+			N[1] = U[2] * W[0] - U[0] * W[2];
+			N[2] = U[0] * W[1] - U[1] * W[0];
+		};
+
+		float Min[3] = { INFINITY, INFINITY, INFINITY };
+		float Max[3] = { -INFINITY, -INFINITY, -INFINITY };
+		for (auto& V : Vertices)
+			for (size_t A = 0; A < 3; A++)
+			{
+				Min[A] = std::min(Min[A], V.Position[A]);
+				Max[A] = std::max(Max[A], V.Position[A]);
+			}
+		double Diagonal = 0.0;
+		for (size_t A = 0; A < 3 && !Vertices.empty(); A++)
+			Diagonal += double(Max[A] - Min[A]) * (Max[A] - Min[A]);
+
+		for (size_t T = 0; T < TriangleCount; T++)
+		{
+			uint32_t A = Triangles.at(3 * T), B = Triangles.at(3 * T + 1), C = Triangles.at(3 * T + 2);
+			double N[3];
+			Normal(A, B, C, N);
+			double Length = std::sqrt(N[0] * N[0] + N[1] * N[1] + N[2] * N[2]);
+			if (Length > 0.0)
+			{
+				// Plane ax + by + cz + d = 0, the quadric holds its outer product scaled by area
+				double Plane[4] = { N[0] / Length, N[1] / Length, N[2] / Length, 0.0 };
+				const float* P = Vertices.at(A).Position;
+				Plane[3] = -(Plane[0] * P[0] + Plane[1] * P[1] + Plane[2] * P[2]);
+
+				std::array<double, 10> K;
+				size_t I = 0;
+				for (size_t R = 0; R < 4; R++)
+					for (size_t C2 = R; C2 < 4; C2++)
+						K[I++] = Plane[R] * Plane[C2] * Length / 2;
+
+				for (uint32_t V : { A, B, C })
+					for (size_t Q = 0; Q < 10; Q++)
+						Quadrics.at(V)[Q] += K[Q];
+			}
+
+			for (uint32_t V : { A, B, C })
+				Around.at(V).push_back(static_cast<uint32_t>(T));
+			EdgeUses[EdgeKey(A, B)]++;
+			EdgeUses[EdgeKey(B, C)]++;
+			EdgeUses[EdgeKey(C, A)]++;
+		}
+
+		// Vertices on an open edge are locked
+		std::vector<bool> Locked(Vertices.size(), false);
+		for (auto& Edge : EdgeUses)
+			if (Edge.second == 1)
+				Locked.at(uint32_t(Edge.first >> 32)) = Locked.at(uint32_t(Edge.first & 0xFFFFFFFF)) = true;
+
+		// Error of moving From onto To
+		auto Cost = [&](uint32_t From, uint32_t To)
+		{
+			const std::array<double, 10>& Q = Quadrics.at(From);
+			const std::array<double, 10>& R = Quadrics.at(To);
+			const float* P = Vertices.at(To).Position;
+			double X = P[0], Y = P[1], Z = P[2];
+			double S[10];
+			for (size_t I = 0; I < 10; I++)
+				S[I] = Q[I] + R[I];
+
+			double Error = S[0] * X * X + 2 * S[1] * X * Y + 2 * S[2] * X * Z + 2 * S[3] * X
+				+ S[4] * Y * Y + 2 * S[5] * Y * Z + 2 * S[6] * Y
+				+ S[7] * Z * Z + 2 * S[8] * Z + S[9];
+
+			// Attribute changes are priced against the size of the segment
+			const Vertex& F = Vertices.at(From);
+			const Vertex& T = Vertices.at(To);
+			double Attributes = 0.0;
+			if (HasUVs)
+				Attributes += std::pow(F.UV[0] - T.UV[0], 2) + std::pow(F.UV[1] - T.UV[1], 2);
+			if (HasColors)
+				for (size_t C = 0; C < 4; C++)
+					Attributes += std::pow((int(F.Color[C]) - int(T.Color[C])) / 255.0, 2);
+			if (HasWeights && (std::memcmp(F.Bones, T.Bones, sizeof(F.Bones)) != 0))
+				Attributes += 1.0;
+
+			return std::max(Error, 0.0) + Attributes * Diagonal;
+		};
+
+		// Cheapest collapses first, stale entries are skipped by their vertex versions
+		typedef std::tuple<double, uint32_t, uint32_t, uint32_t, uint32_t> Collapse;
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> Queue;
+		std::vector<uint32_t> Versions(Vertices.size(), 0);
+		std::vector<bool> Removed(Vertices.size(), false);
+		std::vector<bool> Dead(TriangleCount, false);
+
+		auto Consider = [&](uint32_t A, uint32_t B)
+		{
+			if (!Locked.at(A))
+				Queue.emplace(Cost(A, B), A, B, Versions.at(A), Versions.at(B));
+			if (!Locked.at(B))
+				Queue.emplace(Cost(B, A), B, A, Versions.at(B), Versions.at(A));
+		};
+
+		for (auto& Edge : EdgeUses)
+			Consider(uint32_t(Edge.first >> 32), uint32_t(Edge.first & 0xFFFFFFFF));
+
+		size_t Alive = TriangleCount;
+		while (Alive > Target && !Queue.empty() && std::get<0>(Queue.top()) <= MaxError)
+		{
+			uint32_t From = std::get<1>(Queue.top());
+			uint32_t To = std::get<2>(Queue.top());
+			bool Stale = Removed.at(From) || Removed.at(To) || std::get<3>(Queue.top()) != Versions.at(From)
+				|| std::get<4>(Queue.top()) != Versions.at(To);
+			Queue.pop();
+			if (Stale)
+				continue;
+
+			// Triangles that keep going must not flip over
+			bool Flips = false;
+			for (uint32_t T : Around.at(From))
+			{
+				uint32_t* Corners = &Triangles.at(3 * size_t(T));
+				if (Dead.at(T) || Corners[0] == To || Corners[1] == To || Corners[2] == To)
+					continue;
+
+				double Old[3], New[3];
+				Normal(Corners[0], Corners[1], Corners[2], Old);
+				uint32_t Moved[3] = { Corners[0], Corners[1], Corners[2] };
+				for (uint32_t& C : Moved)
+					if (C == From)
+						C = To;
+				Normal(Moved[0], Moved[1], Moved[2], New);
+				if (Old[0] * New[0] + Old[1] * New[1] + Old[2] * New[2] <= 0.0)
+				{
+					Flips = true;
+					break;
+				}
+			}
+			if (Flips)
+				continue;
+
+			for (uint32_t T : Around.at(From))
+			{
+				if (Dead.at(T))
+					continue;
+
+				uint32_t* Corners = &Triangles.at(3 * size_t(T));
+				if (Corners[0] == To || Corners[1] == To || Corners[2] == To)
+				{
+					Dead.at(T) = true;
+					Alive--;
+					continue;
+				}
+
+				for (size_t K = 0; K < 3; K++)
+					if (Corners[K] == From)
+						Corners[K] = To;
+				Around.at(To).push_back(T);
+			}
+
+			for (size_t Q = 0; Q < 10; Q++)
+				Quadrics.at(To)[Q] += Quadrics.at(From)[Q];
+			Removed.at(From) = true;
+			Versions.at(To)++;
+
+			// Only edges to the kept vertex change cost (positions never move)
+			std::vector<uint32_t> Neighbours;
+			for (uint32_t T : Around.at(To))
+				if (!Dead.at(T))
+					for (size_t K = 0; K < 3; K++)
+						if (Triangles.at(3 * size_t(T) + K) != To)
+							Neighbours.push_back(Triangles.at(3 * size_t(T) + K));
+			std::sort(Neighbours.begin(), Neighbours.end());
+			Neighbours.erase(std::unique(Neighbours.begin(), Neighbours.end()), Neighbours.end());
+			for (uint32_t N : Neighbours)
+				Consider(To, N);
+		}
+
+		// Keep the triangles that survived and the vertices they still use
+		std::vector<uint32_t> Kept;
+		for (size_t T = 0; T < TriangleCount; T++)
+			if (!Dead.at(T))
+				Kept.insert(Kept.end(), Triangles.begin() + 3 * T, Triangles.begin() + 3 * T + 3);
+		Triangles = Kept;
+
+		OptimizeVertexFetch();
+		std::vector<bool> Used(Vertices.size(), false);
+		for (uint32_t Index : Triangles)
+			Used.at(Index) = true;
+		while (!Vertices.empty() && !Used.at(Vertices.size() - 1))
+			Vertices.pop_back();
+	}
+
+	// Signed volume enclosed by the triangles (only meaningful for closed meshes)
+	inline double Volume() const
+	{
+		double Total = 0.0;
+		for (size_t T = 0; T + 2 < Triangles.size(); T += 3)
+		{
+			const float* A = Vertices.at(Triangles.at(T)).Position;
+			const float* B = Vertices.at(Triangles.at(T + 1)).Position;
+			const float* C = Vertices.at(Triangles.at(T + 2)).Position;
+			Total += (double(A[0]) * (double(B[1]) * C[2] - double(B[2]) * C[1])
+				- double(A[1]) * (double(B[0]) * C[2] - double(B[2]) * C[0])
+				+ double(A[2]) * (double(B[0]) * C[1] - double(B[1]) * C[0])) / 6.0;
+		}
+
+		return Total;
+	}
+
+	// Whether the triangles close up: each edge is crossed as often one way as the other
+	// (vertices within a millionth of the mesh size count as one, so seams split for UVs or normals don't open it)
+	inline bool IsClosed() const
+	{
+		if (Triangles.size() < 12)
+			return false;
+
+		float Extent = 0.0f;
+		for (size_t A = 0; A < 3; A++)
+		{
+			float Min = INFINITY, Max = -INFINITY;
+			for (auto& V : Vertices)
+			{
+				Min = std::min(Min, V.Position[A]);
+				Max = std::max(Max, V.Position[A]);
+			}
+			Extent = std::max(Extent, Max - Min);
+		}
+		double Cell = std::max(double(Extent) * 1e-6, 1e-12);
+
+		std::map<std::array<long long, 3>, uint32_t> Positions;
+		std::vector<uint32_t> Welded(Vertices.size());
+		for (size_t V = 0; V < Vertices.size(); V++)
+		{
+			const float* P = Vertices.at(V).Position;
+			std::array<long long, 3> Key = { std::llround(P[0] / Cell), std::llround(P[1] / Cell), std::llround(P[2] / Cell) };
+			Welded.at(V) = Positions.emplace(Key, static_cast<uint32_t>(Positions.size())).first->second;
+		}
+
+		// Going A to B counts up, B to A counts down, so a closed mesh leaves every edge at zero
+		std::unordered_map<uint64_t, long long> Edges;
+		for (size_t T = 0; T + 2 < Triangles.size(); T += 3)
+		{
+			for (size_t K = 0; K < 3; K++)
+			{
+				uint32_t A = Welded.at(Triangles.at(T + K));
+				uint32_t B = Welded.at(Triangles.at(T + (K + 1) % 3));
+				if (A != B)
+					Edges[A < B ? (uint64_t(A) << 32) | B : (uint64_t(B) << 32) | A] += A < B ? 1 : -1;
+			}
+		}
+
+		for (auto& Edge : Edges)
+			if (Edge.second != 0)
+				return false;
+
+		return true;
+	}
+
+	// Sets each vertex normal to the area weighted average of its triangles
+	inline void ComputeNormals()
+	{
+		for (auto& V : Vertices)
+			V.Normal[0] = V.Normal[1] = V.Normal[2] = 0.0f;
+
+		for (size_t T = 0; T + 2 < Triangles.size(); T += 3)
+		{
+			const float* A = Vertices.at(Triangles.at(T)).Position;
+			const float* B = Vertices.at(Triangles.at(T + 1)).Position;
+			const float* C = Vertices.at(Triangles.at(T + 2)).Position;
+			float U[3] = { B[0] - A[0], B[1] - A[1], B[2] - A[2] };
+			float W[3] = { C[0] - A[0], C[1] - A[1], C[2] - A[2] };
+			float N[3] = { U[1] * W[2] - U[2] * W[1], U[2] * W[0] - U[0] * W[2], U[0] * W[1] - U[1] * W[0] };
+			for (size_t K = 0; K < 3; K++)
+				for (size_t A3 = 0; A3 < 3; A3++)
+					Vertices.at(Triangles.at(T + K)).Normal[A3] += N[A3];
+		}
+
+		for (auto& V : Vertices)
+		{
+			float Length = std::sqrt(V.Normal[0] * V.Normal[0] + V.Normal[1] * V.Normal[1] + V.Normal[2] * V.Normal[2]);
+			if (Length > 0.0f)
+				for (size_t A3 = 0; A3 < 3; A3++)
+					V.Normal[A3] /= Length;
+		}
+	}
+
+	// Returns the triangles (outward wound, indexing Points) of the convex hull, empty if the points are flat
+	static inline std::vector<uint32_t> ConvexHull(const std::vector<Vertex>& Points)
+	{
+		class Face
+		{
+		public:
+			uint32_t Corners[3];
+			double Normal[3];
+			double Offset;
+			bool Alive;
+		};
+
+		std::vector<Face> Faces;
+		if (Points.size() < 4)
+			return {};
+
+		auto Delta = [&](uint32_t A, uint32_t B, double D[3])
+		{
+			for (size_t A3 = 0; A3 < 3; A3++)
+				D[A3] = double(Points.at(B).Position[A3]) - Points.at(A).Position[A3];
+		};
+		auto Cross = [](const double U[3], const double W[3], double N[3])
+		{
+			N[0] = U[1] * W[2] - U[2] * W[1];
+			N[1] = U[2] * W[0] - U[0] * W[2];
+			N[2] = U[0] * W[1] - U[1] * W[0];
+		};
+		auto Height = [&](const Face& F, uint32_t P)
+		{
+			const float* X = Points.at(P).Position;
+			return F.Normal[0] * X[0] + F.Normal[1] * X[1] + F.Normal[2] * X[2] - F.Offset;
+		};
+		auto AddFace = [&](uint32_t A, uint32_t B, uint32_t C)
+		{
+			Face F = { { A, B, C }, { 0.0, 0.0, 0.0 }, 0.0, true };
+			double U[3], W[3];
+			Delta(A, B, U);
+			Delta(A, C, W);
+			Cross(U, W, F.Normal);
+			double Length = std::sqrt(F.Normal[0] * F.Normal[0] + F.Normal[1] * F.Normal[1] + F.Normal[2] * F.Normal[2]);
+			for (size_t A3 = 0; A3 < 3 && Length > 0.0; A3++)
+				F.Normal[A3] /= Length;
+			const float* X = Points.at(A).Position;
+			F.Offset = F.Normal[0] * X[0] + F.Normal[1] * X[1] + F.Normal[2] * X[2];
+			Faces.push_back(F);
+		};
+
+		// Starting tetrahedron from extreme points
+		uint32_t I0 = 0, I1 = 0, I2 = 0, I3 = 0;
+		for (uint32_t P = 0; P < Points.size(); P++)
+			if (Points.at(P).Position[0] < Points.at(I0).Position[0])
+				I0 = P;
+
+		double Best = 0.0, Scale = 0.0;
+		for (uint32_t P = 0; P < Points.size(); P++)
+		{
+			double D[3];
+			Delta(I0, P, D);
+			double Distance = D[0] * D[0] + D[1] * D[1] + D[2] * D[2];
+			if (Distance > Best)
+			{
+				Best = Distance;
+				I1 = P;
+			}
+		}
+		Scale = std::sqrt(Best);
+		double Epsilon = Scale * 1e-6;
+		if (Scale <= 0.0)
+			return {};
+
+		Best = 0.0;
+		double Edge[3];
+		Delta(I0, I1, Edge);
+		for (uint32_t P = 0; P < Points.size(); P++)
+		{
+			double D[3], N[3];
+			Delta(I0, P, D);
+			Cross(Edge, D, N);
+			double Area = N[0] * N[0] + N[1] * N[1] + N[2] * N[2];
+			if (Area > Best)
+			{
+				Best = Area;
+				I2 = P;
+			}
+		}
+		if (std::sqrt(Best) <= Epsilon * Scale)
+			return {};
+
+		AddFace(I0, I1, I2);
+		Best = 0.0;
+		for (uint32_t P = 0; P < Points.size(); P++)
+		{
+			double H = std::fabs(Height(Faces.front(), P));
+			if (H > Best)
+			{
+				Best = H;
+				I3 = P;
+			}
+		}
+		if (Best <= Epsilon)
+			return {};
+
+		// Wind the tetrahedron outwards
+		if (Height(Faces.front(), I3) > 0.0)
+			std::swap(I1, I2);
+		Faces.clear();
+		AddFace(I0, I1, I2);
+		AddFace(I0, I3, I1);
+		AddFace(I1, I3, I2);
+		AddFace(I2, I3, I0);
+
+		// Add the other points one at a time, replacing the faces they can see
+		for (uint32_t P = 0; P < Points.size(); P++)
+		{
+			std::unordered_map<uint64_t, bool> Horizon;
+			auto Key = [](uint32_t A, uint32_t B) { return (uint64_t(A) << 32) | B; };
+			for (auto& F : Faces)
+			{
+				if (!F.Alive || Height(F, P) <= Epsilon)
+					continue;
+
+				F.Alive = false;
+				for (size_t K = 0; K < 3; K++)
+				{
+					uint32_t A = F.Corners[K], B = F.Corners[(K + 1) % 3];
+
+					// An edge seen from both sides is inside the visible region
+					auto Reverse = Horizon.find(Key(B, A));
+					if (Reverse != Horizon.end())
+						Horizon.erase(Reverse);
+					else
+						Horizon[Key(A, B)] = true;
+				}
+			}
+
+			for (auto& Edge : Horizon)
+				AddFace(uint32_t(Edge.first >> 32), uint32_t(Edge.first & 0xFFFFFFFF), P);
+
+			// Drop dead faces once they outnumber the live ones, so the scans stay short
+			size_t Dead = std::count_if(Faces.begin(), Faces.end(), [](const Face& F) { return !F.Alive; });
+			if (Dead * 2 > Faces.size())
+				Faces.erase(std::remove_if(Faces.begin(), Faces.end(), [](const Face& F) { return !F.Alive; }), Faces.end());
+		}
+
+		std::vector<uint32_t> Hull;
+		for (auto& F : Faces)
+			if (F.Alive)
+				Hull.insert(Hull.end(), { F.Corners[0], F.Corners[1], F.Corners[2] });
+
+		return Hull;
+	}
+
+	// Removes zero area triangles, repeated triangles, and pairs of back to back triangles (faces inside a closed volume),
+	// returns how many triangles went
+	inline size_t RemoveInteriorFaces()
+	{
+		size_t TriangleCount = Triangles.size() / 3;
+
+		// Triangles by their sorted corners, so reversed copies land together
+		std::map<std::array<uint32_t, 3>, std::vector<size_t>> Same;
+		std::vector<bool> Drop(TriangleCount, false);
+		for (size_t T = 0; T < TriangleCount; T++)
+		{
+			uint32_t A = Triangles.at(3 * T), B = Triangles.at(3 * T + 1), C = Triangles.at(3 * T + 2);
+			double N[3];
+			const float* P = Vertices.at(A).Position;
+			const float* Q = Vertices.at(B).Position;
+			const float* R = Vertices.at(C).Position;
+			double U[3] = { Q[0] - P[0], Q[1] - P[1], Q[2] - P[2] };
+			double W[3] = { R[0] - P[0], R[1] - P[1], R[2] - P[2] };
+			N[0] = U[1] * W[2] - U[2] * W[1];
+			N[1] = U[2] * W[0] - U[0] * W[2];
+			N[2] = U[0] * W[1] - U[1] * W[0];
+			if (A == B || B == C || A == C || N[0] * N[0] + N[1] * N[1] + N[2] * N[2] <= 1e-20)
+			{
+				Drop.at(T) = true;
+				continue;
+			}
+
+			std::array<uint32_t, 3> Sorted = { A, B, C };
+			std::sort(Sorted.begin(), Sorted.end());
+			Same[Sorted].push_back(T);
+		}
+
+		// A face and its reverse cancel out, repeats of the same winding collapse into one
+		for (auto& Group : Same)
+		{
+			std::vector<size_t> Forward, Backward;
+			const std::vector<size_t>& Faces = Group.second;
+			for (size_t T : Faces)
+			{
+				uint32_t* F = &Triangles.at(3 * Faces.front());
+				uint32_t* G = &Triangles.at(3 * T);
+				bool Matches = (G[0] == F[0] && G[1] == F[1]) || (G[0] == F[1] && G[1] == F[2]) || (G[0] == F[2] && G[1] == F[0]);
+				(Matches ? Forward : Backward).push_back(T);
+			}
+
+			// Whichever winding is left over after pairing keeps one face
+			size_t Pairs = std::min(Forward.size(), Backward.size());
+			for (size_t I = 0; I < Forward.size(); I++)
+				Drop.at(Forward.at(I)) = I != Pairs;
+			for (size_t I = 0; I < Backward.size(); I++)
+				Drop.at(Backward.at(I)) = I != Pairs;
+		}
+
+		std::vector<uint32_t> Kept;
+		for (size_t T = 0; T < TriangleCount; T++)
+			if (!Drop.at(T))
+				Kept.insert(Kept.end(), Triangles.begin() + 3 * T, Triangles.begin() + 3 * T + 3);
+
+		size_t Removed = TriangleCount - Kept.size() / 3;
+		Triangles = Kept;
+		return Removed;
+	}
+
+	// Fills the holes bounded by at most MaxEdges open edges with fans, returns how many were closed
+	inline size_t CloseHoles(size_t MaxEdges)
+	{
+		// Half edges with no twin going the other way are open
+		std::unordered_map<uint64_t, size_t> HalfEdges;
+		auto Key = [](uint32_t A, uint32_t B) { return (uint64_t(A) << 32) | B; };
+		for (size_t I = 0; I + 2 < Triangles.size(); I += 3)
+			for (size_t K = 0; K < 3; K++)
+				HalfEdges[Key(Triangles.at(I + K), Triangles.at(I + (K + 1) % 3))]++;
+
+		std::unordered_map<uint32_t, uint32_t> Open;
+		std::vector<uint32_t> Starts;
+		for (auto& Edge : HalfEdges)
+		{
+			uint32_t A = uint32_t(Edge.first >> 32), B = uint32_t(Edge.first & 0xFFFFFFFF);
+			if (HalfEdges.find(Key(B, A)) == HalfEdges.end())
+			{
+				// Where several open edges leave one vertex the loop is ambiguous, so it isn't filled
+				if (Open.count(A) != 0)
+					Open[A] = UINT32_MAX;
+				else
+					Open[A] = B;
+				Starts.push_back(A);
+			}
+		}
+		std::sort(Starts.begin(), Starts.end());
+
+		size_t Closed = 0;
+		std::unordered_map<uint32_t, bool> Visited;
+		for (uint32_t Start : Starts)
+		{
+			if (Visited.count(Start) != 0 || Open.at(Start) == UINT32_MAX)
+				continue;
+
+			// Follow the open edges round the hole
+			std::vector<uint32_t> Loop = { Start };
+			bool Simple = true;
+			for (uint32_t Next = Open.at(Start); Next != Start; Next = Open.at(Next))
+			{
+				auto Found = Open.find(Next);
+				if (Found == Open.end() || Found->second == UINT32_MAX || Visited.count(Next) != 0 || Loop.size() > MaxEdges)
+				{
+					Simple = false;
+					break;
+				}
+				Loop.push_back(Next);
+				Visited[Next] = true;
+			}
+			Visited[Start] = true;
+
+			if (!Simple || Loop.size() < 3 || Loop.size() > MaxEdges)
+				continue;
+
+			// The fan runs against the loop so its edges twin the open ones
+			for (size_t I = 1; I + 1 < Loop.size(); I++)
+				Triangles.insert(Triangles.end(), { Loop.front(), Loop.at(I + 1), Loop.at(I) });
+			Closed++;
+		}
+
+		return Closed;
+	}
+
+	// Counts the edges that can end up on a silhouette: open edges and edges between faces that aren't coplanar
+	inline size_t SilhouetteEdges() const
+	{
+		std::unordered_map<uint64_t, std::vector<size_t>> Edges;
+		auto Key = [](uint32_t A, uint32_t B) { return A < B ? (uint64_t(A) << 32) | B : (uint64_t(B) << 32) | A; };
+		std::vector<std::array<double, 3>> Normals;
+		for (size_t I = 0; I + 2 < Triangles.size(); I += 3)
+		{
+			const float* P = Vertices.at(Triangles.at(I)).Position;
+			const float* Q = Vertices.at(Triangles.at(I + 1)).Position;
+			const float* R = Vertices.at(Triangles.at(I + 2)).Position;
+			double U[3] = { Q[0] - P[0], Q[1] - P[1], Q[2] - P[2] };
+			double W[3] = { R[0] - P[0], R[1] - P[1], R[2] - P[2] };
+			std::array<double, 3> N = { U[1] * W[2] - U[2] * W[1], U[2] * W[0] - U[0] * W[2], U[0] * W[1] - U[1] * W[0] };
+			double Length = std::sqrt(N[0] * N[0] + N[1] * N[1] + N[2] * N[2]);
+			for (size_t A = 0; A < 3 && Length > 0.0; A++)
+				N[A] /= Length;
+			Normals.push_back(N);
+
+			for (size_t K = 0; K < 3; K++)
+				Edges[Key(Triangles.at(I + K), Triangles.at(I + (K + 1) % 3))].push_back(I / 3);
+		}
+
+		size_t Count = 0;
+		for (auto& Edge : Edges)
+		{
+			const std::vector<size_t>& Faces = Edge.second;
+			bool Flat = Faces.size() == 2 && Normals.at(Faces.at(0))[0] * Normals.at(Faces.at(1))[0]
+				+ Normals.at(Faces.at(0))[1] * Normals.at(Faces.at(1))[1] + Normals.at(Faces.at(0))[2] * Normals.at(Faces.at(1))[2] > 0.9999;
+			if (!Flat)
+				Count++;
+		}
+
+		return Count;
+	}
+
+	// Cleans a shadow volume mesh, which only needs positions: welds it, drops degenerate and interior faces,
+	// closes small holes and merges coplanar triangles so fewer edges can become silhouettes
+	inline void OptimizeShadowVolume(size_t MaxHoleEdges)
+	{
+		for (auto& V : Vertices)
+		{
+			std::fill(V.UV, V.UV + 2, 0.0f);
+			std::fill(V.Color, V.Color + 4, static_cast<unsigned char>(255));
+			std::fill(V.Normal, V.Normal + 3, 0.0f);
+		}
+
+		float Min[3] = { INFINITY, INFINITY, INFINITY };
+		float Max[3] = { -INFINITY, -INFINITY, -INFINITY };
+		for (auto& V : Vertices)
+			for (size_t A = 0; A < 3; A++)
+			{
+				Min[A] = std::min(Min[A], V.Position[A]);
+				Max[A] = std::max(Max[A], V.Position[A]);
+			}
+		double Scale = 0.0;
+		for (size_t A = 0; A < 3 && !Vertices.empty(); A++)
+			Scale += double(Max[A] - Min[A]) * (Max[A] - Min[A]);
+
+		Weld(static_cast<float>(std::sqrt(Scale) * 1e-5), INFINITY, INFINITY, 255.0f);
+		RemoveInteriorFaces();
+		CloseHoles(MaxHoleEdges);
+
+		// Quadric error is area times squared distance, so this allows about a thousandth of the size
+		Simplify(0.0f, Scale * Scale * 1e-6);
+		RemoveInteriorFaces();
+
+		if (HasNormals)
+			ComputeNormals();
+	}
+
+	// Turns STRP indices into a triangle list (a strip starts where two indices in a row have the top bit set)
+	static inline std::vector<uint32_t> StripsToTriangles(const std::vector<uint16_t>& Strip)
+	{
+		std::vector<uint32_t> Triangles;
+		size_t Start = 0;
+		for (size_t I = 0; I < Strip.size(); I++)
+		{
+			bool NewStrip = I + 1 < Strip.size() && (Strip.at(I) & 0x8000) && (Strip.at(I + 1) & 0x8000);
+			if (NewStrip)
+			{
+				Start = I;
+				continue;
+			}
+
+			if (I < Start + 2)
+				continue;
+
+			uint32_t A = Strip.at(I - 2) & 0x7FFF;
+			uint32_t B = Strip.at(I - 1) & 0x7FFF;
+			uint32_t C = Strip.at(I) & 0x7FFF;
+
+			// Degenerates join strips, they aren't triangles
+			if (A == B || B == C || A == C)
+				continue;
+
+			// Every other triangle in a strip is wound the other way
+			if ((I - Start) % 2 == 0)
+				Triangles.insert(Triangles.end(), { A, B, C });
+			else
+				Triangles.insert(Triangles.end(), { B, A, C });
+		}
+
+		return Triangles;
+	}
+
+	// Builds the STRP indices for the triangles, in their order if StripsInOrder is set
+	inline std::vector<uint16_t> EncodeStrips() const
+	{
+		return StripsInOrder ? TrianglesToOrderedStrips(Triangles) : TrianglesToStrips(Triangles);
+	}
+
+	// Turns a triangle list into STRP indices that draw the triangles in the same order,
+	// a strip going on for as long as the next triangle continues it
+	static inline std::vector<uint16_t> TrianglesToOrderedStrips(const std::vector<uint32_t>& Triangles)
+	{
+		size_t TriangleCount = Triangles.size() / 3;
+		std::vector<uint16_t> Strip;
+		Strip.reserve(Triangles.size());
+
+		// Whether triangle T has the directed edge A to B
+		auto HasEdge = [&](size_t T, uint32_t A, uint32_t B)
+		{
+			for (size_t K = 0; K < 3; K++)
+				if (Triangles.at(3 * T + K) == A && Triangles.at(3 * T + (K + 1) % 3) == B)
+					return true;
+			return false;
+		};
+
+		// Last two indices of the current strip and how many it has
+		uint32_t X = 0, Y = 0;
+		size_t Length = 0;
+		for (size_t T = 0; T < TriangleCount; T++)
+		{
+			uint32_t A = Triangles.at(3 * T), B = Triangles.at(3 * T + 1), C = Triangles.at(3 * T + 2);
+			if (A == B || B == C || A == C)
+				continue;
+
+			// Every other triangle in a strip is wound backwards, so the shared edge has to run the right way
+			bool Flipped = Length % 2 == 1;
+			if (Length > 0 && (Flipped ? HasEdge(T, Y, X) : HasEdge(T, X, Y)))
+			{
+				for (size_t K = 0; K < 3; K++)
+				{
+					uint32_t Corner = Triangles.at(3 * T + K);
+					if (Corner != X && Corner != Y)
+					{
+						Strip.push_back(uint16_t(Corner));
+						X = Y;
+						Y = Corner;
+						break;
+					}
+				}
+				Length++;
+				continue;
+			}
+
+			// Otherwise a new strip, starting at the corner that lets the next triangle carry on from it
+			size_t First = 0;
+			if (T + 1 < TriangleCount)
+				for (size_t K = 0; K < 3; K++)
+					if (HasEdge(T + 1, Triangles.at(3 * T + (K + 2) % 3), Triangles.at(3 * T + (K + 1) % 3)))
+						First = K;
+
+			for (size_t K = 0; K < 3; K++)
+				Strip.push_back(uint16_t(Triangles.at(3 * T + (First + K) % 3) | (K < 2 ? 0x8000 : 0)));
+			X = Triangles.at(3 * T + (First + 1) % 3);
+			Y = Triangles.at(3 * T + (First + 2) % 3);
+			Length = 3;
+		}
+
+		return Strip;
+	}
+
+	// Turns a triangle list into STRP indices, walking each strip as far as the shared edges allow
+	// (each strip starts with two flagged indices, so no degenerates are needed between them)
+	static inline std::vector<uint16_t> TrianglesToStrips(const std::vector<uint32_t>& Triangles)
+	{
+		size_t TriangleCount = Triangles.size() / 3;
+
+		// Triangles by directed edge, in their winding order
+		std::unordered_map<uint64_t, std::vector<uint32_t>> Edges;
+		auto Key = [](uint32_t A, uint32_t B) { return (uint64_t(A) << 32) | B; };
+		for (size_t T = 0; T < TriangleCount; T++)
+			for (size_t K = 0; K < 3; K++)
+				Edges[Key(Triangles.at(3 * T + K), Triangles.at(3 * T + (K + 1) % 3))].push_back(static_cast<uint32_t>(T));
+
+		std::vector<bool> Used(TriangleCount, false);
+
+		// Degenerate triangles draw nothing, so they aren't stripped
+		for (size_t T = 0; T < TriangleCount; T++)
+		{
+			uint32_t A = Triangles.at(3 * T), B = Triangles.at(3 * T + 1), C = Triangles.at(3 * T + 2);
+			Used.at(T) = A == B || B == C || A == C;
+		}
+
+		// Follows a strip from triangle T starting at corner First, returning its indices and triangles
+		std::vector<uint32_t> Walked(TriangleCount, 0);
+		uint32_t Walks = 0;
+		auto Walk = [&](size_t T, size_t First, std::vector<uint32_t>& Indices, std::vector<uint32_t>& Taken)
+		{
+			Walks++;
+			Walked.at(T) = Walks;
+			Indices.clear();
+			Taken.assign(1, static_cast<uint32_t>(T));
+			for (size_t K = 0; K < 3; K++)
+				Indices.push_back(Triangles.at(3 * T + (First + K) % 3));
+
+			while (true)
+			{
+				// The next triangle shares the last edge, and every other triangle is wound backwards
+				uint32_t X = Indices.at(Indices.size() - 2);
+				uint32_t Y = Indices.back();
+				bool Flipped = Indices.size() % 2 == 1;
+				auto Found = Edges.find(Flipped ? Key(Y, X) : Key(X, Y));
+				if (Found == Edges.end())
+					break;
+
+				long long Next = -1;
+				for (uint32_t Candidate : Found->second)
+					if (!Used.at(Candidate) && Walked.at(Candidate) != Walks)
+					{
+						Next = Candidate;
+						break;
+					}
+				if (Next < 0)
+					break;
+
+				// The new index is the corner that isn't on the shared edge
+				for (size_t K = 0; K < 3; K++)
+				{
+					uint32_t Corner = Triangles.at(3 * size_t(Next) + K);
+					if (Corner != X && Corner != Y)
+					{
+						Indices.push_back(Corner);
+						break;
+					}
+				}
+				Taken.push_back(static_cast<uint32_t>(Next));
+				Walked.at(size_t(Next)) = Walks;
+			}
+		};
+
+		std::vector<uint16_t> Strip;
+		Strip.reserve(Triangles.size());
+		std::vector<uint32_t> Indices, Taken, BestIndices, BestTaken;
+		for (size_t T = 0; T < TriangleCount; T++)
+		{
+			if (Used.at(T))
+				continue;
+
+			// Try each corner of the first triangle and keep the longest strip
+			BestTaken.clear();
+			for (size_t First = 0; First < 3; First++)
+			{
+				Walk(T, First, Indices, Taken);
+				if (Taken.size() > BestTaken.size())
+				{
+					BestIndices.swap(Indices);
+					BestTaken.swap(Taken);
+				}
+			}
+
+			for (uint32_t Done : BestTaken)
+				Used.at(Done) = true;
+
+			for (size_t I = 0; I < BestIndices.size(); I++)
+				Strip.push_back(uint16_t(BestIndices.at(I) | (I < 2 ? 0x8000 : 0)));
+		}
+
+		return Strip;
+	}
+
+	// Keeps at most MaxInfluences bones per vertex, dropping any under Epsilon (the heaviest always stays),
+	// then scales what's left back up to 1. Returns how many vertices lost a bone
+	inline size_t LimitWeights(size_t MaxInfluences, float Epsilon)
+	{
+		if (!HasWeights)
+			return 0;
+
+		MaxInfluences = std::clamp(MaxInfluences, size_t(1), size_t(4));
+		size_t Changed = 0;
+		for (auto& V : Vertices)
+		{
+			// The same bone can take up more than one slot, count it once
+			uint32_t Bones[4] = { 0, 0, 0, 0 };
+			float Weights[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			size_t Count = 0;
+			bool Merged = false;
+			for (size_t W = 0; W < 4; W++)
+			{
+				if (!(V.Weights[W] > 0.0f))
+					continue;
+
+				size_t Slot = std::find(Bones, Bones + Count, V.Bones[W]) - Bones;
+				Merged = Merged || Slot < Count;
+				if (Slot == Count)
+					Bones[Count++] = V.Bones[W];
+				Weights[Slot] += V.Weights[W];
+			}
+
+			// Heaviest first, then keep what makes the cut
+			size_t Order[4] = { 0, 1, 2, 3 };
+			std::stable_sort(Order, Order + Count, [&](size_t A, size_t B) { return Weights[A] > Weights[B]; });
+
+			size_t Kept = 0;
+			while (Kept < Count && Kept < MaxInfluences && (Kept == 0 || Weights[Order[Kept]] >= Epsilon))
+				Kept++;
+
+			if (Kept == Count && !Merged)
+				continue;
+
+			for (size_t W = 0; W < 4; W++)
+			{
+				V.Bones[W] = W < Kept ? Bones[Order[W]] : 0;
+				V.Weights[W] = W < Kept ? Weights[Order[W]] : 0.0f;
+			}
+			Changed += Kept < Count ? 1 : 0;
+		}
+
+		NormalizeWeights();
+		return Changed;
+	}
+
+	// Scales the weights of each vertex to add up to 1 (vertices with none, or already there, are left alone)
+	inline void NormalizeWeights()
+	{
+		for (auto& V : Vertices)
+		{
+#if GEOMETRY_SSE
+			// Add up all four lanes, then divide them all at once
+			__m128 W = _mm_loadu_ps(V.Weights);
+			__m128 Sum = _mm_add_ps(W, _mm_shuffle_ps(W, W, _MM_SHUFFLE(2, 3, 0, 1)));
+			Sum = _mm_add_ps(Sum, _mm_shuffle_ps(Sum, Sum, _MM_SHUFFLE(1, 0, 3, 2)));
+			float Total = _mm_cvtss_f32(Sum);
+			if (Total > 0.0f && std::fabs(Total - 1.0f) > 1e-6f)
+				_mm_storeu_ps(V.Weights, _mm_div_ps(W, Sum));
+#else
+			float Total = V.Weights[0] + V.Weights[1] + V.Weights[2] + V.Weights[3];
+			if (Total > 0.0f && std::fabs(Total - 1.0f) > 1e-6f)
+				for (size_t W = 0; W < 4; W++)
+					V.Weights[W] /= Total;
+#endif
+		}
+	}
+
+private:
+
+	// Counts the vertex transforms a FIFO cache needs for the triangle order, noting the
+	// triangles where it had none of the three vertices
+	inline size_t SimulateCache(size_t CacheSize, std::vector<size_t>* ColdStarts) const
+	{
+		std::vector<size_t> Stamps(Vertices.size(), 0);
+		size_t Time = CacheSize + 1;
+		size_t Misses = 0;
+		for (size_t T = 0; T + 2 < Triangles.size(); T += 3)
+		{
+			size_t TriangleMisses = 0;
+			for (size_t K = 0; K < 3; K++)
+			{
+				// A vertex is in the cache if fewer than CacheSize misses happened since it was loaded
+				size_t& Stamp = Stamps.at(Triangles.at(T + K));
+				if (Time - Stamp > CacheSize)
+				{
+					Stamp = Time++;
+					TriangleMisses++;
+				}
+			}
+
+			if (ColdStarts != nullptr && (TriangleMisses == 3 || T == 0))
+				ColdStarts->push_back(T / 3);
+			Misses += TriangleMisses;
+		}
+
+		return Misses;
+	}
+
+	// Makes room for at least Count vertices
+	inline void Grow(size_t Count)
+	{
+		if (Vertices.size() < Count)
+			Vertices.resize(Count);
+	}
+
+	// Appends raw bytes to a payload
+	static inline void Append(std::vector<unsigned char>& Out, const void* Bytes, size_t Count)
+	{
+		const unsigned char* First = static_cast<const unsigned char*>(Bytes);
+		Out.insert(Out.end(), First, First + Count);
+	}
+};
+
+// A collision primitive fitted around a set of points (the shapes a SWCI chunk can hold)
+class Primitive
+{
+public:
+
+	// SWCI type: 0 sphere, 2 cylinder, 4 box
+	uint32_t Type = 4;
+
+	// SWCI sizes: radius for a sphere, radius and half height (along local Y) for a cylinder, half extents for a box
+	float Size[3] = { 0.0f, 0.0f, 0.0f };
+
+	// Center, and the local X, Y and Z axes as columns
+	float Center[3] = { 0.0f, 0.0f, 0.0f };
+	float Axes[3][3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+
+	// Volume of the shape
+	inline double Volume() const
+	{
+		const double Pi = 3.14159265358979;
+		if (Type == 0)
+			return 4.0 / 3.0 * Pi * Size[0] * Size[0] * Size[0];
+		if (Type == 2)
+			return Pi * Size[0] * Size[0] * 2.0 * Size[1];
+		return 8.0 * Size[0] * Size[1] * Size[2];
+	}
+
+	// Rotation of the axes as a quaternion (XYZW, as TRAN stores it)
+	inline void Rotation(float Q[4]) const
+	{
+		Matrix::Quaternion(Axes, Q);
+	}
+
+	// Fits an oriented box, a sphere and a cylinder around each box axis, smallest first
+	// The box axes come from the principal axes of the points, then get turned about each one to shrink it
+	static inline std::vector<Primitive> Fit(const std::vector<std::array<float, 3>>& Points)
+	{
+		std::vector<Primitive> Fits;
+		if (Points.empty())
+			return Fits;
+
+		double Mean[3] = { 0.0, 0.0, 0.0 };
+		for (auto& P : Points)
+			for (size_t A = 0; A < 3; A++)
+				Mean[A] += P[A] / double(Points.size());
+
+		double Covariance[3][3] = {};
+		for (auto& P : Points)
+			for (size_t R = 0; R < 3; R++)
+				for (size_t C = 0; C < 3; C++)
+					Covariance[R][C] += (P[R] - Mean[R]) * (P[C] - Mean[C]);
+
+		Primitive Box;
+		PrincipalAxes(Covariance, Box.Axes);
+		Box.Wrap(Points);
+
+		// Refinement, turning the box about each axis in 3 degree steps while it gets smaller
+		for (size_t Axis = 0; Axis < 3; Axis++)
+		{
+			Primitive Best = Box;
+			for (int Step = -15; Step <= 15; Step++)
+			{
+				double Angle = Step * 3.14159265358979 / 60.0;
+				Primitive Turned = Box;
+				size_t U = (Axis + 1) % 3, V = (Axis + 2) % 3;
+				for (size_t R = 0; R < 3; R++)
+				{
+					Turned.Axes[R][U] = float(std::cos(Angle) * Box.Axes[R][U] + std::sin(Angle) * Box.Axes[R][V]);
+					Turned.Axes[R][V] = float(-std::sin(Angle) * Box.Axes[R][U] + std::cos(Angle) * Box.Axes[R][V]);
+				}
+				Turned.Wrap(Points);
+				if (Turned.Volume() < Best.Volume())
+					Best = Turned;
+			}
+			Box = Best;
+		}
+		Fits.push_back(Box);
+
+		// Sphere around the box center
+		Primitive Sphere = Box;
+		Sphere.Type = 0;
+		Sphere.Size[0] = Sphere.Size[1] = Sphere.Size[2] = 0.0f;
+		for (auto& P : Points)
+		{
+			float D[3] = { P[0] - Box.Center[0], P[1] - Box.Center[1], P[2] - Box.Center[2] };
+			Sphere.Size[0] = std::max(Sphere.Size[0], std::sqrt(D[0] * D[0] + D[1] * D[1] + D[2] * D[2]));
+		}
+		Fits.push_back(Sphere);
+
+		// Cylinders stand along local Y, so each box axis in turn becomes Y
+		for (size_t Axis = 0; Axis < 3; Axis++)
+		{
+			Primitive Cylinder = Box;
+			Cylinder.Type = 2;
+			for (size_t R = 0; R < 3; R++)
+			{
+				Cylinder.Axes[R][1] = Box.Axes[R][Axis];
+				Cylinder.Axes[R][2] = Box.Axes[R][(Axis + 1) % 3];
+				Cylinder.Axes[R][0] = Box.Axes[R][(Axis + 2) % 3];
+			}
+
+			float Radius = 0.0f;
+			for (auto& P : Points)
+			{
+				float D[3] = { P[0] - Box.Center[0], P[1] - Box.Center[1], P[2] - Box.Center[2] };
+				float X = D[0] * Cylinder.Axes[0][0] + D[1] * Cylinder.Axes[1][0] + D[2] * Cylinder.Axes[2][0];
+				float Z = D[0] * Cylinder.Axes[0][2] + D[1] * Cylinder.Axes[1][2] + D[2] * Cylinder.Axes[2][2];
+				Radius = std::max(Radius, std::sqrt(X * X + Z * Z));
+			}
+			Cylinder.Size[0] = Radius;
+			Cylinder.Size[1] = Box.Size[Axis];
+			Cylinder.Size[2] = 0.0f;
+			Fits.push_back(Cylinder);
+		}
+
+		std::stable_sort(Fits.begin(), Fits.end(), [](const Primitive& A, const Primitive& B) { return A.Volume() < B.Volume(); });
+		return Fits;
+	}
+
+private:
+
+	// Sets the box center and half extents to hold the points along the current axes
+	inline void Wrap(const std::vector<std::array<float, 3>>& Points)
+	{
+		float Min[3] = { INFINITY, INFINITY, INFINITY };
+		float Max[3] = { -INFINITY, -INFINITY, -INFINITY };
+		for (auto& P : Points)
+			for (size_t A = 0; A < 3; A++)
+			{
+				float Along = P[0] * Axes[0][A] + P[1] * Axes[1][A] + P[2] * Axes[2][A];
+				Min[A] = std::min(Min[A], Along);
+				Max[A] = std::max(Max[A], Along);
+			}
+
+		for (size_t R = 0; R < 3; R++)
+			Center[R] = 0.0f;
+		for (size_t A = 0; A < 3; A++)
+		{
+			Size[A] = (Max[A] - Min[A]) / 2.0f;
+			for (size_t R = 0; R < 3; R++)
+				Center[R] += Axes[R][A] * (Min[A] + Max[A]) / 2.0f;
+		}
+	}
+
+	// Eigenvectors of a symmetric 3x3 matrix by Jacobi rotations, as right handed columns
+	static inline void PrincipalAxes(double A[3][3], float Axes[3][3])
+	{
+		double V[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } };
+		for (size_t Sweep = 0; Sweep < 32; Sweep++)
+		{
+			for (size_t P = 0; P < 2; P++)
+			{
+				for (size_t Q = P + 1; Q < 3; Q++)
+				{
+					if (std::fabs(A[P][Q]) < 1e-12)
+						continue;
+
+					double Theta = (A[Q][Q] - A[P][P]) / (2.0 * A[P][Q]);
+					double T = (Theta >= 0.0 ? 1.0 : -1.0) / (std::fabs(Theta) + std::sqrt(Theta * Theta + 1.0));
+					double C = 1.0 / std::sqrt(T * T + 1.0), S = T * C;
+
+					for (size_t K = 0; K < 3; K++)
+					{
+						double KP = A[K][P], KQ = A[K][Q];
+						A[K][P] = C * KP - S * KQ;
+						A[K][Q] = S * KP + C * KQ;
+					}
+					for (size_t K = 0; K < 3; K++)
+					{
+						double PK = A[P][K], QK = A[Q][K];
+						A[P][K] = C * PK - S * QK;
+						A[Q][K] = S * PK + C * QK;
+					}
+					for (size_t K = 0; K < 3; K++)
+					{
+						double KP = V[K][P], KQ = V[K][Q];
+						V[K][P] = C * KP - S * KQ;
+						V[K][Q] = S * KP + C * KQ;
+					}
+				}
+			}
+		}
+
+		for (size_t R = 0; R < 3; R++)
+			for (size_t C = 0; C < 3; C++)
+				Axes[R][C] = float(V[R][C]);
+
+		// Z = X cross Y keeps the axes a rotation
+		Axes[0][2] = Axes[1][0] * Axes[2][1] - Axes[2][0] * Axes[1][1];
+		Axes[1][2] = Axes[2][0] * Axes[0][1] - Axes[0][0] * Axes[2][1];
+		Axes[2][2] = Axes[0][0] * Axes[1][1] - Axes[1][0] * Axes[0][1];
+	}
+};
+
+// Render cost of a model, or the sum over several
+class RenderStats
+{
+public:
+
+	// Model (or file) the numbers are for
+	std::string Name;
+
+	// Segments, and the draw calls they cost (hidden and collision models aren't drawn)
+	size_t Segments = 0;
+	size_t DrawCalls = 0;
+
+	size_t Vertices = 0;
+	size_t Triangles = 0;
+
+	// Misses of a 16 entry FIFO post-transform cache, ACMR is this over Triangles
+	size_t CacheMisses = 0;
+
+	// Bytes of the vertex lists and of the index list the engine draws from (STRP, else the triangles)
+	size_t VertexBytes = 0;
+	size_t IndexBytes = 0;
+
+	// Part of VertexBytes spent on CLRL and WGHT
+	size_t ColorBytes = 0;
+	size_t WeightBytes = 0;
+
+	// Adds another model's numbers to these
+	inline void Add(const RenderStats& Other)
+	{
+		Segments += Other.Segments;
+		DrawCalls += Other.DrawCalls;
+		Vertices += Other.Vertices;
+		Triangles += Other.Triangles;
+		CacheMisses += Other.CacheMisses;
+		VertexBytes += Other.VertexBytes;
+		IndexBytes += Other.IndexBytes;
+		ColorBytes += Other.ColorBytes;
+		WeightBytes += Other.WeightBytes;
+	}
+
+	// Average cache miss ratio over all the triangles
+	inline float ACMR() const
+	{
+		return Triangles > 0 ? static_cast<float>(CacheMisses) / Triangles : 0.0f;
+	}
+
+	// Column headings for Row
+	static inline std::string Heading()
+	{
+		std::ostringstream Out;
+		Out << std::left << std::setw(24) << " NAME" << std::right << std::setw(6) << "SEGS" << std::setw(7) << "DRAWS"
+			<< std::setw(9) << "VERTS" << std::setw(9) << "TRIS" << std::setw(7) << "ACMR" << std::setw(11) << "VB BYTES"
+			<< std::setw(11) << "IB BYTES" << std::setw(10) << "CLRL" << std::setw(10) << "WGHT";
+		return Out.str();
+	}
+
+	// One line of the stats table
+	inline std::string Row() const
+	{
+		std::ostringstream Out;
+		Out << ' ' << std::left << std::setw(23) << Name << std::right << std::setw(6) << Segments << std::setw(7) << DrawCalls
+			<< std::setw(9) << Vertices << std::setw(9) << Triangles << std::setw(7) << std::fixed << std::setprecision(3) << ACMR()
+			<< std::setw(11) << VertexBytes << std::setw(11) << IndexBytes << std::setw(10) << ColorBytes << std::setw(10) << WeightBytes;
+		return Out.str();
+	}
+};
@@ -9,9 +9,16 @@
 #include <string_view>
 #include "Material.h"
 #include "Model.h"
+#include "Chunk.h"
+#include "Geometry.h"
+#include "ThreadPool.h"
 #include <bitset>
 #include <regex>
 #include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
 
 // Object that holds all data on the MSH as well as functions
 // for all required operations
@@ -24,9 +31,21 @@ public:
 
 	std::string GetMSHFilename();
 
+	// Returns a copy of this MSH that owns its own copy of the data
+	MSH Clone();
+
+	// Frees the data held by this MSH
+	void CloseMSH();
+
 	// Read the MSH into memory and populate MSH object
 	bool ReadMSH();
 
+	// Read the MSH file into memory without parsing it
+	bool LoadMSH();
+
+	// Populate the MSH object from the data already in memory
+	void ParseMSH();
+
 	// Renames the selected material
 	void RenameMaterial(unsigned short Selected, std::string name);
 
@@ -93,15 +112,132 @@ public:
 	// Displays all materials according to specifications
 	void ListMaterials();
 
+	// Lists what changed from this MSH to Other, empty when they're the same
+	std::vector<std::string> GetChanges(MSH& Other);
+
+	// Prints what changed from this MSH to Other, returns the number of differences
+	size_t DiffMSH(MSH& Other);
+
+	// Checks the structure of the loaded (not parsed) file without trusting any of it (a parsed one has its edits baked in first)
+	// Returns the problems found as (file offset, chunk path, message)
+	std::vector<std::tuple<size_t, std::string, std::string>> ValidateMSH();
+
+	// Rebuilds the chunk tree of the loaded (not parsed) file with a resynchronizing scan,
+	// then rewrites every chunk size from the bottom up. Returns what had to be fixed
+	std::vector<std::string> RepairMSH();
+
 	// Make any needed adjustments/edits to Data unsigned char array before writing
 	void PrepMSHForWrite();
 
-	// Write the MSH object to file
-	bool WriteMSH();
+	// Write the MSH object to file (without the console line when Quiet, for callers on worker threads)
+	bool WriteMSH(bool Quiet = false);
 
 	// Returns whether the MSH has been altered and needs to be written
 	bool MSHChanged();
 
+	// Adds the materials and models of Other to this MSH (identical materials are shared)
+	void MergeMSH(MSH& Other);
+
+	// Returns the models (by index) of each root hierarchy, or of each model on its own
+	std::vector<std::vector<size_t>> GetModelGroups(bool PerModel);
+
+	// Returns the name of a model without its padding
+	std::string GetModelName(size_t ModelIndex);
+
+	// Returns the parent of each model, or -1 for roots (no PRNT, or one that doesn't exist)
+	std::vector<long long> GetModelParents();
+
+	// Returns the parent and child links of the models
+	const Hierarchy& GetHierarchy();
+
+	// Returns the transform of a model relative to its parent (from its TRAN)
+	Matrix GetLocalTransform(size_t ModelIndex);
+
+	// Returns the world transform of every model, working out only those invalidated since the last call
+	const std::vector<Matrix>& GetWorldTransforms();
+
+	// Returns whether the name marks a hardpoint, collision, shadow volume, bone or other special model
+	static bool IsSpecialModel(const std::string& Name);
+
+	// Returns whether the name marks a collision model (collision or p_ prefixed)
+	static bool IsCollisionModel(const std::string& Name);
+
+	// Returns whether the name marks a shadow volume model (sv_ or shadowvolume prefixed)
+	static bool IsShadowModel(const std::string& Name);
+
+	// Collapses materials whose DATA, ATRB and textures match (names may differ) and remaps MATI
+	void DedupeMaterials();
+
+	// Removes materials no segment uses and compacts the MATI of the rest
+	void PruneMaterials();
+
+	// Joins the segments of each model that share a material into one, as far as 16 bit indices allow
+	void MergeSegments();
+
+	// Bakes the transforms of visible static models into their vertices and joins them into one model per hierarchy
+	void BatchStatic();
+
+	// Reorders each segment's triangles for the vertex cache (and for overdraw if asked), then its vertices for fetch order
+	void OptimizeCache(bool Overdraw);
+
+	// Rebuilds every STRP from the segment's triangles as long strips, segments in parallel
+	void Stripify();
+
+	// Merges the near identical vertices of every segment (in parallel) and remaps their indices
+	void Weld(float PositionTolerance, float NormalTolerance, float UVTolerance, float ColorTolerance);
+
+	// Adds a hidden _lowrez copy of every visible static model, simplified to Ratio of its triangles
+	void GenerateLOD(float Ratio);
+
+	// Cuts collision meshes down to Budget triangles per model, using the convex hull where it fits the mesh
+	void SimplifyCollision(size_t Budget);
+
+	// Replaces collision meshes with a p_ sphere, cylinder or box where one holds the mesh with at most
+	// Tolerance (a fraction of the mesh volume) to spare
+	void FitPrimitives(float Tolerance);
+
+	// Welds, closes and flattens every shadow volume model (sv_, shadowvolume or MTYP 6), segments in parallel
+	void OptimizeShadows();
+
+	// Adds a hidden sv_ shadow volume, simplified to Ratio of the triangles, for each visible static model without one
+	void GenerateShadows(float Ratio);
+
+	// Returns the render cost of each model
+	std::vector<RenderStats> GetRenderStats();
+
+	// Prints the render cost of each model and of the whole file
+	void PrintStats();
+
+	// Returns every byte of the file attributed to the chunk path holding it
+	SizeReport GetSizeReport();
+
+	// Prints where the bytes of the file go and writes them as folded stacks to FoldedFile (if given)
+	void PrintSizeReport(const std::string& FoldedFile);
+
+	// Removes a model and everything under it, renumbering MNDX (and ENVL) of the rest
+	void RemoveSubtree(size_t Root);
+
+	// Removes one model, moving its children up to its parent, renumbering MNDX (and ENVL) of the rest
+	void RemoveModel(size_t Selected);
+
+	// Moves a model and everything under it to a new parent (-1 for a root), keeping parents before children in the file
+	void ReparentSubtree(size_t Root, long long NewParent);
+
+	// Hides a model and everything under it
+	void HideSubtree(size_t Root);
+
+	// Folds null models nothing refers to (by ENVL, animation or special name) into their children and removes them
+	void Flatten();
+
+	// Cuts every skinned vertex down to MaxInfluences bones of at least Epsilon (renormalized), then drops the
+	// ENVL entries no vertex uses any more
+	void LimitWeights(size_t MaxInfluences, float Epsilon);
+
+	// Returns a standalone MSH file holding only the selected models and the materials they use
+	// The bones of selected skins are pulled in along with their parents, so the skin still deforms
+	// Only reads this MSH, so several can be built at once
+	std::vector<unsigned char> ExtractModels(const std::vector<size_t>& Selected);
+
 	// Imports MODL chunk
 	bool ImportMODL();
 
@@ -137,12 +273,23 @@ private:
 	// Vector of model objects
 	std::vector<Model> Models;
 
+	// Parent and child links of Models, rebuilt on every parse and kept up by the edits
+	Hierarchy Graph;
+
+	// World transform of each model, and whether it's still good (cleared for a model and everything under it)
+	std::vector<Matrix> WorldTransforms;
+	std::vector<char> WorldValid;
+	bool WorldDirty = true;
+
 	// Vector that holds all MATD chunks
 	std::vector<unsigned char> MATD_Chunks;
 
 	// Vector that holds all MODL chunks
 	std::vector<unsigned char> MODL_Chunks;
 
+	// Top level chunks of the file (normally just HEDR) with their children
+	std::vector<Chunk> Chunks;
+
 	// File positions for easy seeking
 	size_t HEDR_Size = 0;
 	size_t MATL_Count_Position = 0;
@@ -205,6 +352,121 @@ private:
 	// Read CLRB of each segment if present
 	void ReadCLRB();
 
+	// Builds the chunk tree of the whole file
+	void ReadChunks();
+
+	// Reads a chunk and its children, returns the position after it
+	size_t ReadChunk(Chunk& C, size_t position, size_t end);
+
+	// Reads the TRAN of each MODL from the chunk tree
+	void ReadTRAN();
+
+	// Returns the filename of the parse cache sidecar
+	std::string GetCacheFilename();
+
+	// Restores the parsed state from the sidecar, false if missing or stale
+	bool ReadCache();
+
+	// Saves the parsed state to the sidecar
+	bool WriteCache();
+
+	// Saves a chunk and its children to the sidecar
+	void WriteCacheChunk(std::ostream& Out, const Chunk& C);
+
+	// Returns the file size, timestamp and hash that a sidecar must match
+	void GetCacheKey(uint64_t& FileSize, int64_t& FileTime, uint64_t& FileHash);
+
+	// Compares two lists of sibling chunks, matching them by header and occurrence
+	void DiffChunks(const std::vector<Chunk>& A, MSH& Other, const std::vector<Chunk>& B, const std::string& Path, std::vector<std::string>& Changes);
+
+	// Compares two chunks, only descending into them when their bytes differ
+	void DiffChunk(const Chunk& A, MSH& Other, const Chunk& B, const std::string& Path, std::vector<std::string>& Changes);
+
+	// Finds the chunk whose size is stored at Position
+	const Chunk* FindChunk(size_t Position);
+
+	// Returns whether two chunks (header, size and payload) hold the same bytes
+	bool SameChunk(const Chunk& A, MSH& Other, const Chunk& B);
+
+	// Returns a short readable form of a leaf chunk's payload
+	std::string DescribeChunk(const Chunk& C);
+
+	// Returns whether a chunk starts at position (Known: only trust headers from the grammar)
+	bool LooksLikeChunk(size_t position, bool Known);
+
+	// Returns the next position after position where a known chunk starts, or Size
+	size_t FindNextChunk(size_t position);
+
+	// Scans the children of container C ignoring its recorded size, returns where C ends
+	size_t ScanChunk(Chunk& C, size_t position, const std::string& Path, std::vector<std::string>& Fixes);
+
+	// Appends C to Out, working out container sizes from their children
+	void WriteChunk(const Chunk& C, std::vector<unsigned char>& Out, const std::string& Path, std::vector<std::string>* Fixes = nullptr);
+
+	// Returns a copy of C whose leaves hold their own payload, so it can outlive or leave this MSH
+	Chunk DetachChunk(const Chunk& C);
+
+	// Replaces Data with the written Tree and parses it again
+	void RebuildMSH(const std::vector<Chunk>& Tree);
+
+	// Returns whether there are material or model edits that PrepMSHForWrite still has to bake in
+	bool PendingEdits();
+
+	// Bakes pending edits into Data and re-parses, so structural operations see them
+	void CommitEdits();
+
+	// Rebuilds MATL so old material M becomes Map[M] (the first material mapped to an index is kept),
+	// rewriting every MATI on the way
+	void RemapMaterials(const std::vector<uint32_t>& Map);
+
+	// Returns the first child of Parent with this header, or nullptr
+	static Chunk* FindChild(Chunk& Parent, const std::string& Header);
+
+	// Returns the payload of a leaf, wherever it's held
+	std::string_view GetPayload(const Chunk& C);
+
+	// Reads the string in a leaf, writes it into a detached leaf (NULL terminated and padded to 4 bytes)
+	std::string GetChunkString(const Chunk& C);
+	static void SetChunkString(Chunk& C, const std::string& Str);
+
+	// Reads the uint32 at Offset in a leaf, writes it into a detached leaf
+	uint32_t GetChunkValue(const Chunk& C, size_t Offset = 0);
+	static void SetChunkValue(Chunk& C, uint32_t Value, size_t Offset = 0);
+
+	// Decodes the geometry of a SEGM chunk, false if its lists are malformed
+	bool DecodeSegment(const Chunk& SEGM, Geometry& Geo);
+
+	// Builds a detached SEGM chunk from decoded geometry into SEGM, false (leaving SEGM alone) if its indices don't fit in 16 bits
+	static bool EncodeSegment(const Geometry& Geo, Chunk& SEGM);
+
+	// Joins the segments of GEOM that share a material and lists, adding up how many there were and are
+	void MergeGEOM(Chunk& GEOM, size_t& Before, size_t& After, size_t& Refused);
+
+	// Adds the bytes of C (under Parent) to Report, returns all the bytes it spans
+	uint64_t AttributeBytes(const Chunk& C, const std::string& Parent, SizeReport& Report);
+
+	// Links up Graph from the names and parents of Models
+	void BuildHierarchy();
+
+	// Drops the cached world transform of a model and everything under it
+	void InvalidateWorld(size_t ModelIndex);
+
+	// Numbers the MODLs of MSH2 from 1 in file order and points ENVL at the new numbers
+	void RenumberModels(Chunk& MSH2);
+
+	// Returns the first model kept in MSH2 that is skinned to a Removed one, -1 if there's none
+	long long FindSkinnedToRemoved(Chunk& MSH2, const std::vector<char>& Removed);
+
+	// CRC of a name the way skeleton and animation chunks refer to models (lower case, polynomial 0x04C11DB7)
+	static uint32_t NameCRC(const std::string& Name);
+
+	// Flags the models the skeleton, blend and animation chunks under HEDR refer to,
+	// false if there are such chunks but they match no model (so it can't be told)
+	bool GetAnimatedModels(const Chunk& HEDR, std::vector<char>& Animated);
+
+	// Flags the models an ENVL refers to (the bones of the skins)
+	std::vector<char> GetEnvelopedModels(const std::vector<Chunk*>& MODLs);
+
 	// Creates a new MATL chunk 
 	std::vector<unsigned char> Create_MATL_Chunk();
 
@@ -2782,6 +3044,30 @@ inline void MSH::ReadCLRB()
 
 // Reads MSH to vector of chars and performs all reading operations
 inline bool MSH::ReadMSH()
+{
+	// Read the file into memory
+	if (!LoadMSH())
+		return false;
+
+	// Restore everything from the sidecar if it's still valid for this file
+	if (CACHE && ReadCache())
+	{
+		BuildHierarchy();
+		return true;
+	}
+
+	// Otherwise do the full parse
+	ParseMSH();
+
+	// And save it for next time
+	if (CACHE)
+		WriteCache();
+
+	return true;
+}
+
+// Reads the MSH file into the Data array without parsing it
+inline bool MSH::LoadMSH()
 {
 	// Open File
 	std::ifstream InFile(FileName.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
@@ -2791,6 +3077,10 @@ inline bool MSH::ReadMSH()
 	// Get the size of the MSH file by recording stream position (at end by ios::ate)
 	Size = static_cast<size_t>(InFile.tellg());
 
+	// Free anything from a previous read
+	if (Data != nullptr)
+		delete[] Data;
+
 	// Allocate a new unsigned char array of msh filesize and point MSHFile->Data to it
 	Data = new unsigned char[Size];
 
@@ -2813,6 +3103,18 @@ inline bool MSH::ReadMSH()
 	// This is how we will read data
 	sv = std::string_view((char*)Data, Size);
 
+	return true;
+}
+
+// Populates materials, models and the chunk tree from Data
+inline void MSH::ParseMSH()
+{
+	// Start from a clean slate in case this MSH was parsed before
+	Materials.clear();
+	Models.clear();
+	MaterialCount = 0;
+	ModelCount = 0;
+
 	// Read Material Info ---------------------------------------
 	// Read and save data concerning the material list
 	ReadMATL();
@@ -2866,9 +3168,440 @@ inline bool MSH::ReadMSH()
 	// Checks to see if a model is a cloth and records it
 	ReadCLTH();
 
+	// Read Chunk Layout ---------------------------------------
+	ReadChunks();
+
+	// Reads in the transform of each MODL chunk
+	ReadTRAN();
+
+	// Links the models up by their PRNT
+	BuildHierarchy();
+}
+
+// Builds the chunk tree for the whole file
+inline void MSH::ReadChunks()
+{
+	Chunks.clear();
+
+	// Normally there's only HEDR, but keep anything trailing it too
+	size_t pos = 0;
+	while (pos + 8 <= Size)
+	{
+		Chunk Top;
+		pos = ReadChunk(Top, pos, Size);
+		Chunks.push_back(Top);
+	}
+
+	if (DEBUG)
+		std::cout << "\n ReadChunks: " << Chunks.size() << " top level chunk(s) found";
+}
+
+// Reads the chunk at position (and its children) without going past end
+inline size_t MSH::ReadChunk(Chunk& C, size_t position, size_t end)
+{
+	C.Header = std::string(sv.substr(position, 4));
+	C.Position = position + 4;
+	std::memcpy(&C.Size, Data + C.Position, 4);
+
+	// Never walk past the parent, even if the recorded size says otherwise
+	size_t start = C.Position + 4;
+	size_t stop = start + C.Size;
+	if (C.Size > end - start)
+		stop = end;
+
+	// Walk the children of containers
+	if (Chunk::IsContainer(C.Header))
+	{
+		size_t pos = start + Chunk::PrefixSize(C.Header);
+		while (pos + 8 <= stop)
+		{
+			Chunk Child;
+			pos = ReadChunk(Child, pos, stop);
+			C.Children.push_back(Child);
+		}
+	}
+
+	return stop;
+}
+
+// Reads the TRAN of each MODL from the chunk tree
+inline void MSH::ReadTRAN()
+{
+	Chunk* MSH2 = Chunks.empty() ? nullptr : FindChild(Chunks.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	size_t M = 0;
+	for (auto& MODL : MSH2->Children)
+	{
+		if (MODL.Header != "MODL")
+			continue;
+		if (M >= Models.size())
+			break;
+
+		// Short or missing TRAN chunks leave the identity
+		Chunk* TRAN = FindChild(MODL, "TRAN");
+		if (TRAN != nullptr && GetPayload(*TRAN).size() >= sizeof(Models.at(M).TRAN))
+		{
+			std::memcpy(Models.at(M).TRAN, GetPayload(*TRAN).data(), sizeof(Models.at(M).TRAN));
+			Models.at(M).TRAN_Position = TRAN->Position;
+		}
+		M++;
+	}
+
+	if (DEBUG)
+		std::cout << "\n ReadTRAN: " << M << " transform(s) read";
+}
+
+// Returns the name of the parse cache sidecar for this MSH
+inline std::string MSH::GetCacheFilename()
+{
+	return FileName + 'c';
+}
+
+// Gets the values a sidecar has to match to be used for this file
+inline void MSH::GetCacheKey(uint64_t& FileSize, int64_t& FileTime, uint64_t& FileHash)
+{
+	FileSize = Size;
+
+	std::error_code Error;
+	auto Time = std::filesystem::last_write_time(FileName, Error);
+	FileTime = Error ? 0 : static_cast<int64_t>(Time.time_since_epoch().count());
+
+	FileHash = HashBytes(Data, Size);
+}
+
+// Sidecar layout version, bump whenever the saved fields change
+static const uint32_t CACHE_VERSION = 2;
+
+// Restores the parsed state of the MSH from its sidecar
+inline bool MSH::ReadCache()
+{
+	std::ifstream In(GetCacheFilename().c_str(), std::ios::in | std::ios::binary);
+	if (!In.is_open())
+		return false;
+
+	// Check the header and that the sidecar still belongs to this file
+	char Magic[4] = { '\x00', '\x00', '\x00', '\x00' };
+	In.read(Magic, 4);
+	uint32_t Version = 0;
+	ReadValue(In, Version);
+	if (!In || std::string(Magic, 4) != "MSHC" || Version != CACHE_VERSION)
+		return false;
+
+	uint64_t CachedSize = 0, FileSize = 0, CachedHash = 0, FileHash = 0;
+	int64_t CachedTime = 0, FileTime = 0;
+	ReadValue(In, CachedSize);
+	ReadValue(In, CachedTime);
+	ReadValue(In, CachedHash);
+
+	// Size and time are cheap so check them before hashing the file
+	if (!In || CachedSize != Size)
+		return false;
+
+	GetCacheKey(FileSize, FileTime, FileHash);
+	if (CachedTime != FileTime || CachedHash != FileHash)
+		return false;
+
+	// Start from a clean slate
+	Materials.clear();
+	Models.clear();
+	Chunks.clear();
+
+	// MSH info
+	ReadValue(In, MaterialCount);
+	ReadValue(In, ModelCount);
+	ReadValue(In, MATL_Count_Position);
+	ReadValue(In, MATL_Position);
+	ReadValue(In, MATL_Size);
+	if (!In || MaterialCount > Size || ModelCount > Size)
+		return false;
+
+	// Materials
+	Materials.reserve(MaterialCount);
+	for (uint32_t C = 0; C < MaterialCount && In; C++)
+	{
+		Material Mat;
+		ReadString(In, Mat.MatName);
+		ReadString(In, Mat.TX0D);
+		ReadString(In, Mat.TX1D);
+		ReadString(In, Mat.TX2D);
+		ReadString(In, Mat.TX3D);
+		ReadValue(In, Mat.RenderType);
+		ReadValue(In, Mat.Data0);
+		ReadValue(In, Mat.Data1);
+		for (short F = 0; F < 8; F++)
+			ReadValue(In, std::get<1>(Mat.MatFlags[F]));
+		ReadValue(In, Mat.S_Decay);
+		ReadValue(In, Mat.D_RGBA);
+		ReadValue(In, Mat.S_RGBA);
+		ReadValue(In, Mat.A_RGBA);
+		ReadValue(In, Mat.MATD_Position);
+		ReadValue(In, Mat.MATD_Size);
+		ReadValue(In, Mat.MatName_Position);
+		ReadValue(In, Mat.MatName_Size);
+		ReadValue(In, Mat.ATRB_Position);
+		ReadValue(In, Mat.TX0D_Position);
+		ReadValue(In, Mat.TX0D_Size);
+		ReadValue(In, Mat.TX1D_Position);
+		ReadValue(In, Mat.TX1D_Size);
+		ReadValue(In, Mat.TX2D_Position);
+		ReadValue(In, Mat.TX2D_Size);
+		ReadValue(In, Mat.TX3D_Position);
+		ReadValue(In, Mat.TX3D_Size);
+		ReadValue(In, Mat.MATI);
+		ReadValue(In, Mat.DATA_Position);
+		Materials.push_back(Mat);
+	}
+
+	// Models and their segments
+	Models.reserve(ModelCount);
+	for (uint32_t C = 0; C < ModelCount && In; C++)
+	{
+		Model MODL;
+		ReadValue(In, MODL.MNDX);
+		ReadString(In, MODL.Name);
+		ReadValue(In, MODL.MODL_Size);
+		ReadValue(In, MODL.MODL_Position);
+		ReadValue(In, MODL.GEOM_Size);
+		ReadValue(In, MODL.GEOM_Position);
+		ReadValue(In, MODL.MTYP);
+		ReadString(In, MODL.PRNT);
+		ReadValue(In, MODL.FLGS);
+		ReadValue(In, MODL.CLTH);
+		ReadValue(In, MODL.CLTH_Position);
+		ReadValue(In, MODL.CLTH_Size);
+		ReadString(In, MODL.CTEX);
+		ReadValue(In, MODL.Name_Position);
+		ReadValue(In, MODL.Name_Size);
+		ReadValue(In, MODL.MNDX_Position);
+		ReadValue(In, MODL.MTYP_Position);
+		ReadValue(In, MODL.PRNT_Size);
+		ReadValue(In, MODL.PRNT_Index);
+		ReadValue(In, MODL.PRNT_Position);
+		ReadValue(In, MODL.FLGS_Position);
+		ReadValue(In, MODL.TRAN);
+		ReadValue(In, MODL.TRAN_Position);
+		ReadValue(In, MODL.CTEX_Size);
+		ReadValue(In, MODL.CTEX_Position);
+
+		uint32_t SegmentCount = 0;
+		ReadValue(In, SegmentCount);
+		if (!In || SegmentCount > Size)
+			return false;
+
+		for (uint32_t D = 0; D < SegmentCount && In; D++)
+		{
+			Segment SEGM;
+			ReadValue(In, SEGM.MATI);
+			ReadValue(In, SEGM.MATI_Position);
+			ReadValue(In, SEGM.SEGM_Position);
+			ReadValue(In, SEGM.SEGM_Size);
+			ReadValue(In, SEGM.CLRB_Position);
+			ReadValue(In, SEGM.CLRB);
+			ReadValue(In, SEGM.CLRL_Position);
+			ReadValue(In, SEGM.CLRL_Size);
+			ReadValue(In, SEGM.CLRL_Present);
+			ReadValue(In, SEGM.CLRB_Present);
+			ReadValue(In, SEGM.CLRL_OG);
+			ReadValue(In, SEGM.CLRB_OG);
+			ReadValue(In, SEGM.CLRL_Count);
+
+			uint32_t ColorCount = 0;
+			ReadValue(In, ColorCount);
+			if (!In || ColorCount > Size)
+				return false;
+
+			SEGM.CLRL.reserve(ColorCount);
+			for (uint32_t E = 0; E < ColorCount && In; E++)
+			{
+				std::vector<unsigned char> V(4);
+				In.read(reinterpret_cast<char*>(V.data()), 4);
+				SEGM.CLRL.push_back(V);
+			}
+
+			MODL.Segments.push_back(SEGM);
+		}
+
+		Models.push_back(MODL);
+	}
+
+	// Chunk tree, saved in pre-order with child counts
+	uint32_t TopCount = 0;
+	ReadValue(In, TopCount);
+	if (!In || TopCount > Size)
+		return false;
+
+	// Stack of chunks still waiting to be read
+	std::vector<Chunk*> Pending;
+	Chunks.resize(TopCount);
+	for (uint32_t C = TopCount; C > 0; C--)
+		Pending.push_back(&Chunks.at(C - 1));
+
+	while (!Pending.empty() && In)
+	{
+		Chunk* Current = Pending.back();
+		Pending.pop_back();
+
+		uint32_t ChildCount = 0;
+		ReadString(In, Current->Header, 4);
+		ReadValue(In, Current->Position);
+		ReadValue(In, Current->Size);
+		ReadValue(In, ChildCount);
+		if (!In || ChildCount > Size)
+			return false;
+
+		// Children are stored right after their parent, so read them next in order
+		Current->Children.resize(ChildCount);
+		for (uint32_t D = ChildCount; D > 0; D--)
+			Pending.push_back(&Current->Children.at(D - 1));
+	}
+
+	if (!In)
+		return false;
+
+	if (DEBUG)
+		std::cout << " ReadCache: Restored " << FileName << " from " << GetCacheFilename() << "\n";
+
 	return true;
 }
 
+// Saves a chunk and its children in pre-order
+inline void MSH::WriteCacheChunk(std::ostream& Out, const Chunk& C)
+{
+	WriteString(Out, C.Header);
+	WriteValue(Out, C.Position);
+	WriteValue(Out, C.Size);
+	WriteValue(Out, static_cast<uint32_t>(C.Children.size()));
+
+	for (const Chunk& Child : C.Children)
+		WriteCacheChunk(Out, Child);
+}
+
+// Saves the parsed state of the MSH next to it so the next read can skip parsing
+inline bool MSH::WriteCache()
+{
+	std::ofstream Out(GetCacheFilename().c_str(), std::ios::out | std::ios::binary);
+	if (!Out.is_open())
+		return false;
+
+	uint64_t FileSize = 0, FileHash = 0;
+	int64_t FileTime = 0;
+	GetCacheKey(FileSize, FileTime, FileHash);
+
+	// Header and the values that tie the sidecar to this exact file
+	Out.write("MSHC", 4);
+	WriteValue(Out, CACHE_VERSION);
+	WriteValue(Out, FileSize);
+	WriteValue(Out, FileTime);
+	WriteValue(Out, FileHash);
+
+	// MSH info
+	WriteValue(Out, MaterialCount);
+	WriteValue(Out, ModelCount);
+	WriteValue(Out, MATL_Count_Position);
+	WriteValue(Out, MATL_Position);
+	WriteValue(Out, MATL_Size);
+
+	// Materials
+	for (const Material& Mat : Materials)
+	{
+		WriteString(Out, Mat.MatName);
+		WriteString(Out, Mat.TX0D);
+		WriteString(Out, Mat.TX1D);
+		WriteString(Out, Mat.TX2D);
+		WriteString(Out, Mat.TX3D);
+		WriteValue(Out, Mat.RenderType);
+		WriteValue(Out, Mat.Data0);
+		WriteValue(Out, Mat.Data1);
+		for (short F = 0; F < 8; F++)
+			WriteValue(Out, std::get<1>(Mat.MatFlags[F]));
+		WriteValue(Out, Mat.S_Decay);
+		WriteValue(Out, Mat.D_RGBA);
+		WriteValue(Out, Mat.S_RGBA);
+		WriteValue(Out, Mat.A_RGBA);
+		WriteValue(Out, Mat.MATD_Position);
+		WriteValue(Out, Mat.MATD_Size);
+		WriteValue(Out, Mat.MatName_Position);
+		WriteValue(Out, Mat.MatName_Size);
+		WriteValue(Out, Mat.ATRB_Position);
+		WriteValue(Out, Mat.TX0D_Position);
+		WriteValue(Out, Mat.TX0D_Size);
+		WriteValue(Out, Mat.TX1D_Position);
+		WriteValue(Out, Mat.TX1D_Size);
+		WriteValue(Out, Mat.TX2D_Position);
+		WriteValue(Out, Mat.TX2D_Size);
+		WriteValue(Out, Mat.TX3D_Position);
+		WriteValue(Out, Mat.TX3D_Size);
+		WriteValue(Out, Mat.MATI);
+		WriteValue(Out, Mat.DATA_Position);
+	}
+
+	// Models and their segments
+	for (const Model& MODL : Models)
+	{
+		WriteValue(Out, MODL.MNDX);
+		WriteString(Out, MODL.Name);
+		WriteValue(Out, MODL.MODL_Size);
+		WriteValue(Out, MODL.MODL_Position);
+		WriteValue(Out, MODL.GEOM_Size);
+		WriteValue(Out, MODL.GEOM_Position);
+		WriteValue(Out, MODL.MTYP);
+		WriteString(Out, MODL.PRNT);
+		WriteValue(Out, MODL.FLGS);
+		WriteValue(Out, MODL.CLTH);
+		WriteValue(Out, MODL.CLTH_Position);
+		WriteValue(Out, MODL.CLTH_Size);
+		WriteString(Out, MODL.CTEX);
+		WriteValue(Out, MODL.Name_Position);
+		WriteValue(Out, MODL.Name_Size);
+		WriteValue(Out, MODL.MNDX_Position);
+		WriteValue(Out, MODL.MTYP_Position);
+		WriteValue(Out, MODL.PRNT_Size);
+		WriteValue(Out, MODL.PRNT_Index);
+		WriteValue(Out, MODL.PRNT_Position);
+		WriteValue(Out, MODL.FLGS_Position);
+		WriteValue(Out, MODL.TRAN);
+		WriteValue(Out, MODL.TRAN_Position);
+		WriteValue(Out, MODL.CTEX_Size);
+		WriteValue(Out, MODL.CTEX_Position);
+
+		WriteValue(Out, static_cast<uint32_t>(MODL.Segments.size()));
+		for (const Segment& SEGM : MODL.Segments)
+		{
+			WriteValue(Out, SEGM.MATI);
+			WriteValue(Out, SEGM.MATI_Position);
+			WriteValue(Out, SEGM.SEGM_Position);
+			WriteValue(Out, SEGM.SEGM_Size);
+			WriteValue(Out, SEGM.CLRB_Position);
+			WriteValue(Out, SEGM.CLRB);
+			WriteValue(Out, SEGM.CLRL_Position);
+			WriteValue(Out, SEGM.CLRL_Size);
+			WriteValue(Out, SEGM.CLRL_Present);
+			WriteValue(Out, SEGM.CLRB_Present);
+			WriteValue(Out, SEGM.CLRL_OG);
+			WriteValue(Out, SEGM.CLRB_OG);
+			WriteValue(Out, SEGM.CLRL_Count);
+
+			WriteValue(Out, static_cast<uint32_t>(SEGM.CLRL.size()));
+			for (const std::vector<unsigned char>& V : SEGM.CLRL)
+				Out.write(reinterpret_cast<const char*>(V.data()), 4);
+		}
+	}
+
+	// Chunk tree
+	WriteValue(Out, static_cast<uint32_t>(Chunks.size()));
+	for (const Chunk& C : Chunks)
+		WriteCacheChunk(Out, C);
+
+	Out.close();
+
+	if (DEBUG)
+		std::cout << "\n WriteCache: Saved " << GetCacheFilename() << "\n";
+
+	return bool(Out);
+}
+
 // Sets the msh filename property and checks that it exists
 inline void MSH::SetMSHFilename(std::string Fname = "")
 {
@@ -2939,6 +3672,33 @@ inline std::string MSH::GetMSHFilename()
 	return FileName;
 }
 
+// Returns a deep copy of the MSH, so edits to it leave this one untouched
+inline MSH MSH::Clone()
+{
+	// Copy everything, then give the copy its own Data array
+	MSH Copy = *this;
+
+	if (Data != nullptr)
+	{
+		Copy.Data = new unsigned char[Size];
+		std::memcpy(Copy.Data, Data, Size);
+		Copy.sv = std::string_view((char*)Copy.Data, Size);
+	}
+
+	return Copy;
+}
+
+// Frees the Data array (copies made without Clone share it!)
+inline void MSH::CloseMSH()
+{
+	if (Data != nullptr)
+		delete[] Data;
+
+	Data = nullptr;
+	sv = std::string_view();
+	Size = 0;
+}
+
 // Pads a vector of chars by multiple of four with nulls
 inline void MSH::PadString(std::vector<unsigned char>& str)
 {
@@ -3163,7 +3923,8 @@ inline void MSH::PrepModelForWrite()
 // Make any needed adjustments/edits to vector before writing back to file
 inline void MSH::PrepMSHForWrite()
 {
-	if (MSHChanged())
+	// Structural operations (merge...) leave Data consistent already, only edits need baking in
+	if (MSHChanged() && PendingEdits())
 	{
 		// Creates new MATL and MATD chunks for our material edits
 		PrepMatForWrite();
@@ -3219,7 +3980,7 @@ inline void MSH::PrepMSHForWrite()
 }
 
 // Write the new MSH to file
-inline bool MSH::WriteMSH()
+inline bool MSH::WriteMSH(bool Quiet)
 {
 	if (MSHChanged())
 	{
@@ -3233,7 +3994,8 @@ inline bool MSH::WriteMSH()
 			// Close file and flush buffers
 			OutFile.close();
 
-			std::cout << "\n WriteMSH: MSH " << FileName << " Written!";
+			if (!Quiet)
+				std::cout << "\n WriteMSH: MSH " << FileName << " Written!";
 
 			return true;
 		}
@@ -3622,6 +4384,7 @@ inline bool MSH::ImportMODL()
 	CHANGED = true;
 	Models.push_back(NewMODL);
 	ModelCount++;
+	BuildHierarchy();
 
 	return true;
 }
@@ -3955,12 +4718,18 @@ inline void MSH::RenameModel(unsigned short Selected, std::string name)
 			NewName.push_back(mc);
 
 		// Change PRNT name of all children to new name
-		for (unsigned short D = 0; D < ModelCount; D++)
-			if (Models.at(D).PRNT_Index == Models.at(Selected).MNDX)
-			{
-				Models.at(D).PRNT = NewName;
-				Models.at(D).PRNT_Size = static_cast<uint32_t>(NewNameV.size());
-			}
+		for (size_t D : Graph.Children.at(Selected))
+		{
+			if (!Models.at(D).CHANGED[0])
+				Models.at(D).OG_Value[0] = Models.at(D).PRNT_Size;
+
+			Models.at(D).PRNT = NewName;
+			Models.at(D).PRNT_Size = static_cast<uint32_t>(NewNameV.size());
+			Models.at(D).MODLChanged = true;
+			Models.at(D).CHANGED[0] = true;
+		}
+
+		Graph.Rename(Selected, GetModelName(Selected), std::string(NewName.c_str()));
 
 		// Now actually do it
 		if (!Models.at(Selected).CHANGED[1])
@@ -4020,7 +4789,7 @@ inline void MSH::SetModelParent(unsigned short Selected, unsigned short ModelInd
 	unsigned short NewPRNT = ModelIndex;
 
 	if (NewPRNT > 0 && NewPRNT <= ModelCount)
-		if (NewPRNT != Selected && NewPRNT != Models.at(NewPRNT).PRNT_Index - 1)
+		if (NewPRNT != Selected && NewPRNT != Models.at(NewPRNT).PRNT_Index - 1 && Graph.SetParent(Selected, NewPRNT))
 		{
 			if (!Models.at(Selected).CHANGED[0])
 				Models.at(Selected).OG_Value[0] = Models.at(Selected).PRNT_Size;
@@ -4030,6 +4799,7 @@ inline void MSH::SetModelParent(unsigned short Selected, unsigned short ModelInd
 			Models.at(Selected).PRNT_Index = NewPRNT + 1;
 			Models.at(Selected).MODLChanged = true;
 			Models.at(Selected).CHANGED[0] = true;
+			InvalidateWorld(Selected);
 		}
 }
 
@@ -4115,7 +4885,6 @@ inline void MSH::SetClothTex(unsigned short modl, std::string TexName)
 inline void MSH::ListModels()
 {
 	std::cout << " Model Info displayed as follows: \n MODEL INDEX, NAME, ASSIGNED MATERIAL, VISIBILITY, PARENT \n\n";
-	std::regex norm("(p_)(.*)|(collision)(.*)|(sv_)(.*)|(shadowvolume)(.*)|(c_)(.*)|(eff_)(.*)|(root_)(.*)|(bone_)(.*)|(hp_)(.*)");
 	for (auto m : Models)
 	{
 		if (ADVANCEDMODELS)
@@ -4143,7 +4912,7 @@ inline void MSH::ListModels()
 
 			std::cout << "\n\n";
 		}
-		else if (!std::regex_match(m.Name, norm) && m.MTYP != 0 && m.MTYP != 3)
+		else if (!IsSpecialModel(m.Name) && m.MTYP != 0 && m.MTYP != 3)
 
 		{
 			std::cout << ' ' << m.MNDX << " | " << ' ' << m.Name << "  |  ";
@@ -4206,4 +4975,3391 @@ inline void MSH::ListMaterials()
 
 		std::cout << "\n\n";
 	}
-}
\ No newline at end of file
+}
+
+// Prints what changed from this MSH to Other, returns the number of differences
+inline std::vector<std::string> MSH::GetChanges(MSH& Other)
+{
+	CommitEdits();
+	Other.CommitEdits();
+
+	std::vector<std::string> Changes;
+
+	// Drops the NULL padding from names
+	auto Trim = [](std::string Str)
+	{
+		while (!Str.empty() && Str.back() == '\0')
+			Str.pop_back();
+		return Str;
+	};
+
+	// Whole file identical, nothing else to do
+	if (Size == Other.Size && (Size == 0 || std::memcmp(Data, Other.Data, Size) == 0))
+		return Changes;
+
+	// Materials, matched by name
+	for (auto& A : Materials)
+	{
+		const Material* B = nullptr;
+		for (auto& M : Other.Materials)
+			if (Trim(M.MatName) == Trim(A.MatName))
+				B = &M;
+
+		std::string Name = Trim(A.MatName);
+		if (B == nullptr)
+		{
+			Changes.push_back("- material " + Name);
+			continue;
+		}
+
+		const Chunk* ChunkA = FindChunk(A.MATD_Position);
+		const Chunk* ChunkB = Other.FindChunk(B->MATD_Position);
+		if (ChunkA != nullptr && ChunkB != nullptr && SameChunk(*ChunkA, Other, *ChunkB))
+			continue;
+
+		size_t Before = Changes.size();
+		auto Field = [&](const std::string& Label, const std::string& From, const std::string& To)
+		{
+			if (From != To)
+				Changes.push_back("~ material " + Name + ": " + Label + " " + From + " -> " + To);
+		};
+		auto Color = [](const float RGBA[4])
+		{
+			std::ostringstream s;
+			s << RGBA[0] << ' ' << RGBA[1] << ' ' << RGBA[2] << ' ' << RGBA[3];
+			return s.str();
+		};
+
+		Field("RenderType", std::to_string(A.RenderType), std::to_string(B->RenderType));
+		Field("Data0", std::to_string(A.Data0), std::to_string(B->Data0));
+		Field("Data1", std::to_string(A.Data1), std::to_string(B->Data1));
+		Field("ATRB", std::to_string(Data[A.ATRB_Position]), std::to_string(Other.Data[B->ATRB_Position]));
+		Field("TX0D", Trim(A.TX0D), Trim(B->TX0D));
+		Field("TX1D", Trim(A.TX1D), Trim(B->TX1D));
+		Field("TX2D", Trim(A.TX2D), Trim(B->TX2D));
+		Field("TX3D", Trim(A.TX3D), Trim(B->TX3D));
+		Field("Diffuse", Color(A.D_RGBA), Color(B->D_RGBA));
+		Field("Specular", Color(A.S_RGBA), Color(B->S_RGBA));
+		Field("Ambient", Color(A.A_RGBA), Color(B->A_RGBA));
+		Field("SpecularDecay", std::to_string(A.S_Decay), std::to_string(B->S_Decay));
+
+		if (Changes.size() == Before)
+			Changes.push_back("~ material " + Name + ": MATD bytes changed");
+	}
+	for (auto& B : Other.Materials)
+	{
+		bool Found = false;
+		for (auto& A : Materials)
+			if (Trim(A.MatName) == Trim(B.MatName))
+				Found = true;
+
+		if (!Found)
+			Changes.push_back("+ material " + Trim(B.MatName));
+	}
+
+	// Models, matched by name, then compared chunk by chunk
+	for (auto& A : Models)
+	{
+		const Model* B = nullptr;
+		for (auto& M : Other.Models)
+			if (Trim(M.Name) == Trim(A.Name))
+				B = &M;
+
+		std::string Name = Trim(A.Name);
+		if (B == nullptr)
+		{
+			Changes.push_back("- model " + Name);
+			continue;
+		}
+
+		const Chunk* ChunkA = FindChunk(A.MODL_Position);
+		const Chunk* ChunkB = Other.FindChunk(B->MODL_Position);
+		if (ChunkA == nullptr || ChunkB == nullptr)
+			continue;
+
+		std::vector<std::string> ModelChanges;
+		DiffChunks(ChunkA->Children, Other, ChunkB->Children, "", ModelChanges);
+		for (auto& Change : ModelChanges)
+			Changes.push_back(Change.substr(0, 2) + "model " + Name + ": " + Change.substr(2));
+	}
+	for (auto& B : Other.Models)
+	{
+		bool Found = false;
+		for (auto& A : Models)
+			if (Trim(A.Name) == Trim(B.Name))
+				Found = true;
+
+		if (!Found)
+			Changes.push_back("+ model " + Trim(B.Name));
+	}
+
+	// Everything else (SINF, skeleton, animation...) as plain chunks
+	DiffChunks(Chunks, Other, Other.Chunks, "", Changes);
+
+	return Changes;
+}
+
+// Prints what changed from this MSH to Other, returns the number of differences
+inline size_t MSH::DiffMSH(MSH& Other)
+{
+	CommitEdits();
+	Other.CommitEdits();
+
+	// Whole file identical, nothing else to do
+	if (Size == Other.Size && (Size == 0 || std::memcmp(Data, Other.Data, Size) == 0))
+	{
+		std::cout << " DiffMSH: " << FileName << " and " << Other.FileName << " are identical\n";
+		return 0;
+	}
+
+	std::vector<std::string> Changes = GetChanges(Other);
+	std::cout << " DiffMSH: " << FileName << " -> " << Other.FileName << "\n";
+	for (auto& Change : Changes)
+		std::cout << ' ' << Change << "\n";
+	if (Changes.empty())
+		std::cout << " No structural differences (padding or ordering only)\n";
+
+	return Changes.size();
+}
+
+// Compares two lists of sibling chunks, matching them by header and occurrence
+inline void MSH::DiffChunks(const std::vector<Chunk>& A, MSH& Other, const std::vector<Chunk>& B, const std::string& Path, std::vector<std::string>& Changes)
+{
+	// Label of each chunk, e.g. SEGM[1] for the second SEGM
+	auto Label = [](const std::vector<Chunk>& List, size_t Index)
+	{
+		size_t Occurrence = 0;
+		for (size_t C = 0; C < Index; C++)
+			if (List.at(C).Header == List.at(Index).Header)
+				Occurrence++;
+
+		std::string Name = List.at(Index).Header;
+		if (Occurrence > 0)
+			Name += "[" + std::to_string(Occurrence) + "]";
+		return Name;
+	};
+
+	std::vector<std::string> LabelsB;
+	for (size_t C = 0; C < B.size(); C++)
+		LabelsB.push_back(Label(B, C));
+
+	std::vector<bool> Matched(B.size(), false);
+	for (size_t C = 0; C < A.size(); C++)
+	{
+		// Materials and models are compared by name in DiffMSH
+		if (Path == "HEDR/MSH2/" && (A.at(C).Header == "MATL" || A.at(C).Header == "MODL"))
+			continue;
+
+		std::string Name = Label(A, C);
+		size_t Match = 0;
+		while (Match < B.size() && LabelsB.at(Match) != Name)
+			Match++;
+
+		if (Match == B.size())
+		{
+			Changes.push_back("- " + Path + Name);
+			continue;
+		}
+
+		Matched.at(Match) = true;
+		DiffChunk(A.at(C), Other, B.at(Match), Path + Name, Changes);
+	}
+
+	for (size_t C = 0; C < B.size(); C++)
+	{
+		if (Path == "HEDR/MSH2/" && (B.at(C).Header == "MATL" || B.at(C).Header == "MODL"))
+			continue;
+
+		if (!Matched.at(C))
+			Changes.push_back("+ " + Path + LabelsB.at(C));
+	}
+}
+
+// Compares two chunks, only descending into them when their bytes differ
+inline void MSH::DiffChunk(const Chunk& A, MSH& Other, const Chunk& B, const std::string& Path, std::vector<std::string>& Changes)
+{
+	if (SameChunk(A, Other, B))
+		return;
+
+	if (Chunk::IsContainer(A.Header))
+	{
+		size_t Before = Changes.size();
+		DiffChunks(A.Children, Other, B.Children, Path + "/", Changes);
+
+		// Same children, so the difference is in the prefix (MATL count) or padding
+		if (Changes.size() == Before && Path != "HEDR" && Path != "HEDR/MSH2")
+			Changes.push_back("~ " + Path);
+		return;
+	}
+
+	// MATI only matters if it points at a differently named material
+	if (A.Header == "MATI" && A.Size >= 4 && B.Size >= 4)
+	{
+		uint32_t IndexA = 0;
+		uint32_t IndexB = 0;
+		std::memcpy(&IndexA, Data + A.Position + 4, 4);
+		std::memcpy(&IndexB, Other.Data + B.Position + 4, 4);
+
+		std::string NameA = IndexA < Materials.size() ? Materials.at(IndexA).MatName : std::to_string(IndexA);
+		std::string NameB = IndexB < Other.Materials.size() ? Other.Materials.at(IndexB).MatName : std::to_string(IndexB);
+		if (NameA == NameB)
+			return;
+	}
+
+	std::string From = DescribeChunk(A);
+	std::string To = Other.DescribeChunk(B);
+	if (From == To)
+		Changes.push_back("~ " + Path + ": changed, " + From);
+	else
+		Changes.push_back("~ " + Path + ": " + From + " -> " + To);
+}
+
+// Finds the chunk whose size is stored at Position
+inline const Chunk* MSH::FindChunk(size_t Position)
+{
+	std::vector<const std::vector<Chunk>*> Lists = { &Chunks };
+	while (!Lists.empty())
+	{
+		const std::vector<Chunk>* List = Lists.back();
+		Lists.pop_back();
+
+		for (auto& C : *List)
+		{
+			if (C.Position == Position)
+				return &C;
+
+			// Only descend into the chunk that contains Position
+			if (Position > C.Position && Position < C.Position + 4 + C.Size)
+				Lists.push_back(&C.Children);
+		}
+	}
+
+	return nullptr;
+}
+
+// Returns whether two chunks (header, size and payload) hold the same bytes
+inline bool MSH::SameChunk(const Chunk& A, MSH& Other, const Chunk& B)
+{
+	if (A.Header != B.Header || A.Size != B.Size)
+		return false;
+
+	// Truncated chunks only compare what's actually there
+	size_t CountA = std::min(static_cast<size_t>(A.Size), Size - (A.Position + 4));
+	size_t CountB = std::min(static_cast<size_t>(B.Size), Other.Size - (B.Position + 4));
+
+	return CountA == CountB && std::memcmp(Data + A.Position + 4, Other.Data + B.Position + 4, CountA) == 0;
+}
+
+// Returns a short readable form of a leaf chunk's payload
+inline std::string MSH::DescribeChunk(const Chunk& C)
+{
+	size_t Count = std::min(static_cast<size_t>(C.Size), Size - (C.Position + 4));
+	const unsigned char* Payload = Data + C.Position + 4;
+
+	// Strings
+	if (C.Header == "NAME" || C.Header == "PRNT" || C.Header == "CTEX" || C.Header == "TX0D"
+		|| C.Header == "TX1D" || C.Header == "TX2D" || C.Header == "TX3D")
+	{
+		std::string Str(reinterpret_cast<const char*>(Payload), Count);
+		Str = Str.substr(0, Str.find('\0'));
+		return "\"" + Str + "\"";
+	}
+
+	// Single numbers
+	if ((C.Header == "MTYP" || C.Header == "MNDX" || C.Header == "FLGS") && Count >= 4)
+	{
+		uint32_t Value = 0;
+		std::memcpy(&Value, Payload, 4);
+		return std::to_string(Value);
+	}
+
+	if (C.Header == "MATI" && Count >= 4)
+	{
+		uint32_t Value = 0;
+		std::memcpy(&Value, Payload, 4);
+		std::string Name = Value < Materials.size() ? Materials.at(Value).MatName : "?";
+		return std::to_string(Value) + " (" + Name.substr(0, Name.find('\0')) + ")";
+	}
+
+	// Geometry lists report their element count where it leads the payload
+	if ((C.Header == "POSL" || C.Header == "NRML" || C.Header == "UV0L" || C.Header == "CLRL"
+		|| C.Header == "WGHT" || C.Header == "NDXL" || C.Header == "NDXT" || C.Header == "STRP") && Count >= 4)
+	{
+		uint32_t Value = 0;
+		std::memcpy(&Value, Payload, 4);
+		return std::to_string(Value) + " entries (" + std::to_string(C.Size) + " bytes)";
+	}
+
+	return std::to_string(C.Size) + " bytes";
+}
+
+// Checks the structure of the loaded (not parsed) file without trusting any of it
+// Returns the problems found as (file offset, chunk path, message)
+inline std::vector<std::tuple<size_t, std::string, std::string>> MSH::ValidateMSH()
+{
+	CommitEdits();
+
+	std::vector<std::tuple<size_t, std::string, std::string>> Problems;
+	auto Report = [&](size_t Offset, const std::string& Path, const std::string& Message)
+	{
+		Problems.emplace_back(Offset, Path, Message);
+	};
+
+	if (Size < 8)
+	{
+		Report(0, "", "file is too small to hold a chunk");
+		return Problems;
+	}
+
+	if (sv.substr(0, 4) != "HEDR")
+		Report(0, "", "file doesn't start with HEDR");
+
+	// Collected on the way for the cross checks at the end
+	uint32_t MATL_Count = 0;
+	size_t MATL_Offset = 0;
+	bool HasMATL = false;
+	uint32_t MATD_Count = 0;
+	std::vector<std::pair<size_t, uint32_t>> MATIs;
+	std::vector<std::string> ModelNames;
+	std::vector<std::pair<size_t, std::string>> Parents;
+
+	// Bytes per entry of the counted lists in a SEGM
+	auto EntrySize = [](const std::string& Header) -> size_t
+	{
+		if (Header == "POSL" || Header == "NRML")
+			return 12;
+		if (Header == "UV0L")
+			return 8;
+		if (Header == "CLRL")
+			return 4;
+		if (Header == "WGHT")
+			return 32;
+		if (Header == "NDXT")
+			return 6;
+		if (Header == "STRP")
+			return 2;
+		return 0;
+	};
+
+	// Reads a padded string out of a leaf chunk
+	auto ReadName = [&](size_t Start, uint32_t Length)
+	{
+		std::string Name(sv.substr(Start, Length));
+		return Name.substr(0, Name.find('\0'));
+	};
+
+	// Walks the chunks between position and end, checking each against its parent
+	std::function<void(size_t, size_t, const std::string&)> Walk = [&](size_t position, size_t end, const std::string& Parent)
+	{
+		while (position < end)
+		{
+			if (end - position < 8)
+			{
+				Report(position, Parent, std::to_string(end - position) + " stray byte(s) after the last chunk");
+				return;
+			}
+
+			// Headers are 4 upper case letters or digits
+			std::string Header(sv.substr(position, 4));
+			bool ValidHeader = true;
+			for (char& ch : Header)
+			{
+				if (!((ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9')))
+				{
+					ch = '?';
+					ValidHeader = false;
+				}
+			}
+
+			std::string Path = Parent.empty() ? Header : Parent + "/" + Header;
+			if (!ValidHeader)
+			{
+				Report(position, Path, "invalid chunk header, can't continue in " + (Parent.empty() ? std::string("file") : Parent));
+				return;
+			}
+
+			uint32_t ChunkSize = 0;
+			std::memcpy(&ChunkSize, Data + position + 4, 4);
+
+			size_t start = position + 8;
+			if (ChunkSize > end - start)
+			{
+				Report(position, Path, "size " + std::to_string(ChunkSize) + " runs " + std::to_string(ChunkSize - (end - start))
+					+ " byte(s) past the end of " + (Parent.empty() ? std::string("the file") : Parent));
+				ChunkSize = static_cast<uint32_t>(end - start);
+			}
+			size_t stop = start + ChunkSize;
+
+			if (Chunk::IsContainer(Header))
+			{
+				if (Header == "MATL")
+				{
+					HasMATL = true;
+					MATL_Offset = position;
+					if (ChunkSize >= 4)
+						std::memcpy(&MATL_Count, Data + start, 4);
+				}
+				else if (Header == "MATD")
+					MATD_Count++;
+
+				if (Chunk::PrefixSize(Header) > ChunkSize)
+					Report(position, Path, "too small to hold its " + std::to_string(Chunk::PrefixSize(Header)) + " byte prefix");
+				else
+					Walk(start + Chunk::PrefixSize(Header), stop, Path);
+			}
+			else if (Header == "MATI")
+			{
+				if (ChunkSize < 4)
+					Report(position, Path, "too small to hold a material index");
+				else
+				{
+					uint32_t Index = 0;
+					std::memcpy(&Index, Data + start, 4);
+					MATIs.emplace_back(position, Index);
+				}
+			}
+			else if (Header == "NAME" && Parent.size() >= 4 && Parent.compare(Parent.size() - 4, 4, "MODL") == 0)
+				ModelNames.push_back(ReadName(start, ChunkSize));
+			else if (Header == "PRNT")
+				Parents.emplace_back(position, ReadName(start, ChunkSize));
+			else if (Parent.size() >= 4 && Parent.compare(Parent.size() - 4, 4, "SEGM") == 0)
+			{
+				// Lists that lead with a count must hold that many entries
+				if (Header == "NDXL" && ChunkSize >= 4)
+				{
+					uint32_t Polygons = 0;
+					std::memcpy(&Polygons, Data + start, 4);
+
+					size_t pos = start + 4;
+					for (uint32_t P = 0; P < Polygons && pos <= stop; P++)
+					{
+						uint16_t Count = 0;
+						if (pos + 2 <= stop)
+							std::memcpy(&Count, Data + pos, 2);
+						pos += 2 + 2 * size_t(Count);
+					}
+
+					if (pos > stop)
+						Report(position, Path, "polygon list of " + std::to_string(Polygons) + " runs past the end of the chunk");
+				}
+				else if (EntrySize(Header) > 0 && ChunkSize >= 4)
+				{
+					uint32_t Count = 0;
+					std::memcpy(&Count, Data + start, 4);
+
+					uint64_t Needed = 4 + uint64_t(Count) * EntrySize(Header);
+					if (Needed > ChunkSize)
+						Report(position, Path, "holds " + std::to_string(Count) + " entries needing " + std::to_string(Needed)
+							+ " bytes but is only " + std::to_string(ChunkSize));
+				}
+			}
+
+			position = stop;
+		}
+	};
+
+	Walk(0, Size, "");
+
+	// Cross checks
+	if (HasMATL && MATD_Count != MATL_Count)
+		Report(MATL_Offset, "HEDR/MSH2/MATL", "says " + std::to_string(MATL_Count) + " materials but holds " + std::to_string(MATD_Count) + " MATD chunks");
+
+	for (auto& MATI : MATIs)
+		if (MATI.second >= MATD_Count)
+			Report(MATI.first, "MATI", "material index " + std::to_string(MATI.second) + " is out of range (" + std::to_string(MATD_Count) + " materials)");
+
+	for (auto& Parent : Parents)
+		if (std::find(ModelNames.begin(), ModelNames.end(), Parent.second) == ModelNames.end())
+			Report(Parent.first, "PRNT", "parent model \"" + Parent.second + "\" doesn't exist");
+
+	return Problems;
+}
+
+// Rebuilds the chunk tree of the loaded (not parsed) file with a resynchronizing scan,
+// then rewrites every chunk size from the bottom up. Returns what had to be fixed
+inline std::vector<std::string> MSH::RepairMSH()
+{
+	std::vector<std::string> Fixes;
+	std::vector<Chunk> Tree;
+
+	// Only HEDR belongs at the top, anything else is skipped until the next one
+	size_t position = 0;
+	while (position + 8 <= Size)
+	{
+		if (!LooksLikeChunk(position, true) || sv.substr(position, 4) != "HEDR")
+		{
+			size_t Next = position + 1;
+			while (Next + 8 <= Size && sv.substr(Next, 4) != "HEDR")
+				Next++;
+			if (Next + 8 > Size)
+				Next = Size;
+
+			Fixes.push_back("dropped " + std::to_string(Next - position) + " stray byte(s) at " + std::to_string(position));
+			position = Next;
+			continue;
+		}
+
+		Chunk Top;
+		position = ScanChunk(Top, position, "HEDR", Fixes);
+		Tree.push_back(Top);
+	}
+
+	if (position < Size)
+		Fixes.push_back("dropped " + std::to_string(Size - position) + " stray byte(s) at " + std::to_string(position));
+
+	// Write it all back out with fresh sizes
+	std::vector<unsigned char> Repaired;
+	Repaired.reserve(Size);
+	for (auto& Top : Tree)
+		WriteChunk(Top, Repaired, Top.Header, &Fixes);
+
+	if (Repaired.size() != Size || std::memcmp(Repaired.data(), Data, Size) != 0)
+	{
+		delete[] Data;
+		Size = Repaired.size();
+		Data = new unsigned char[Size];
+		std::memcpy(Data, Repaired.data(), Size);
+		sv = std::string_view((char*)Data, Size);
+		CHANGED = true;
+	}
+
+	return Fixes;
+}
+
+// Returns whether a chunk starts at position (Known: only trust headers from the grammar)
+inline bool MSH::LooksLikeChunk(size_t position, bool Known)
+{
+	if (position + 8 > Size)
+		return false;
+
+	std::string Header(sv.substr(position, 4));
+	for (char ch : Header)
+		if (!((ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9')))
+			return false;
+
+	if (Known && !Chunk::IsKnown(Header))
+		return false;
+
+	// Container sizes are rebuilt anyway, leaves have to fit
+	uint32_t ChunkSize = 0;
+	std::memcpy(&ChunkSize, Data + position + 4, 4);
+	return Chunk::IsContainer(Header) || ChunkSize <= Size - (position + 8);
+}
+
+// Returns the next position after position where a known chunk starts, or Size
+inline size_t MSH::FindNextChunk(size_t position)
+{
+	for (size_t Next = position + 1; Next + 8 <= Size; Next++)
+		if (LooksLikeChunk(Next, true))
+			return Next;
+
+	return Size;
+}
+
+// Scans the children of container C ignoring its recorded size, returns where C ends
+// A container ends at the first chunk that doesn't belong in it
+inline size_t MSH::ScanChunk(Chunk& C, size_t position, const std::string& Path, std::vector<std::string>& Fixes)
+{
+	C.Header = std::string(sv.substr(position, 4));
+	C.Position = position + 4;
+	std::memcpy(&C.Size, Data + C.Position, 4);
+
+	size_t pos = C.Position + 4 + Chunk::PrefixSize(C.Header);
+	if (pos > Size)
+		return Size;
+
+	while (pos + 8 <= Size)
+	{
+		// Garbage, skip ahead to the next chunk we recognise
+		if (!LooksLikeChunk(pos, false))
+		{
+			size_t Next = FindNextChunk(pos);
+			Fixes.push_back("dropped " + std::to_string(Next - pos) + " unreadable byte(s) at " + std::to_string(pos) + " in " + Path);
+			pos = Next;
+			continue;
+		}
+
+		std::string Header(sv.substr(pos, 4));
+		if (!Chunk::Accepts(C.Header, Header))
+			return pos;
+
+		Chunk Child;
+		if (Chunk::IsContainer(Header))
+		{
+			pos = ScanChunk(Child, pos, Path + "/" + Header, Fixes);
+			C.Children.push_back(Child);
+			continue;
+		}
+
+		Child.Header = Header;
+		Child.Position = pos + 4;
+		std::memcpy(&Child.Size, Data + Child.Position, 4);
+
+		// A leaf should be followed by another chunk or the end of the file
+		// If the next chunk starts inside it the size was too big, otherwise the gap is skipped as garbage
+		size_t start = Child.Position + 4;
+		size_t stop = start + Child.Size;
+		size_t Next = stop;
+		if (stop != Size && !LooksLikeChunk(stop, false))
+			Next = FindNextChunk(start - 1);
+
+		if (Next < stop)
+		{
+			Fixes.push_back(Path + "/" + Header + " at " + std::to_string(pos) + ": size " + std::to_string(Child.Size)
+				+ " -> " + std::to_string(Next - start));
+			Child.Size = static_cast<uint32_t>(Next - start);
+			stop = Next;
+		}
+
+		C.Children.push_back(Child);
+		pos = stop;
+	}
+
+	return std::min(pos, Size);
+}
+
+// Appends C to Out, working out container sizes from their children
+inline void MSH::WriteChunk(const Chunk& C, std::vector<unsigned char>& Out, const std::string& Path, std::vector<std::string>* Fixes)
+{
+	Out.insert(Out.end(), C.Header.begin(), C.Header.end());
+	size_t SizePosition = Out.size();
+	Out.insert(Out.end(), 4, 0);
+
+	if (Chunk::IsContainer(C.Header))
+	{
+		// MATL leads with the number of materials
+		if (C.Header == "MATL")
+		{
+			uint32_t Count = 0;
+			for (auto& Child : C.Children)
+				if (Child.Header == "MATD")
+					Count++;
+
+			uint32_t OldCount = Count;
+			if (!C.Owned && C.Position + 8 <= Size)
+				std::memcpy(&OldCount, Data + C.Position + 4, 4);
+			if (Fixes != nullptr && OldCount != Count)
+				Fixes->push_back(Path + " at " + std::to_string(C.Position - 4) + ": material count " + std::to_string(OldCount) + " -> " + std::to_string(Count));
+
+			Out.insert(Out.end(), reinterpret_cast<unsigned char*>(&Count), reinterpret_cast<unsigned char*>(&Count) + 4);
+		}
+
+		for (auto& Child : C.Children)
+			WriteChunk(Child, Out, Path + "/" + Child.Header, Fixes);
+	}
+	else if (C.Owned)
+		Out.insert(Out.end(), C.Payload.begin(), C.Payload.end());
+	else
+	{
+		size_t Count = std::min(static_cast<size_t>(C.Size), Size - std::min(Size, C.Position + 4));
+		Out.insert(Out.end(), Data + C.Position + 4, Data + C.Position + 4 + Count);
+	}
+
+	uint32_t NewSize = static_cast<uint32_t>(Out.size() - SizePosition - 4);
+	std::memcpy(Out.data() + SizePosition, &NewSize, 4);
+
+	if (Fixes != nullptr && !C.Owned && Chunk::IsContainer(C.Header) && NewSize != C.Size)
+		Fixes->push_back(Path + " at " + std::to_string(C.Position - 4) + ": size " + std::to_string(C.Size) + " -> " + std::to_string(NewSize));
+}
+
+// Returns a copy of C whose leaves hold their own payload, so it can outlive or leave this MSH
+inline Chunk MSH::DetachChunk(const Chunk& C)
+{
+	Chunk Copy;
+	Copy.Header = C.Header;
+	Copy.Size = C.Size;
+	Copy.Owned = true;
+
+	if (C.Owned)
+		Copy.Payload = C.Payload;
+	else if (Chunk::IsContainer(C.Header))
+	{
+		// Keep the prefix (MATL count) too
+		size_t Prefix = std::min(Chunk::PrefixSize(C.Header), Size - std::min(Size, C.Position + 4));
+		Copy.Payload.assign(Data + C.Position + 4, Data + C.Position + 4 + Prefix);
+	}
+	else
+	{
+		size_t Count = std::min(static_cast<size_t>(C.Size), Size - std::min(Size, C.Position + 4));
+		Copy.Payload.assign(Data + C.Position + 4, Data + C.Position + 4 + Count);
+	}
+
+	for (auto& Child : C.Children)
+		Copy.Children.push_back(DetachChunk(Child));
+
+	return Copy;
+}
+
+// Replaces Data with the written Tree and parses it again
+inline void MSH::RebuildMSH(const std::vector<Chunk>& Tree)
+{
+	std::vector<unsigned char> Rebuilt;
+	Rebuilt.reserve(Size);
+	for (auto& C : Tree)
+		WriteChunk(C, Rebuilt, C.Header);
+
+	delete[] Data;
+	Size = Rebuilt.size();
+	Data = new unsigned char[Size];
+	std::memcpy(Data, Rebuilt.data(), Size);
+	sv = std::string_view((char*)Data, Size);
+
+	ParseMSH();
+	CHANGED = true;
+}
+
+// Returns whether there are material or model edits that PrepMSHForWrite still has to bake in
+inline bool MSH::PendingEdits()
+{
+	for (auto& Mat : Materials)
+		if (Mat.MATDChanged)
+			return true;
+
+	// ImportMODL only marks the CHANGED bits of the new model
+	for (auto& MODL : Models)
+		if (MODL.MODLChanged || MODL.CHANGED.any())
+			return true;
+
+	return false;
+}
+
+// Returns the first child of Parent with this header, or nullptr
+inline Chunk* MSH::FindChild(Chunk& Parent, const std::string& Header)
+{
+	for (auto& Child : Parent.Children)
+		if (Child.Header == Header)
+			return &Child;
+
+	return nullptr;
+}
+
+// Returns the payload of a leaf, wherever it's held
+inline std::string_view MSH::GetPayload(const Chunk& C)
+{
+	if (C.Owned)
+		return std::string_view(reinterpret_cast<const char*>(C.Payload.data()), C.Payload.size());
+
+	size_t Start = std::min(Size, C.Position + 4);
+	return sv.substr(Start, std::min(static_cast<size_t>(C.Size), Size - Start));
+}
+
+// Reads the string in a leaf
+inline std::string MSH::GetChunkString(const Chunk& C)
+{
+	std::string Str(GetPayload(C));
+	return Str.substr(0, Str.find('\0'));
+}
+
+// Writes the string into a detached leaf (NULL terminated and padded to 4 bytes)
+inline void MSH::SetChunkString(Chunk& C, const std::string& Str)
+{
+	C.Payload.assign(Str.begin(), Str.end());
+	C.Payload.push_back(0);
+	while (C.Payload.size() % 4 != 0)
+		C.Payload.push_back(0);
+
+	C.Size = static_cast<uint32_t>(C.Payload.size());
+	C.Owned = true;
+}
+
+// Reads the uint32 at Offset in a leaf
+inline uint32_t MSH::GetChunkValue(const Chunk& C, size_t Offset)
+{
+	std::string_view Payload = GetPayload(C);
+
+	uint32_t Value = 0;
+	if (Offset + 4 <= Payload.size())
+		std::memcpy(&Value, Payload.data() + Offset, 4);
+
+	return Value;
+}
+
+// Writes the uint32 at Offset in a detached leaf
+inline void MSH::SetChunkValue(Chunk& C, uint32_t Value, size_t Offset)
+{
+	if (C.Payload.size() < Offset + 4)
+		C.Payload.resize(Offset + 4, 0);
+
+	std::memcpy(C.Payload.data() + Offset, &Value, 4);
+	C.Size = static_cast<uint32_t>(C.Payload.size());
+	C.Owned = true;
+}
+
+// Adds the materials and models of Other to this MSH (identical materials are shared)
+inline void MSH::MergeMSH(MSH& Other)
+{
+	// Work on detached copies so the bytes of both files can be mixed
+	std::vector<Chunk> Tree;
+	for (auto& C : Chunks)
+		Tree.push_back(DetachChunk(C));
+
+	std::vector<Chunk> OtherTree;
+	for (auto& C : Other.Chunks)
+		OtherTree.push_back(Other.DetachChunk(C));
+
+	Chunk* HEDR = Tree.empty() ? nullptr : &Tree.front();
+	Chunk* OtherHEDR = OtherTree.empty() ? nullptr : &OtherTree.front();
+	Chunk* MSH2 = HEDR ? FindChild(*HEDR, "MSH2") : nullptr;
+	Chunk* OtherMSH2 = OtherHEDR ? FindChild(*OtherHEDR, "MSH2") : nullptr;
+	if (MSH2 == nullptr || OtherMSH2 == nullptr)
+	{
+		std::cout << "\n MergeMSH: " << Other.FileName << " has no MSH2 chunk, skipped!";
+		return;
+	}
+
+	Chunk* MATL = FindChild(*MSH2, "MATL");
+	Chunk* OtherMATL = FindChild(*OtherMSH2, "MATL");
+	if (MATL == nullptr)
+	{
+		std::cout << "\n MergeMSH: " << FileName << " has no MATL chunk, skipped!";
+		return;
+	}
+
+	// Returns the name in a NAME child
+	auto NameOf = [this](Chunk& C)
+	{
+		Chunk* Name = FindChild(C, "NAME");
+		return Name ? GetChunkString(*Name) : std::string();
+	};
+
+	// Returns Base, or Base_1, Base_2... whichever isn't in Taken yet
+	auto Unique = [](const std::string& Base, const std::vector<std::string>& Taken)
+	{
+		std::string Name = Base;
+		for (unsigned int N = 1; std::find(Taken.begin(), Taken.end(), Name) != Taken.end(); N++)
+			Name = Base + "_" + std::to_string(N);
+		return Name;
+	};
+
+	// Materials, reusing any that are byte for byte the same
+	std::vector<std::string> MaterialNames;
+	std::vector<std::vector<unsigned char>> MaterialBytes;
+	for (auto& MATD : MATL->Children)
+	{
+		MaterialNames.push_back(NameOf(MATD));
+		MaterialBytes.emplace_back();
+		WriteChunk(MATD, MaterialBytes.back(), "MATD");
+	}
+
+	std::vector<uint32_t> MaterialMap;
+	unsigned int Shared = 0;
+	if (OtherMATL != nullptr)
+	{
+		for (auto& MATD : OtherMATL->Children)
+		{
+			std::vector<unsigned char> Bytes;
+			WriteChunk(MATD, Bytes, "MATD");
+
+			auto Same = std::find(MaterialBytes.begin(), MaterialBytes.end(), Bytes);
+			if (Same != MaterialBytes.end())
+			{
+				MaterialMap.push_back(static_cast<uint32_t>(Same - MaterialBytes.begin()));
+				Shared++;
+				continue;
+			}
+
+			// A different material with a name we already have gets a new name
+			Chunk* Name = FindChild(MATD, "NAME");
+			if (Name != nullptr)
+				SetChunkString(*Name, Unique(GetChunkString(*Name), MaterialNames));
+
+			MaterialMap.push_back(static_cast<uint32_t>(MATL->Children.size()));
+			MaterialNames.push_back(NameOf(MATD));
+			MaterialBytes.emplace_back();
+			WriteChunk(MATD, MaterialBytes.back(), "MATD");
+			MATL->Children.push_back(MATD);
+		}
+	}
+
+	// Models get new indices after ours and unique names
+	std::vector<std::string> ModelNames;
+	uint32_t NextMNDX = 0;
+	size_t LastModel = 0;
+	for (size_t C = 0; C < MSH2->Children.size(); C++)
+	{
+		Chunk& MODL = MSH2->Children.at(C);
+		if (MODL.Header != "MODL")
+			continue;
+
+		ModelNames.push_back(NameOf(MODL));
+		Chunk* MNDX = FindChild(MODL, "MNDX");
+		if (MNDX != nullptr)
+			NextMNDX = std::max(NextMNDX, GetChunkValue(*MNDX) + 1);
+		LastModel = C + 1;
+	}
+	if (LastModel == 0)
+		LastModel = MSH2->Children.size();
+
+	std::vector<std::pair<std::string, std::string>> Renamed;
+	std::vector<std::pair<uint32_t, uint32_t>> Reindexed;
+	std::vector<Chunk> NewModels;
+	for (auto& MODL : OtherMSH2->Children)
+	{
+		if (MODL.Header != "MODL")
+			continue;
+
+		std::string OldName = NameOf(MODL);
+		std::string NewName = Unique(OldName, ModelNames);
+		ModelNames.push_back(NewName);
+		if (NewName != OldName)
+			Renamed.emplace_back(OldName, NewName);
+
+		if (Chunk* Name = FindChild(MODL, "NAME"))
+			SetChunkString(*Name, NewName);
+		if (Chunk* MNDX = FindChild(MODL, "MNDX"))
+		{
+			Reindexed.emplace_back(GetChunkValue(*MNDX), NextMNDX);
+			SetChunkValue(*MNDX, NextMNDX++);
+		}
+
+		NewModels.push_back(MODL);
+	}
+
+	// Point parents, materials and envelopes at their new names and indices
+	for (auto& MODL : NewModels)
+	{
+		if (Chunk* PRNT = FindChild(MODL, "PRNT"))
+			for (auto& Name : Renamed)
+				if (GetChunkString(*PRNT) == Name.first)
+				{
+					// A new name may equal a later old name, so stop at the first match
+					SetChunkString(*PRNT, Name.second);
+					break;
+				}
+
+		Chunk* GEOM = FindChild(MODL, "GEOM");
+		if (GEOM == nullptr)
+			continue;
+
+		for (auto& Child : GEOM->Children)
+		{
+			if (Child.Header == "SEGM")
+			{
+				for (auto& MATI : Child.Children)
+					if (MATI.Header == "MATI")
+					{
+						uint32_t Index = GetChunkValue(MATI);
+						SetChunkValue(MATI, Index < MaterialMap.size() ? MaterialMap.at(Index) : 0);
+					}
+			}
+			else if (Child.Header == "ENVL")
+			{
+				// Count, then the MNDX of each envelope model
+				uint32_t Count = GetChunkValue(Child);
+				for (uint32_t E = 0; E < Count; E++)
+					for (auto& Index : Reindexed)
+						if (GetChunkValue(Child, 4 + 4 * size_t(E)) == Index.first)
+						{
+							SetChunkValue(Child, Index.second, 4 + 4 * size_t(E));
+							break;
+						}
+			}
+		}
+	}
+
+	MSH2->Children.insert(MSH2->Children.begin() + LastModel, NewModels.begin(), NewModels.end());
+
+	// Skeletons and animations aren't combined
+	for (auto& C : OtherHEDR->Children)
+		if (C.Header == "SKL2" || C.Header == "BLN2" || C.Header == "ANM2")
+			std::cout << "\n MergeMSH: " << C.Header << " of " << Other.FileName << " was not merged";
+
+	RebuildMSH(Tree);
+
+	std::cout << "\n MergeMSH: " << Other.FileName << " merged, " << NewModels.size() << " model(s), "
+		<< MaterialMap.size() - Shared << " new material(s), " << Shared << " shared, " << Renamed.size() << " renamed";
+}
+
+// Returns the models (by index) of each root hierarchy, or of each model on its own
+inline std::vector<std::vector<size_t>> MSH::GetModelGroups(bool PerModel)
+{
+	std::vector<std::vector<size_t>> Groups;
+	if (PerModel)
+	{
+		for (size_t M = 0; M < Models.size(); M++)
+			Groups.push_back({ M });
+		return Groups;
+	}
+
+	std::vector<bool> Grouped(Models.size(), false);
+	for (size_t Root = 0; Root < Models.size(); Root++)
+	{
+		if (Graph.Parents.at(Root) != -1)
+			continue;
+
+		// Collect the hierarchy, keeping file order
+		Groups.push_back(Graph.Subtree(Root));
+		std::sort(Groups.back().begin(), Groups.back().end());
+		for (size_t M : Groups.back())
+			Grouped.at(M) = true;
+	}
+
+	// Models stuck in a parent loop go on their own
+	for (size_t M = 0; M < Models.size(); M++)
+		if (!Grouped.at(M))
+			Groups.push_back({ M });
+
+	return Groups;
+}
+
+// Returns the name of a model without its padding
+inline std::string MSH::GetModelName(size_t ModelIndex)
+{
+	return std::string(Models.at(ModelIndex).Name.c_str());
+}
+
+// Returns the parent of each model, or -1 for roots (no PRNT, or one that doesn't exist)
+inline std::vector<long long> MSH::GetModelParents()
+{
+	return Graph.Parents;
+}
+
+// Returns the parent and child links of the models
+inline const Hierarchy& MSH::GetHierarchy()
+{
+	return Graph;
+}
+
+// Links up Graph from the names and parents of Models
+inline void MSH::BuildHierarchy()
+{
+	std::vector<std::string> Names;
+	std::vector<std::string> ParentNames;
+	for (size_t M = 0; M < Models.size(); M++)
+	{
+		Names.push_back(GetModelName(M));
+		ParentNames.push_back(std::string(Models.at(M).PRNT.c_str()));
+	}
+
+	Graph.Build(Names, ParentNames);
+
+	// Every world transform has to be worked out again
+	WorldTransforms.assign(Models.size(), Matrix());
+	WorldValid.assign(Models.size(), 0);
+	WorldDirty = true;
+}
+
+// Drops the cached world transform of a model and everything under it
+inline void MSH::InvalidateWorld(size_t ModelIndex)
+{
+	for (size_t M : Graph.Subtree(ModelIndex))
+		WorldValid.at(M) = 0;
+	WorldDirty = true;
+}
+
+// Returns the transform of a model relative to its parent (from its TRAN)
+inline Matrix MSH::GetLocalTransform(size_t ModelIndex)
+{
+	return Matrix::FromTRAN(Models.at(ModelIndex).TRAN);
+}
+
+// Returns the world transform of every model, working out only those invalidated since the last call
+inline const std::vector<Matrix>& MSH::GetWorldTransforms()
+{
+	if (!WorldDirty)
+		return WorldTransforms;
+
+	// Parents come before their children in a subtree, so a parent is always ready when its children need it
+	for (size_t Root = 0; Root < Models.size(); Root++)
+	{
+		if (Graph.Parents.at(Root) != -1)
+			continue;
+
+		for (size_t M : Graph.Subtree(Root))
+		{
+			if (WorldValid.at(M))
+				continue;
+
+			long long P = Graph.Parents.at(M);
+			WorldTransforms.at(M) = P == -1 ? GetLocalTransform(M) : WorldTransforms.at(static_cast<size_t>(P)) * GetLocalTransform(M);
+			WorldValid.at(M) = 1;
+		}
+	}
+
+	// Models stuck in a parent loop can't be reached from a root, so they only get their own transform
+	for (size_t M = 0; M < Models.size(); M++)
+		if (!WorldValid.at(M))
+		{
+			WorldTransforms.at(M) = GetLocalTransform(M);
+			WorldValid.at(M) = 1;
+		}
+
+	WorldDirty = false;
+	return WorldTransforms;
+}
+
+// Returns whether the name marks a hardpoint, collision, shadow volume, bone or other special model
+inline bool MSH::IsSpecialModel(const std::string& Name)
+{
+	static const std::regex Special("(p_)(.*)|(collision)(.*)|(sv_)(.*)|(shadowvolume)(.*)|(c_)(.*)|(eff_)(.*)|(root_)(.*)|(bone_)(.*)|(hp_)(.*)");
+	return std::regex_match(Name, Special);
+}
+
+// Returns whether the name marks a collision model (collision or p_ prefixed)
+inline bool MSH::IsCollisionModel(const std::string& Name)
+{
+	static const std::regex Collision("(collision)(.*)|(p_)(.*)");
+	return std::regex_match(Name, Collision);
+}
+
+// Returns whether the name marks a shadow volume model (sv_ or shadowvolume prefixed)
+inline bool MSH::IsShadowModel(const std::string& Name)
+{
+	static const std::regex Shadow("(sv_)(.*)|(shadowvolume)(.*)");
+	return std::regex_match(Name, Shadow);
+}
+
+// Returns a standalone MSH file holding only the selected models and the materials they use
+// Only reads this MSH, so several can be built at once
+inline std::vector<unsigned char> MSH::ExtractModels(const std::vector<size_t>& Selected)
+{
+	std::vector<unsigned char> Out;
+	if (Chunks.empty())
+		return Out;
+
+	// Copy the tree (leaves still point into Data until they're changed)
+	Chunk HEDR = Chunks.front();
+	Chunk* MSH2 = FindChild(HEDR, "MSH2");
+	Chunk* MATL = MSH2 ? FindChild(*MSH2, "MATL") : nullptr;
+	if (MSH2 == nullptr || MATL == nullptr)
+		return Out;
+
+	std::vector<Chunk*> MODLs;
+	for (auto& C : MSH2->Children)
+		if (C.Header == "MODL")
+			MODLs.push_back(&C);
+	if (MODLs.size() != Models.size())
+		return Out;
+
+	// Skins can't deform without their bones, so the bones (and the models above them) come along
+	std::vector<bool> Wanted(MODLs.size(), false);
+	for (size_t M : Selected)
+		if (M < Wanted.size())
+			Wanted.at(M) = true;
+
+	bool Skinned = false;
+	for (size_t M = 0; M < MODLs.size(); M++)
+	{
+		Chunk* GEOM = Wanted.at(M) ? FindChild(*MODLs.at(M), "GEOM") : nullptr;
+		Chunk* ENVL = GEOM ? FindChild(*GEOM, "ENVL") : nullptr;
+		if (ENVL == nullptr)
+			continue;
+
+		Skinned = true;
+		uint32_t Count = GetChunkValue(*ENVL);
+		for (uint32_t E = 0; E < Count && 4 + 4 * size_t(E) + 4 <= ENVL->Size; E++)
+		{
+			uint32_t Bone = GetChunkValue(*ENVL, 4 + 4 * size_t(E));
+			for (size_t B = 0; B < MODLs.size(); B++)
+			{
+				Chunk* MNDX = FindChild(*MODLs.at(B), "MNDX");
+				if (MNDX == nullptr || GetChunkValue(*MNDX) != Bone)
+					continue;
+
+				// Stops at the first model already wanted, which also ends parent loops
+				for (long long P = static_cast<long long>(B); P != -1 && !Wanted.at(P); P = Graph.Parents.at(P))
+					Wanted.at(P) = true;
+				break;
+			}
+		}
+	}
+
+	// Animation belongs to the whole file, the skeleton and blend data only matter to skins
+	HEDR.Children.erase(std::remove_if(HEDR.Children.begin(), HEDR.Children.end(), [Skinned](const Chunk& C)
+		{ return C.Header == "ANM2" || (!Skinned && (C.Header == "SKL2" || C.Header == "BLN2")); }), HEDR.Children.end());
+	MSH2 = FindChild(HEDR, "MSH2");
+
+	// Keep the wanted MODLs, in file order
+	std::vector<Chunk> Kept;
+	std::vector<Chunk> Rest;
+	size_t ModelIndex = 0;
+	for (auto& C : MSH2->Children)
+	{
+		if (C.Header == "MODL")
+		{
+			if (Wanted.at(ModelIndex))
+				Kept.push_back(C);
+			ModelIndex++;
+		}
+		else
+			Rest.push_back(C);
+	}
+
+	for (auto& C : Rest)
+		if (C.Header == "MATL")
+			MATL = &C;
+
+	// Materials in use, in their original order
+	std::vector<uint32_t> MaterialMap(MATL->Children.size(), UINT32_MAX);
+	for (auto& MODL : Kept)
+		if (Chunk* GEOM = FindChild(MODL, "GEOM"))
+			for (auto& SEGM : GEOM->Children)
+				if (SEGM.Header == "SEGM")
+					if (Chunk* MATI = FindChild(SEGM, "MATI"))
+						if (GetChunkValue(*MATI) < MaterialMap.size())
+							MaterialMap.at(GetChunkValue(*MATI)) = 0;
+
+	std::vector<Chunk> Materials;
+	for (size_t M = 0; M < MATL->Children.size(); M++)
+	{
+		if (MaterialMap.at(M) == UINT32_MAX)
+			continue;
+		MaterialMap.at(M) = static_cast<uint32_t>(Materials.size());
+		Materials.push_back(MATL->Children.at(M));
+	}
+
+	// The file readers expect at least one material
+	if (Materials.empty() && !MATL->Children.empty())
+		Materials.push_back(MATL->Children.front());
+	MATL->Children = Materials;
+
+	// Number the models from 1 again and fix up what refers to them
+	std::vector<std::string> Names;
+	std::vector<std::pair<uint32_t, uint32_t>> Reindexed;
+	for (size_t M = 0; M < Kept.size(); M++)
+	{
+		if (Chunk* Name = FindChild(Kept.at(M), "NAME"))
+			Names.push_back(GetChunkString(*Name));
+		if (Chunk* MNDX = FindChild(Kept.at(M), "MNDX"))
+		{
+			Reindexed.emplace_back(GetChunkValue(*MNDX), static_cast<uint32_t>(M + 1));
+			*MNDX = DetachChunk(*MNDX);
+			SetChunkValue(*MNDX, static_cast<uint32_t>(M + 1));
+		}
+	}
+
+	for (auto& MODL : Kept)
+	{
+		// Parents that didn't come along are dropped, making this a root
+		for (size_t C = 0; C < MODL.Children.size(); C++)
+			if (MODL.Children.at(C).Header == "PRNT"
+				&& std::find(Names.begin(), Names.end(), GetChunkString(MODL.Children.at(C))) == Names.end())
+				MODL.Children.erase(MODL.Children.begin() + C--);
+
+		Chunk* GEOM = FindChild(MODL, "GEOM");
+		if (GEOM == nullptr)
+			continue;
+
+		for (auto& Child : GEOM->Children)
+		{
+			if (Child.Header == "SEGM")
+			{
+				if (Chunk* MATI = FindChild(Child, "MATI"))
+				{
+					uint32_t Index = GetChunkValue(*MATI);
+					*MATI = DetachChunk(*MATI);
+					SetChunkValue(*MATI, Index < MaterialMap.size() && MaterialMap.at(Index) != UINT32_MAX ? MaterialMap.at(Index) : 0);
+				}
+			}
+			else if (Child.Header == "ENVL")
+			{
+				Child = DetachChunk(Child);
+				uint32_t Count = GetChunkValue(Child);
+				for (uint32_t E = 0; E < Count; E++)
+					for (auto& Index : Reindexed)
+						if (GetChunkValue(Child, 4 + 4 * size_t(E)) == Index.first)
+						{
+							SetChunkValue(Child, Index.second, 4 + 4 * size_t(E));
+							break;
+						}
+			}
+		}
+	}
+
+	// MODLs go back where they were, before anything that followed them in MSH2
+	MSH2->Children.clear();
+	for (auto& C : Rest)
+		if (C.Header == "SINF" || C.Header == "CAMR" || C.Header == "MATL")
+			MSH2->Children.push_back(C);
+	MSH2->Children.insert(MSH2->Children.end(), Kept.begin(), Kept.end());
+	for (auto& C : Rest)
+		if (C.Header != "SINF" && C.Header != "CAMR" && C.Header != "MATL")
+			MSH2->Children.push_back(C);
+
+	WriteChunk(HEDR, Out, "HEDR");
+	return Out;
+}
+
+// Bakes pending edits into Data and re-parses, so structural operations see them
+inline void MSH::CommitEdits()
+{
+	if (!PendingEdits())
+		return;
+
+	PrepMSHForWrite();
+	ParseMSH();
+	CHANGED = true;
+}
+
+// Rebuilds MATL so old material M becomes Map[M] (the first material mapped to an index is kept),
+// rewriting every MATI on the way
+inline void MSH::RemapMaterials(const std::vector<uint32_t>& Map)
+{
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	Chunk* MATL = MSH2 ? FindChild(*MSH2, "MATL") : nullptr;
+	if (MATL == nullptr)
+		return;
+
+	std::vector<Chunk> Kept;
+	for (size_t M = 0; M < MATL->Children.size() && M < Map.size(); M++)
+		if (Map.at(M) == Kept.size())
+			Kept.push_back(MATL->Children.at(M));
+	MATL->Children = Kept;
+
+	for (auto& MODL : MSH2->Children)
+	{
+		Chunk* GEOM = MODL.Header == "MODL" ? FindChild(MODL, "GEOM") : nullptr;
+		if (GEOM == nullptr)
+			continue;
+
+		for (auto& SEGM : GEOM->Children)
+		{
+			Chunk* MATI = SEGM.Header == "SEGM" ? FindChild(SEGM, "MATI") : nullptr;
+			if (MATI == nullptr)
+				continue;
+
+			uint32_t Index = GetChunkValue(*MATI);
+			*MATI = DetachChunk(*MATI);
+			SetChunkValue(*MATI, Index < Map.size() ? Map.at(Index) : 0);
+		}
+	}
+
+	RebuildMSH(Tree);
+}
+
+// Collapses materials whose DATA, ATRB and textures match (names may differ) and remaps MATI
+inline void MSH::DedupeMaterials()
+{
+	CommitEdits();
+
+	Chunk* MSH2 = Chunks.empty() ? nullptr : FindChild(Chunks.front(), "MSH2");
+	Chunk* MATL = MSH2 ? FindChild(*MSH2, "MATL") : nullptr;
+	if (MATL == nullptr)
+		return;
+
+	// Everything but the name decides whether two materials look the same
+	std::vector<std::vector<unsigned char>> Keys;
+	std::vector<uint64_t> Hashes;
+	for (auto& MATD : MATL->Children)
+	{
+		Keys.emplace_back();
+		for (auto& Child : MATD.Children)
+			if (Child.Header != "NAME")
+				WriteChunk(Child, Keys.back(), Child.Header);
+		Hashes.push_back(HashBytes(Keys.back().data(), Keys.back().size()));
+	}
+
+	std::vector<uint32_t> Map;
+	std::vector<size_t> Firsts;
+	for (size_t M = 0; M < Keys.size(); M++)
+	{
+		size_t Same = 0;
+		while (Same < Firsts.size() && !(Hashes.at(Firsts.at(Same)) == Hashes.at(M) && Keys.at(Firsts.at(Same)) == Keys.at(M)))
+			Same++;
+
+		if (Same == Firsts.size())
+			Firsts.push_back(M);
+		Map.push_back(static_cast<uint32_t>(Same));
+	}
+
+	size_t Removed = Keys.size() - Firsts.size();
+	std::cout << "\n DedupeMaterials: " << FileName << ": " << Removed << " duplicate material(s) removed ("
+		<< Keys.size() << " -> " << Firsts.size() << ")";
+
+	if (Removed > 0)
+		RemapMaterials(Map);
+}
+
+// Removes materials no segment uses and compacts the MATI of the rest
+inline void MSH::PruneMaterials()
+{
+	CommitEdits();
+
+	// Usage table from the segments
+	std::vector<bool> Used(Materials.size(), false);
+	for (auto& MODL : Models)
+		for (auto& SEGM : MODL.Segments)
+			if (SEGM.MATI < Used.size())
+				Used.at(SEGM.MATI) = true;
+
+	// The readers need at least one material to be left
+	if (std::find(Used.begin(), Used.end(), true) == Used.end() && !Used.empty())
+		Used.at(0) = true;
+
+	std::vector<uint32_t> Map;
+	uint32_t Next = 0;
+	for (bool InUse : Used)
+		Map.push_back(InUse ? Next++ : UINT32_MAX);
+
+	size_t Removed = Used.size() - Next;
+	std::cout << "\n PruneMaterials: " << FileName << ": " << Removed << " unused material(s) removed ("
+		<< Used.size() << " -> " << Next << ")";
+
+	if (Removed > 0)
+		RemapMaterials(Map);
+}
+
+// Decodes the geometry of a SEGM chunk, false if its lists are malformed
+inline bool MSH::DecodeSegment(const Chunk& SEGM, Geometry& Geo)
+{
+	std::vector<std::pair<std::string, std::string_view>> Children;
+	for (auto& Child : SEGM.Children)
+		Children.emplace_back(Child.Header, GetPayload(Child));
+
+	return Geo.Decode(Children);
+}
+
+// Builds a detached SEGM chunk from decoded geometry into SEGM, false (leaving SEGM alone) if its indices don't fit in 16 bits
+inline bool MSH::EncodeSegment(const Geometry& Geo, Chunk& SEGM)
+{
+	auto Encoded = Geo.Encode();
+	if (Encoded.empty())
+		return false;
+
+	SEGM = Chunk();
+	SEGM.Header = "SEGM";
+	for (auto& List : Encoded)
+	{
+		Chunk Child;
+		Child.Header = List.first;
+		Child.Payload = List.second;
+		Child.Size = static_cast<uint32_t>(Child.Payload.size());
+		Child.Owned = true;
+		SEGM.Children.push_back(Child);
+	}
+
+	return true;
+}
+
+// Joins the segments of each model that share a material into one, as far as 16 bit indices allow
+inline void MSH::MergeSegments()
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	size_t Before = 0;
+	size_t After = 0;
+	size_t Refused = 0;
+
+	for (auto& MODL : MSH2->Children)
+		if (Chunk* GEOM = MODL.Header == "MODL" ? FindChild(MODL, "GEOM") : nullptr)
+			MergeGEOM(*GEOM, Before, After, Refused);
+
+	std::cout << "\n MergeSegments: " << FileName << ": " << Before << " -> " << After << " segment(s)";
+	if (Refused > 0)
+		std::cout << ", " << Refused << " merge(s) refused for exceeding " << Geometry::MaxVertices << " vertices";
+
+	// Decoding keeps only triangles, so that's what a merged segment has left to write
+	if (After < Before)
+	{
+		std::cout << " (merged segments write NDXL polygons as triangles and rebuild their strips)";
+		RebuildMSH(Tree);
+	}
+}
+
+// Joins the segments of GEOM that share a material and lists, adding up how many there were and are
+inline void MSH::MergeGEOM(Chunk& GEOM, size_t& Before, size_t& After, size_t& Refused)
+{
+	// Segments merged so far, with the child index each one replaces and how many went into it
+	std::vector<Geometry> Merged;
+	std::vector<size_t> Slots;
+	std::vector<size_t> Parts;
+	std::vector<bool> Dropped(GEOM.Children.size(), false);
+
+	for (size_t C = 0; C < GEOM.Children.size(); C++)
+	{
+		if (GEOM.Children.at(C).Header != "SEGM")
+			continue;
+		Before++;
+
+		Geometry Geo;
+		if (!DecodeSegment(GEOM.Children.at(C), Geo))
+		{
+			After++;
+			continue;
+		}
+
+		// Only segments with the same lists can share buffers, and shadow volumes can't be joined
+		size_t Target = 0;
+		bool Blocked = false;
+		bool Full = false;
+		for (auto& Extra : Geo.Extra)
+			Blocked = Blocked || Extra.first == "SHDW";
+
+		while (!Blocked && Target < Merged.size())
+		{
+			Geometry& Into = Merged.at(Target);
+			if (Into.MATI == Geo.MATI && Into.HasNormals == Geo.HasNormals && Into.HasUVs == Geo.HasUVs
+				&& Into.HasColors == Geo.HasColors && Into.HasWeights == Geo.HasWeights && Into.Extra == Geo.Extra)
+			{
+				if (Into.Vertices.size() + Geo.Vertices.size() <= Geometry::MaxVertices)
+					break;
+				Full = true;
+			}
+			Target++;
+		}
+
+		if (Blocked || Target == Merged.size())
+		{
+			if (!Blocked)
+			{
+				// Refused once, only if something could have taken it but had no room
+				Refused += Full;
+				Merged.push_back(Geo);
+				Slots.push_back(C);
+				Parts.push_back(1);
+			}
+			After++;
+			continue;
+		}
+
+		// Rebase the indices onto the end of the vertex list
+		Geometry& Into = Merged.at(Target);
+		uint32_t Base = static_cast<uint32_t>(Into.Vertices.size());
+		Into.Vertices.insert(Into.Vertices.end(), Geo.Vertices.begin(), Geo.Vertices.end());
+		for (uint32_t Index : Geo.Triangles)
+			Into.Triangles.push_back(Index + Base);
+		Into.HasNDXL = Into.HasNDXL || Geo.HasNDXL;
+		Into.HasNDXT = Into.HasNDXT || Geo.HasNDXT;
+		Into.HasSTRP = Into.HasSTRP || Geo.HasSTRP;
+		Parts.at(Target)++;
+		Dropped.at(C) = true;
+	}
+
+	// Segments that took in others are written again, the ones they took in go
+	// (merges stop at MaxVertices, so these always encode)
+	for (size_t M = 0; M < Merged.size(); M++)
+		if (Parts.at(M) > 1)
+			EncodeSegment(Merged.at(M), GEOM.Children.at(Slots.at(M)));
+
+	std::vector<Chunk> Kept;
+	for (size_t C = 0; C < GEOM.Children.size(); C++)
+		if (!Dropped.at(C))
+			Kept.push_back(GEOM.Children.at(C));
+	GEOM.Children = Kept;
+}
+
+// Bakes the transforms of visible static models into their vertices and joins them into one model per hierarchy
+inline void MSH::BatchStatic()
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	std::vector<Chunk*> MODLs;
+	for (auto& Child : MSH2->Children)
+		if (Child.Header == "MODL")
+			MODLs.push_back(&Child);
+	if (MODLs.size() != Models.size())
+		return;
+
+	std::vector<long long> Parent = GetModelParents();
+	const std::vector<Matrix>& World = GetWorldTransforms();
+
+	std::vector<char> Animated;
+	if (!GetAnimatedModels(Tree.front(), Animated))
+	{
+		std::cout << "\n BatchStatic: " << FileName << ": can't tell which models are animated, nothing batched";
+		return;
+	}
+	std::vector<char> Enveloped = GetEnvelopedModels(MODLs);
+
+	// Anything under an animated model moves with it, so it isn't static either
+	for (size_t Root = 0; Root < Models.size(); Root++)
+		if (Parent.at(Root) == -1)
+			for (size_t M : Graph.Subtree(Root))
+				if (Parent.at(M) != -1 && Animated.at(static_cast<size_t>(Parent.at(M))))
+					Animated.at(M) = 1;
+
+	// Static, visible, plain models only: animated, bone, skinned, cloth, shadow and special models are left as they are
+	std::vector<std::vector<Geometry>> Decoded(Models.size());
+	std::vector<bool> Batchable(Models.size(), false);
+	for (size_t M = 0; M < Models.size(); M++)
+	{
+		Chunk* GEOM = FindChild(*MODLs.at(M), "GEOM");
+		if (Models.at(M).MTYP != 4 || Models.at(M).FLGS || IsSpecialModel(Models.at(M).Name) || GEOM == nullptr
+			|| Animated.at(M) || Enveloped.at(M) || FindChild(*GEOM, "ENVL") != nullptr || FindChild(*GEOM, "CLTH") != nullptr)
+			continue;
+
+		bool Plain = true;
+		for (auto& SEGM : GEOM->Children)
+		{
+			if (SEGM.Header != "SEGM")
+				continue;
+
+			Decoded.at(M).emplace_back();
+			Geometry& Geo = Decoded.at(M).back();
+			Plain = Plain && DecodeSegment(SEGM, Geo) && !Geo.HasWeights && Geo.FitsIndices();
+			for (auto& Extra : Geo.Extra)
+				Plain = Plain && Extra.first != "SHDW";
+		}
+
+		Batchable.at(M) = Plain && !Decoded.at(M).empty();
+	}
+
+	size_t Batched = 0;
+	size_t Hosts = 0;
+	size_t Before = 0;
+	size_t After = 0;
+	size_t Refused = 0;
+	std::vector<bool> Removed(Models.size(), false);
+
+	for (auto& Group : GetModelGroups(false))
+	{
+		std::vector<size_t> Members;
+		for (size_t M : Group)
+			if (Batchable.at(M))
+				Members.push_back(M);
+		if (Members.size() < 2)
+			continue;
+
+		// The first static model takes in the rest, in its own space
+		size_t Host = Members.front();
+		Chunk* HostGEOM = FindChild(*MODLs.at(Host), "GEOM");
+		Matrix ToHost = World.at(Host).Inverse();
+		std::vector<Geometry> All = Decoded.at(Host);
+
+		for (size_t I = 1; I < Members.size(); I++)
+		{
+			size_t M = Members.at(I);
+			for (auto& Geo : Decoded.at(M))
+			{
+				Geo.Transform(ToHost * World.at(M));
+				Chunk SEGM;
+				if (EncodeSegment(Geo, SEGM))
+					HostGEOM->Children.push_back(SEGM);
+				All.push_back(Geo);
+			}
+
+			// Models that still parent others stay behind as empty nulls
+			bool HasChildren = std::find(Parent.begin(), Parent.end(), static_cast<long long>(M)) != Parent.end();
+			if (HasChildren)
+			{
+				Chunk* MTYP = FindChild(*MODLs.at(M), "MTYP");
+				if (MTYP != nullptr)
+				{
+					*MTYP = DetachChunk(*MTYP);
+					SetChunkValue(*MTYP, 0);
+				}
+
+				std::vector<Chunk> Kept;
+				for (auto& Child : MODLs.at(M)->Children)
+					if (Child.Header != "GEOM")
+						Kept.push_back(Child);
+				MODLs.at(M)->Children = Kept;
+			}
+			else
+				Removed.at(M) = true;
+			Batched++;
+		}
+
+		// The host's bounding box now has to hold everything
+		float Min[3] = { INFINITY, INFINITY, INFINITY };
+		float Max[3] = { -INFINITY, -INFINITY, -INFINITY };
+		for (auto& Geo : All)
+			for (auto& V : Geo.Vertices)
+				for (size_t A = 0; A < 3; A++)
+				{
+					Min[A] = std::min(Min[A], V.Position[A]);
+					Max[A] = std::max(Max[A], V.Position[A]);
+				}
+
+		Chunk* BBOX = FindChild(*HostGEOM, "BBOX");
+		if (BBOX != nullptr && Min[0] <= Max[0])
+		{
+			// Rotation (XYZW), center, extents, then the radius of the sphere around it
+			float Box[11] = { 0.0f, 0.0f, 0.0f, 1.0f };
+			for (size_t A = 0; A < 3; A++)
+			{
+				Box[4 + A] = (Min[A] + Max[A]) / 2;
+				Box[7 + A] = (Max[A] - Min[A]) / 2;
+			}
+			Box[10] = std::sqrt(Box[7] * Box[7] + Box[8] * Box[8] + Box[9] * Box[9]);
+
+			*BBOX = DetachChunk(*BBOX);
+			BBOX->Payload.assign(reinterpret_cast<unsigned char*>(Box), reinterpret_cast<unsigned char*>(Box) + sizeof(Box));
+			BBOX->Size = static_cast<uint32_t>(BBOX->Payload.size());
+		}
+
+		MergeGEOM(*HostGEOM, Before, After, Refused);
+		Hosts++;
+	}
+
+	std::cout << "\n BatchStatic: " << FileName << ": " << Batched << " static model(s) batched into " << Hosts
+		<< " model(s), " << Before << " -> " << After << " segment(s)";
+	if (Refused > 0)
+		std::cout << ", " << Refused << " merge(s) refused for exceeding " << Geometry::MaxVertices << " vertices";
+
+	if (Batched == 0)
+		return;
+
+	std::vector<Chunk> Kept;
+	size_t Model = 0;
+	for (auto& Child : MSH2->Children)
+	{
+		if (Child.Header == "MODL" && Removed.at(Model++))
+			continue;
+		Kept.push_back(Child);
+	}
+	MSH2->Children = Kept;
+	RenumberModels(*MSH2);
+
+	RebuildMSH(Tree);
+}
+
+// Reorders each segment's triangles for the vertex cache (and for overdraw if asked), then its vertices for fetch order
+inline void MSH::OptimizeCache(bool Overdraw)
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	size_t Optimized = 0;
+	for (auto& MODL : MSH2->Children)
+	{
+		Chunk* GEOM = MODL.Header == "MODL" ? FindChild(MODL, "GEOM") : nullptr;
+		if (GEOM == nullptr)
+			continue;
+
+		Chunk* Name = FindChild(MODL, "NAME");
+		size_t Segment = 0;
+		for (auto& SEGM : GEOM->Children)
+		{
+			if (SEGM.Header != "SEGM")
+				continue;
+
+			// Shadow volumes may point at the vertices, so those segments keep their order
+			Geometry Geo;
+			bool Usable = DecodeSegment(SEGM, Geo) && Geo.Triangles.size() >= 6;
+			for (auto& Extra : Geo.Extra)
+				Usable = Usable && Extra.first != "SHDW";
+
+			if (Usable)
+			{
+				// Measured on the strips when there are some, as that's what gets drawn
+				float Before = Geo.DrawnCacheMissRatio();
+				Geo.OptimizeVertexCache();
+				if (Overdraw)
+					Geo.OptimizeOverdraw(1.05f);
+				Geo.OptimizeVertexFetch();
+				Geo.StripsInOrder = true;
+				float After = Geo.DrawnCacheMissRatio();
+
+				std::cout << "\n OptimizeCache: " << (Name ? GetChunkString(*Name) : std::string()) << " segment " << Segment
+					<< ": ACMR " << std::fixed << std::setprecision(3) << Before << " -> " << After << std::defaultfloat;
+
+				if (EncodeSegment(Geo, SEGM))
+					Optimized++;
+			}
+			Segment++;
+		}
+	}
+
+	std::cout << "\n OptimizeCache: " << FileName << ": " << Optimized << " segment(s) reordered";
+
+	if (Optimized > 0)
+		RebuildMSH(Tree);
+}
+
+// Rebuilds every STRP from the segment's triangles as long strips, segments in parallel
+inline void MSH::Stripify()
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	// Decoding reads Data, so it's done here and only the stripping goes to the workers
+	std::vector<Chunk*> Targets;
+	std::vector<std::vector<uint32_t>> Lists;
+	for (auto& MODL : MSH2->Children)
+	{
+		Chunk* GEOM = MODL.Header == "MODL" ? FindChild(MODL, "GEOM") : nullptr;
+		if (GEOM == nullptr)
+			continue;
+
+		for (auto& SEGM : GEOM->Children)
+		{
+			Chunk* STRP = SEGM.Header == "SEGM" ? FindChild(SEGM, "STRP") : nullptr;
+			Geometry Geo;
+			if (STRP == nullptr || !DecodeSegment(SEGM, Geo) || Geo.Vertices.size() > Geometry::MaxVertices)
+				continue;
+
+			Targets.push_back(STRP);
+			Lists.push_back(Geo.Triangles);
+		}
+	}
+
+	std::vector<std::vector<uint16_t>> Strips(Targets.size());
+	{
+		ThreadPool Pool(std::thread::hardware_concurrency());
+		for (size_t S = 0; S < Targets.size(); S++)
+			Pool.Submit([&Strips, &Lists, S] { Strips.at(S) = Geometry::TrianglesToStrips(Lists.at(S)); });
+	}
+
+	// A strip is only replaced when it gets shorter
+	size_t Before = 0;
+	size_t After = 0;
+	size_t Replaced = 0;
+	for (size_t S = 0; S < Targets.size(); S++)
+	{
+		Chunk& STRP = *Targets.at(S);
+		uint32_t OldCount = GetChunkValue(STRP);
+		uint32_t NewCount = static_cast<uint32_t>(Strips.at(S).size());
+		Before += OldCount;
+
+		if (NewCount >= OldCount)
+		{
+			After += OldCount;
+			continue;
+		}
+
+		STRP.Payload.clear();
+		STRP.Payload.resize(4 + 2 * size_t(NewCount), 0);
+		std::memcpy(STRP.Payload.data(), &NewCount, 4);
+		if (NewCount > 0)
+			std::memcpy(STRP.Payload.data() + 4, Strips.at(S).data(), 2 * size_t(NewCount));
+		while (STRP.Payload.size() % 4 != 0)
+			STRP.Payload.push_back(0);
+
+		STRP.Size = static_cast<uint32_t>(STRP.Payload.size());
+		STRP.Owned = true;
+		After += NewCount;
+		Replaced++;
+	}
+
+	std::cout << "\n Stripify: " << FileName << ": " << Replaced << " of " << Targets.size() << " strip list(s) rebuilt, "
+		<< Before << " -> " << After << " strip indices";
+
+	if (Replaced > 0)
+		RebuildMSH(Tree);
+}
+
+// Merges the near identical vertices of every segment (in parallel) and remaps their indices
+inline void MSH::Weld(float PositionTolerance, float NormalTolerance, float UVTolerance, float ColorTolerance)
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	// Shadow volumes may point at the vertices, so those segments are left alone
+	std::vector<Chunk*> Targets;
+	std::vector<Geometry> Decoded;
+	for (auto& MODL : MSH2->Children)
+	{
+		Chunk* GEOM = MODL.Header == "MODL" ? FindChild(MODL, "GEOM") : nullptr;
+		if (GEOM == nullptr)
+			continue;
+
+		for (auto& SEGM : GEOM->Children)
+		{
+			Geometry Geo;
+			if (SEGM.Header != "SEGM" || !DecodeSegment(SEGM, Geo))
+				continue;
+
+			bool Usable = true;
+			for (auto& Extra : Geo.Extra)
+				Usable = Usable && Extra.first != "SHDW";
+			if (!Usable)
+				continue;
+
+			Targets.push_back(&SEGM);
+			Decoded.push_back(Geo);
+		}
+	}
+
+	std::vector<size_t> Removed(Targets.size(), 0);
+	{
+		ThreadPool Pool(std::thread::hardware_concurrency());
+		for (size_t S = 0; S < Targets.size(); S++)
+			Pool.Submit([&, S] { Removed.at(S) = Decoded.at(S).Weld(PositionTolerance, NormalTolerance, UVTolerance, ColorTolerance); });
+	}
+
+	size_t Before = 0;
+	size_t After = 0;
+	size_t Welded = 0;
+	for (size_t S = 0; S < Targets.size(); S++)
+	{
+		Before += Decoded.at(S).Vertices.size() + Removed.at(S);
+		After += Decoded.at(S).Vertices.size();
+		if (Removed.at(S) == 0)
+			continue;
+
+		if (EncodeSegment(Decoded.at(S), *Targets.at(S)))
+			Welded++;
+	}
+
+	std::cout << "\n Weld: " << FileName << ": " << Welded << " of " << Targets.size() << " segment(s) welded, "
+		<< Before << " -> " << After << " vertices";
+
+	if (Welded > 0)
+		RebuildMSH(Tree);
+}
+
+// Adds a hidden _lowrez copy of every visible static model, simplified to Ratio of its triangles
+inline void MSH::GenerateLOD(float Ratio)
+{
+	if (!(Ratio > 0.0f && Ratio < 1.0f))
+	{
+		std::cout << "\n GenerateLOD: " << FileName << ": ratio must be between 0 and 1";
+		return;
+	}
+
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	std::vector<Chunk*> MODLs;
+	std::vector<std::string> Names;
+	uint32_t NextMNDX = 0;
+	for (auto& MODL : MSH2->Children)
+	{
+		if (MODL.Header != "MODL")
+			continue;
+
+		Chunk* Name = FindChild(MODL, "NAME");
+		Chunk* MNDX = FindChild(MODL, "MNDX");
+		MODLs.push_back(&MODL);
+		Names.push_back(Name ? GetChunkString(*Name) : std::string());
+		if (MNDX != nullptr)
+			NextMNDX = std::max(NextMNDX, GetChunkValue(*MNDX) + 1);
+	}
+	if (MODLs.size() != Models.size())
+		return;
+
+	// Visible, plain static models that don't have a _lowrez yet
+	std::vector<Chunk> LODs;
+	std::vector<Geometry> Decoded;
+	std::vector<std::pair<size_t, size_t>> Places;
+	for (size_t M = 0; M < Models.size(); M++)
+	{
+		const std::string& ModelName = Names.at(M);
+		bool IsLOD = ModelName.size() >= 7 && ModelName.compare(ModelName.size() - 7, 7, "_lowrez") == 0;
+		if (Models.at(M).MTYP != 4 || Models.at(M).FLGS || IsSpecialModel(Models.at(M).Name) || IsLOD
+			|| std::find(Names.begin(), Names.end(), ModelName + "_lowrez") != Names.end())
+			continue;
+
+		Chunk* GEOM = FindChild(*MODLs.at(M), "GEOM");
+		if (GEOM == nullptr || FindChild(*GEOM, "ENVL") != nullptr || FindChild(*GEOM, "CLTH") != nullptr)
+			continue;
+
+		// Same place in the hierarchy, hidden, with the next free MNDX
+		Chunk LOD = DetachChunk(*MODLs.at(M));
+		LOD.Children.erase(std::remove_if(LOD.Children.begin(), LOD.Children.end(), [](const Chunk& Child)
+			{ return Child.Header == "FLGS"; }), LOD.Children.end());
+
+		// FLGS goes before TRAN and the geometry
+		Chunk FLGS;
+		FLGS.Header = "FLGS";
+		SetChunkValue(FLGS, 1);
+
+		auto Place = std::find_if(LOD.Children.begin(), LOD.Children.end(), [](const Chunk& Child)
+			{ return Child.Header == "TRAN" || Child.Header == "GEOM" || Child.Header == "SWCI"; });
+		LOD.Children.insert(Place, FLGS);
+
+		if (Chunk* Name = FindChild(LOD, "NAME"))
+			SetChunkString(*Name, ModelName + "_lowrez");
+		if (Chunk* MNDX = FindChild(LOD, "MNDX"))
+			SetChunkValue(*MNDX, NextMNDX++);
+
+		LODs.push_back(LOD);
+		Chunk* LODGEOM = FindChild(LODs.back(), "GEOM");
+		for (size_t C = 0; C < LODGEOM->Children.size(); C++)
+		{
+			Geometry Geo;
+			if (LODGEOM->Children.at(C).Header == "SEGM" && DecodeSegment(LODGEOM->Children.at(C), Geo))
+			{
+				bool Usable = true;
+				for (auto& Extra : Geo.Extra)
+					Usable = Usable && Extra.first != "SHDW";
+
+				if (Usable)
+				{
+					Decoded.push_back(Geo);
+					Places.emplace_back(LODs.size() - 1, C);
+				}
+			}
+		}
+	}
+
+	size_t Before = 0;
+	for (auto& Geo : Decoded)
+		Before += Geo.Triangles.size() / 3;
+
+	{
+		ThreadPool Pool(std::thread::hardware_concurrency());
+		for (size_t S = 0; S < Decoded.size(); S++)
+			Pool.Submit([&Decoded, Ratio, S] { Decoded.at(S).Simplify(Ratio); });
+	}
+
+	size_t After = 0;
+	for (size_t S = 0; S < Decoded.size(); S++)
+	{
+		After += Decoded.at(S).Triangles.size() / 3;
+		EncodeSegment(Decoded.at(S), FindChild(LODs.at(Places.at(S).first), "GEOM")->Children.at(Places.at(S).second));
+	}
+
+	std::cout << "\n GenerateLOD: " << FileName << ": " << LODs.size() << " _lowrez model(s) added, "
+		<< Before << " -> " << After << " triangles";
+
+	if (LODs.empty())
+		return;
+
+	// The new models go after the last one
+	size_t Last = 0;
+	for (size_t C = 0; C < MSH2->Children.size(); C++)
+		if (MSH2->Children.at(C).Header == "MODL")
+			Last = C + 1;
+	MSH2->Children.insert(MSH2->Children.begin() + Last, LODs.begin(), LODs.end());
+
+	RebuildMSH(Tree);
+}
+
+// Cuts collision meshes down to Budget triangles per model, using the convex hull where it fits the mesh
+inline void MSH::SimplifyCollision(size_t Budget)
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr || Budget == 0)
+		return;
+
+	std::vector<Chunk*> Targets;
+	std::vector<Geometry> Decoded;
+	std::vector<size_t> Budgets;
+	std::vector<std::string> Owners;
+	for (auto& MODL : MSH2->Children)
+	{
+		Chunk* Name = MODL.Header == "MODL" ? FindChild(MODL, "NAME") : nullptr;
+		Chunk* GEOM = MODL.Header == "MODL" ? FindChild(MODL, "GEOM") : nullptr;
+		if (Name == nullptr || GEOM == nullptr || !IsCollisionModel(GetChunkString(*Name)))
+			continue;
+
+		std::vector<Chunk*> Segments;
+		std::vector<Geometry> Geos;
+		size_t Total = 0;
+		for (auto& SEGM : GEOM->Children)
+		{
+			Geometry Geo;
+			if (SEGM.Header != "SEGM" || !DecodeSegment(SEGM, Geo) || Geo.HasWeights)
+				continue;
+
+			Total += Geo.Triangles.size() / 3;
+			Segments.push_back(&SEGM);
+			Geos.push_back(Geo);
+		}
+
+		// The budget is shared between segments by their size
+		for (size_t S = 0; S < Segments.size(); S++)
+		{
+			Targets.push_back(Segments.at(S));
+			Budgets.push_back(std::max<size_t>(4, Budget * (Geos.at(S).Triangles.size() / 3) / std::max<size_t>(1, Total)));
+			Decoded.push_back(Geos.at(S));
+			Owners.push_back(GetChunkString(*Name));
+		}
+	}
+
+	std::vector<size_t> Before(Targets.size());
+	std::vector<bool> Hulled(Targets.size(), false);
+	{
+		ThreadPool Pool(std::thread::hardware_concurrency());
+		for (size_t S = 0; S < Targets.size(); S++)
+		{
+			Pool.Submit([&, S]
+			{
+				Geometry& Geo = Decoded.at(S);
+				size_t Count = Geo.Triangles.size() / 3;
+				Before.at(S) = Count;
+				if (Count <= Budgets.at(S))
+					return;
+
+				// A closed mesh that fills most of its hull is close enough to convex to be replaced by it
+				// (an open one has no volume to go by, so it's only simplified)
+				std::vector<uint32_t> Hull = Geo.IsClosed() ? Geometry::ConvexHull(Geo.Vertices) : std::vector<uint32_t>();
+				Geometry Shape = Geo;
+				Shape.Triangles = Hull;
+				double HullVolume = Shape.Volume();
+				if (!Hull.empty() && std::fabs(Geo.Volume()) >= 0.85 * HullVolume)
+				{
+					Shape.OptimizeVertexFetch();
+					std::vector<bool> Used(Shape.Vertices.size(), false);
+					for (uint32_t Index : Shape.Triangles)
+						Used.at(Index) = true;
+					while (!Shape.Vertices.empty() && !Used.at(Shape.Vertices.size() - 1))
+						Shape.Vertices.pop_back();
+					if (Shape.HasNormals)
+						Shape.ComputeNormals();
+
+					Geo = Shape;
+					Hulled.at(S) = true;
+				}
+
+				Count = Geo.Triangles.size() / 3;
+				if (Count > Budgets.at(S))
+					Geo.Simplify(float(Budgets.at(S)) / Count);
+			});
+		}
+	}
+
+	size_t Changed = 0;
+	for (size_t S = 0; S < Targets.size(); S++)
+	{
+		size_t After = Decoded.at(S).Triangles.size() / 3;
+		std::cout << "\n SimplifyCollision: " << Owners.at(S) << ": " << Before.at(S) << " -> " << After << " triangles"
+			<< (Hulled.at(S) ? " (convex hull)" : "");
+
+		if (After < Before.at(S) && EncodeSegment(Decoded.at(S), *Targets.at(S)))
+		{
+			Changed++;
+		}
+	}
+
+	std::cout << "\n SimplifyCollision: " << FileName << ": " << Changed << " of " << Targets.size() << " collision segment(s) simplified";
+
+	if (Changed > 0)
+		RebuildMSH(Tree);
+}
+
+// Replaces collision meshes with a p_ sphere, cylinder or box where one holds the mesh with at most
+// Tolerance (a fraction of the mesh volume) to spare
+inline void MSH::FitPrimitives(float Tolerance)
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	// Models are looked up by the MODL's position, so the two have to line up
+	std::vector<Chunk*> MODLs;
+	for (auto& Child : MSH2->Children)
+		if (Child.Header == "MODL")
+			MODLs.push_back(&Child);
+	if (MODLs.size() != Models.size())
+		return;
+
+	std::vector<long long> Parent = GetModelParents();
+	size_t Fitted = 0;
+	size_t Checked = 0;
+	for (size_t M = 0; M < MODLs.size(); M++)
+	{
+		Chunk& MODL = *MODLs.at(M);
+
+		// Collision meshes only, and not ones other models hang off (their name changes)
+		Chunk* Name = FindChild(MODL, "NAME");
+		Chunk* GEOM = FindChild(MODL, "GEOM");
+		if (Name == nullptr || GEOM == nullptr || FindChild(MODL, "SWCI") != nullptr || !IsCollisionModel(GetChunkString(*Name))
+			|| std::find(Parent.begin(), Parent.end(), static_cast<long long>(M)) != Parent.end())
+			continue;
+
+		// Fitted in the parent's space, so the primitive's TRAN is just its center and rotation
+		// All segments together, as a mesh may only close up across them
+		Matrix Local = GetLocalTransform(M);
+		Geometry Whole;
+		bool Usable = true;
+		for (auto& SEGM : GEOM->Children)
+		{
+			Geometry Geo;
+			if (SEGM.Header != "SEGM")
+				continue;
+			Usable = Usable && DecodeSegment(SEGM, Geo);
+
+			uint32_t Base = static_cast<uint32_t>(Whole.Vertices.size());
+			Whole.Vertices.insert(Whole.Vertices.end(), Geo.Vertices.begin(), Geo.Vertices.end());
+			for (uint32_t Index : Geo.Triangles)
+				Whole.Triangles.push_back(Index + Base);
+		}
+		Whole.Transform(Local);
+
+		// Open meshes have no volume to compare against
+		double MeshVolume = Usable && Whole.IsClosed() ? Whole.Volume() : 0.0;
+		if (MeshVolume <= 0.0)
+			continue;
+
+		std::vector<std::array<float, 3>> Points;
+		for (auto& V : Whole.Vertices)
+			Points.push_back({ V.Position[0], V.Position[1], V.Position[2] });
+		Checked++;
+
+		std::vector<Primitive> Fits = Primitive::Fit(Points);
+		const Primitive& Best = Fits.front();
+		double Spare = Best.Volume() / MeshVolume - 1.0;
+
+		const char* Shapes[] = { "sphere", "", "cylinder", "", "box" };
+		std::cout << "\n FitPrimitives: " << GetChunkString(*Name) << ": " << Shapes[Best.Type] << " with "
+			<< std::fixed << std::setprecision(1) << Spare * 100.0 << std::defaultfloat << "% spare volume";
+		if (Spare > Tolerance)
+		{
+			std::cout << ", kept as a mesh";
+			continue;
+		}
+
+		// The primitive takes the model's place, MNDX and parent, and keeps it hidden
+		Chunk Fit;
+		Fit.Header = "MODL";
+		for (auto& Child : MODL.Children)
+		{
+			if (Child.Header == "MTYP")
+			{
+				Chunk MTYP = DetachChunk(Child);
+				SetChunkValue(MTYP, 0);
+				Fit.Children.push_back(MTYP);
+			}
+			else if (Child.Header == "NAME")
+			{
+				std::string Old = GetChunkString(Child);
+				Chunk NAME = DetachChunk(Child);
+				SetChunkString(NAME, Old.compare(0, 2, "p_") == 0 ? Old : "p_" + Old);
+				Fit.Children.push_back(NAME);
+			}
+			else if (Child.Header == "MNDX" || Child.Header == "PRNT")
+				Fit.Children.push_back(DetachChunk(Child));
+		}
+
+		Chunk FLGS;
+		FLGS.Header = "FLGS";
+		SetChunkValue(FLGS, 1);
+		Fit.Children.push_back(FLGS);
+
+		float Transform[10] = { 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, Best.Center[0], Best.Center[1], Best.Center[2] };
+		Best.Rotation(Transform + 3);
+		Chunk NewTRAN;
+		NewTRAN.Header = "TRAN";
+		NewTRAN.Payload.assign(reinterpret_cast<unsigned char*>(Transform), reinterpret_cast<unsigned char*>(Transform) + sizeof(Transform));
+		NewTRAN.Size = static_cast<uint32_t>(NewTRAN.Payload.size());
+		NewTRAN.Owned = true;
+		Fit.Children.push_back(NewTRAN);
+
+		Chunk SWCI;
+		SWCI.Header = "SWCI";
+		SetChunkValue(SWCI, Best.Type);
+		for (size_t S = 0; S < 3; S++)
+		{
+			uint32_t Bits = 0;
+			std::memcpy(&Bits, &Best.Size[S], 4);
+			SetChunkValue(SWCI, Bits, 4 + 4 * S);
+		}
+		Fit.Children.push_back(SWCI);
+
+		MODL = Fit;
+		Fitted++;
+	}
+
+	std::cout << "\n FitPrimitives: " << FileName << ": " << Fitted << " of " << Checked << " collision mesh(es) replaced by primitives";
+
+	if (Fitted > 0)
+		RebuildMSH(Tree);
+}
+
+// Welds, closes and flattens every shadow volume model (sv_, shadowvolume or MTYP 6), segments in parallel
+inline void MSH::OptimizeShadows()
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	std::vector<Chunk*> Targets;
+	std::vector<Geometry> Decoded;
+	std::vector<std::string> Owners;
+	size_t Skipped = 0;
+	for (auto& MODL : MSH2->Children)
+	{
+		Chunk* Name = MODL.Header == "MODL" ? FindChild(MODL, "NAME") : nullptr;
+		Chunk* MTYP = MODL.Header == "MODL" ? FindChild(MODL, "MTYP") : nullptr;
+		Chunk* GEOM = MODL.Header == "MODL" ? FindChild(MODL, "GEOM") : nullptr;
+		if (Name == nullptr || GEOM == nullptr || !(IsShadowModel(GetChunkString(*Name)) || (MTYP && GetChunkValue(*MTYP) == 6)))
+			continue;
+
+		for (auto& SEGM : GEOM->Children)
+		{
+			Geometry Geo;
+			if (SEGM.Header != "SEGM" || !DecodeSegment(SEGM, Geo) || Geo.HasWeights)
+				continue;
+
+			// Shadow data may index the vertices, and welding renumbers them
+			bool Usable = true;
+			for (auto& Extra : Geo.Extra)
+				Usable = Usable && Extra.first != "SHDW";
+			if (!Usable)
+			{
+				std::cout << "\n OptimizeShadows: " << GetChunkString(*Name) << ": segment has SHDW data, left as it is";
+				Skipped++;
+				continue;
+			}
+
+			Targets.push_back(&SEGM);
+			Decoded.push_back(Geo);
+			Owners.push_back(GetChunkString(*Name));
+		}
+	}
+
+	// Triangles, open edges and silhouette candidates before and after
+	std::vector<std::array<size_t, 6>> Counts(Targets.size());
+	{
+		ThreadPool Pool(std::thread::hardware_concurrency());
+		for (size_t S = 0; S < Targets.size(); S++)
+		{
+			Pool.Submit([&Decoded, &Counts, S]
+			{
+				Geometry& Geo = Decoded.at(S);
+				Geometry Probe = Geo;
+				Counts.at(S)[0] = Geo.Triangles.size() / 3;
+				Counts.at(S)[1] = Probe.CloseHoles(SIZE_MAX);
+				Counts.at(S)[2] = Geo.SilhouetteEdges();
+
+				Geo.OptimizeShadowVolume(16);
+
+				Probe = Geo;
+				Counts.at(S)[3] = Geo.Triangles.size() / 3;
+				Counts.at(S)[4] = Probe.CloseHoles(SIZE_MAX);
+				Counts.at(S)[5] = Geo.SilhouetteEdges();
+			});
+		}
+	}
+
+	for (size_t S = 0; S < Targets.size(); S++)
+	{
+		std::array<size_t, 6>& C = Counts.at(S);
+		std::cout << "\n OptimizeShadows: " << Owners.at(S) << ": " << C[0] << " -> " << C[3] << " triangles, "
+			<< C[1] << " -> " << C[4] << " holes, " << C[2] << " -> " << C[5] << " silhouette edges";
+		EncodeSegment(Decoded.at(S), *Targets.at(S));
+	}
+
+	std::cout << "\n OptimizeShadows: " << FileName << ": " << Targets.size() << " shadow segment(s) optimized";
+	if (Skipped > 0)
+		std::cout << ", " << Skipped << " with SHDW data skipped";
+
+	if (!Targets.empty())
+		RebuildMSH(Tree);
+}
+
+// Adds a hidden sv_ shadow volume, simplified to Ratio of the triangles, for each visible static model without one
+inline void MSH::GenerateShadows(float Ratio)
+{
+	if (!(Ratio > 0.0f && Ratio <= 1.0f))
+	{
+		std::cout << "\n GenerateShadows: " << FileName << ": ratio must be above 0 and at most 1";
+		return;
+	}
+
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	std::vector<std::string> Names;
+	uint32_t NextMNDX = 0;
+	for (auto& MODL : MSH2->Children)
+	{
+		if (MODL.Header != "MODL")
+			continue;
+
+		Chunk* Name = FindChild(MODL, "NAME");
+		Chunk* MNDX = FindChild(MODL, "MNDX");
+		Names.push_back(Name ? GetChunkString(*Name) : std::string());
+		if (MNDX != nullptr)
+			NextMNDX = std::max(NextMNDX, GetChunkValue(*MNDX) + 1);
+	}
+
+	// One shadow mesh per model, from all of its segments
+	std::vector<Chunk> Shadows;
+	std::vector<Geometry> Decoded;
+	size_t Model = 0;
+	for (auto& MODL : MSH2->Children)
+	{
+		if (MODL.Header != "MODL")
+			continue;
+		size_t M = Model++;
+
+		const std::string& ModelName = Names.at(M);
+		Chunk* GEOM = FindChild(MODL, "GEOM");
+		if (Models.at(M).MTYP != 4 || Models.at(M).FLGS || IsSpecialModel(Models.at(M).Name) || GEOM == nullptr
+			|| FindChild(*GEOM, "ENVL") != nullptr || FindChild(*GEOM, "CLTH") != nullptr
+			|| std::find(Names.begin(), Names.end(), "sv_" + ModelName) != Names.end())
+			continue;
+
+		Geometry Shape;
+		bool First = true;
+		for (auto& SEGM : GEOM->Children)
+		{
+			Geometry Geo;
+			if (SEGM.Header != "SEGM" || !DecodeSegment(SEGM, Geo))
+				continue;
+
+			if (First)
+			{
+				Shape.MATI = Geo.MATI;
+				Shape.HasNormals = true;
+				Shape.HasNDXL = Geo.HasNDXL;
+				Shape.HasNDXT = Geo.HasNDXT;
+				Shape.HasSTRP = Geo.HasSTRP && Geo.Vertices.size() <= Geometry::MaxVertices;
+				First = false;
+			}
+
+			uint32_t Base = static_cast<uint32_t>(Shape.Vertices.size());
+			Shape.Vertices.insert(Shape.Vertices.end(), Geo.Vertices.begin(), Geo.Vertices.end());
+			for (uint32_t Index : Geo.Triangles)
+				Shape.Triangles.push_back(Index + Base);
+		}
+		if (First || Shape.Triangles.empty())
+			continue;
+
+		// Same place in the hierarchy, MTYP 6, hidden, with the next free MNDX (given once it's known to fit)
+		Chunk Shadow;
+		Shadow.Header = "MODL";
+		for (auto& Child : MODL.Children)
+			if (Child.Header != "FLGS" && Child.Header != "GEOM")
+				Shadow.Children.push_back(DetachChunk(Child));
+
+		// FLGS goes before TRAN and the geometry
+		Chunk FLGS;
+		FLGS.Header = "FLGS";
+		SetChunkValue(FLGS, 1);
+
+		auto Place = std::find_if(Shadow.Children.begin(), Shadow.Children.end(), [](const Chunk& Child)
+			{ return Child.Header == "TRAN" || Child.Header == "GEOM" || Child.Header == "SWCI"; });
+		Shadow.Children.insert(Place, FLGS);
+
+		if (Chunk* MTYP = FindChild(Shadow, "MTYP"))
+			SetChunkValue(*MTYP, 6);
+		if (Chunk* Name = FindChild(Shadow, "NAME"))
+			SetChunkString(*Name, "sv_" + ModelName);
+
+		// The render model's BBOX still holds the shadow
+		Chunk NewGEOM;
+		NewGEOM.Header = "GEOM";
+		if (Chunk* BBOX = FindChild(*GEOM, "BBOX"))
+			NewGEOM.Children.push_back(DetachChunk(*BBOX));
+		Shadow.Children.push_back(NewGEOM);
+
+		Shadows.push_back(Shadow);
+		Decoded.push_back(Shape);
+	}
+
+	size_t Before = 0;
+	for (auto& Geo : Decoded)
+		Before += Geo.Triangles.size() / 3;
+
+	{
+		ThreadPool Pool(std::thread::hardware_concurrency());
+		for (size_t S = 0; S < Decoded.size(); S++)
+		{
+			Pool.Submit([&Decoded, Ratio, S]
+			{
+				Geometry& Geo = Decoded.at(S);
+				size_t Count = Geo.Triangles.size() / 3;
+				Geo.OptimizeShadowVolume(16);
+				if (Geo.Triangles.size() / 3 > Count * Ratio)
+					Geo.Simplify(Count * Ratio / (Geo.Triangles.size() / 3));
+			});
+		}
+	}
+
+	// Cleaning up welds the segments of a model together, but a shadow that still has too many vertices to index is left out
+	size_t After = 0;
+	size_t Skipped = 0;
+	std::vector<Chunk> Added;
+	for (size_t S = 0; S < Shadows.size(); S++)
+	{
+		Decoded.at(S).HasSTRP = Decoded.at(S).HasSTRP && Decoded.at(S).Vertices.size() <= Geometry::MaxVertices;
+
+		Chunk SEGM;
+		if (!EncodeSegment(Decoded.at(S), SEGM))
+		{
+			Chunk* Name = FindChild(Shadows.at(S), "NAME");
+			std::cout << "\n GenerateShadows: " << (Name ? GetChunkString(*Name) : std::string()) << ": "
+				<< Decoded.at(S).Vertices.size() << " vertices are more than 16 bit indices reach, skipped";
+			Skipped++;
+			continue;
+		}
+
+		FindChild(Shadows.at(S), "GEOM")->Children.push_back(SEGM);
+		if (Chunk* MNDX = FindChild(Shadows.at(S), "MNDX"))
+			SetChunkValue(*MNDX, NextMNDX++);
+		After += Decoded.at(S).Triangles.size() / 3;
+		Added.push_back(Shadows.at(S));
+	}
+
+	std::cout << "\n GenerateShadows: " << FileName << ": " << Added.size() << " sv_ model(s) added, "
+		<< Before << " -> " << After << " triangles";
+	if (Skipped > 0)
+		std::cout << ", " << Skipped << " skipped for exceeding 16 bit indices";
+
+	if (Added.empty())
+		return;
+
+	size_t Last = 0;
+	for (size_t C = 0; C < MSH2->Children.size(); C++)
+		if (MSH2->Children.at(C).Header == "MODL")
+			Last = C + 1;
+	MSH2->Children.insert(MSH2->Children.begin() + Last, Added.begin(), Added.end());
+
+	RebuildMSH(Tree);
+}
+
+// Returns the render cost of each model
+inline std::vector<RenderStats> MSH::GetRenderStats()
+{
+	std::vector<RenderStats> Stats;
+	Chunk* MSH2 = Chunks.empty() ? nullptr : FindChild(Chunks.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return Stats;
+
+	for (auto& MODL : MSH2->Children)
+	{
+		if (MODL.Header != "MODL")
+			continue;
+
+		Stats.emplace_back();
+		RenderStats& Model = Stats.back();
+		Chunk* Name = FindChild(MODL, "NAME");
+		Chunk* FLGS = FindChild(MODL, "FLGS");
+		Chunk* GEOM = FindChild(MODL, "GEOM");
+		Model.Name = Name ? GetChunkString(*Name) : std::string();
+		if (GEOM == nullptr)
+			continue;
+
+		bool Drawn = !(FLGS && (GetChunkValue(*FLGS) & 1)) && !IsCollisionModel(Model.Name);
+		for (auto& SEGM : GEOM->Children)
+		{
+			Geometry Geo;
+			if (SEGM.Header != "SEGM" || !DecodeSegment(SEGM, Geo))
+				continue;
+
+			size_t Count = Geo.Vertices.size();
+			size_t Triangles = Geo.Triangles.size() / 3;
+			Model.Segments++;
+			Model.DrawCalls += Drawn ? 1 : 0;
+			Model.Vertices += Count;
+			Model.Triangles += Triangles;
+			// Measured on the strips when there are some, as that's what gets drawn (and what IndexBytes counts)
+			Model.CacheMisses += static_cast<size_t>(Geo.DrawnCacheMissRatio() * Triangles + 0.5f);
+
+			// Sizes as the lists are stored: POSL and NRML 12 bytes, UV0L 8, CLRL 4 and WGHT 32 per vertex
+			Model.ColorBytes += Geo.HasColors ? 4 * Count : 0;
+			Model.WeightBytes += Geo.HasWeights ? 32 * Count : 0;
+			Model.VertexBytes += 12 * Count + (Geo.HasNormals ? 12 * Count : 0) + (Geo.HasUVs ? 8 * Count : 0)
+				+ (Geo.HasColors ? 4 * Count : 0) + (Geo.HasWeights ? 32 * Count : 0);
+
+			Chunk* STRP = FindChild(SEGM, "STRP");
+			Model.IndexBytes += STRP ? 2 * size_t(GetChunkValue(*STRP)) : 6 * Triangles;
+		}
+	}
+
+	return Stats;
+}
+
+// Prints the render cost of each model and of the whole file
+inline void MSH::PrintStats()
+{
+	RenderStats Total;
+	Total.Name = "TOTAL";
+
+	std::cout << "\n Stats: " << FileName << "\n" << RenderStats::Heading();
+	for (auto& Model : GetRenderStats())
+	{
+		std::cout << "\n" << Model.Row();
+		Total.Add(Model);
+	}
+	std::cout << "\n" << Total.Row();
+}
+
+// Returns every byte of the file attributed to the chunk path holding it
+inline SizeReport MSH::GetSizeReport()
+{
+	CommitEdits();
+
+	SizeReport Report;
+	Report.Total = Size;
+	Report.Files = 1;
+
+	uint64_t Attributed = 0;
+	for (auto& C : Chunks)
+		Attributed += AttributeBytes(C, "", Report);
+
+	// Trailing bytes too short to be a chunk
+	if (Attributed < Size)
+	{
+		Report.Paths["(unattributed)"].first += Size - Attributed;
+		Report.Paths["(unattributed)"].second++;
+	}
+
+	return Report;
+}
+
+// Adds the bytes of C (under Parent) to Report, returns all the bytes it spans
+inline uint64_t MSH::AttributeBytes(const Chunk& C, const std::string& Parent, SizeReport& Report)
+{
+	// Headers come straight from the file, so keep them from breaking the path or the folded stacks
+	std::string Header = C.Header;
+	for (char& ch : Header)
+		if (!std::isgraph(static_cast<unsigned char>(ch)) || ch == '/' || ch == ';')
+			ch = '?';
+
+	std::string Path = Parent.empty() ? Header : Parent + "/" + Header;
+
+	// Header and size, then the payload as far as the file goes
+	uint64_t Bytes = 8 + std::min(static_cast<uint64_t>(C.Size), static_cast<uint64_t>(Size - std::min(Size, C.Position + 4)));
+
+	uint64_t Children = 0;
+	for (auto& Child : C.Children)
+		Children += AttributeBytes(Child, Path, Report);
+
+	Report.Paths[Path].first += Bytes - std::min(Children, Bytes);
+	Report.Paths[Path].second++;
+	return Bytes;
+}
+
+// Prints where the bytes of the file go and writes them as folded stacks to FoldedFile (if given)
+inline void MSH::PrintSizeReport(const std::string& FoldedFile)
+{
+	SizeReport Report = GetSizeReport();
+	std::cout << "\n Size report: " << FileName << "\n" << Report.Table();
+
+	if (FoldedFile.empty())
+		return;
+
+	std::ofstream Out(FoldedFile, std::ios::out | std::ios::binary);
+	if (!Out.is_open())
+	{
+		std::cout << "\n Could not write " << FoldedFile << "!";
+		return;
+	}
+
+	Out << Report.Folded();
+	std::cout << "\n Folded stacks written to " << FoldedFile;
+}
+
+// Numbers the MODLs of MSH2 from 1 in file order and points ENVL at the new numbers
+inline void MSH::RenumberModels(Chunk& MSH2)
+{
+	std::unordered_map<uint32_t, uint32_t> Reindexed;
+	uint32_t Next = 1;
+	for (auto& MODL : MSH2.Children)
+	{
+		if (MODL.Header != "MODL")
+			continue;
+
+		if (Chunk* MNDX = FindChild(MODL, "MNDX"))
+		{
+			Reindexed.emplace(GetChunkValue(*MNDX), Next);
+			*MNDX = DetachChunk(*MNDX);
+			SetChunkValue(*MNDX, Next);
+		}
+		Next++;
+	}
+
+	for (auto& MODL : MSH2.Children)
+	{
+		Chunk* GEOM = MODL.Header == "MODL" ? FindChild(MODL, "GEOM") : nullptr;
+		Chunk* ENVL = GEOM ? FindChild(*GEOM, "ENVL") : nullptr;
+		if (ENVL == nullptr)
+			continue;
+
+		// Count, then the MNDX of each envelope model
+		*ENVL = DetachChunk(*ENVL);
+		uint32_t Count = GetChunkValue(*ENVL);
+		for (uint32_t E = 0; E < Count && 8 + 4 * size_t(E) <= ENVL->Payload.size(); E++)
+		{
+			auto Index = Reindexed.find(GetChunkValue(*ENVL, 4 + 4 * size_t(E)));
+			if (Index != Reindexed.end())
+				SetChunkValue(*ENVL, Index->second, 4 + 4 * size_t(E));
+		}
+	}
+}
+
+// Returns the first model kept in MSH2 that is skinned to a Removed one, -1 if there's none
+inline long long MSH::FindSkinnedToRemoved(Chunk& MSH2, const std::vector<char>& Removed)
+{
+	std::vector<uint32_t> RemovedMNDX;
+	size_t M = 0;
+	for (auto& MODL : MSH2.Children)
+		if (MODL.Header == "MODL" && Removed.at(M++))
+			if (Chunk* MNDX = FindChild(MODL, "MNDX"))
+				RemovedMNDX.push_back(GetChunkValue(*MNDX));
+
+	M = 0;
+	for (auto& MODL : MSH2.Children)
+	{
+		if (MODL.Header != "MODL" || Removed.at(M++))
+			continue;
+
+		Chunk* GEOM = FindChild(MODL, "GEOM");
+		Chunk* ENVL = GEOM ? FindChild(*GEOM, "ENVL") : nullptr;
+		if (ENVL == nullptr)
+			continue;
+
+		for (uint32_t E = 0; E < GetChunkValue(*ENVL); E++)
+			if (std::find(RemovedMNDX.begin(), RemovedMNDX.end(), GetChunkValue(*ENVL, 4 + 4 * size_t(E))) != RemovedMNDX.end())
+				return static_cast<long long>(M - 1);
+	}
+
+	return -1;
+}
+
+// Removes a model and everything under it, renumbering MNDX (and ENVL) of the rest
+inline void MSH::RemoveSubtree(size_t Root)
+{
+	CommitEdits();
+	if (Root >= Models.size())
+	{
+		std::cout << "\n RemoveSubtree: " << FileName << ": there is no model " << Root;
+		return;
+	}
+
+	std::vector<size_t> Subtree = Graph.Subtree(Root);
+	if (Subtree.size() == Models.size())
+	{
+		std::cout << "\n RemoveSubtree: " << FileName << ": can't remove every model";
+		return;
+	}
+
+	std::vector<char> Removed(Models.size(), 0);
+	for (size_t M : Subtree)
+		Removed.at(M) = 1;
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	// Skins that stay can't lose their bones
+	long long Skinned = FindSkinnedToRemoved(*MSH2, Removed);
+	if (Skinned != -1)
+	{
+		std::cout << "\n RemoveSubtree: " << FileName << ": " << GetModelName(static_cast<size_t>(Skinned))
+			<< " is skinned to a model under " << GetModelName(Root) << ", nothing removed";
+		return;
+	}
+
+	std::vector<Chunk> Kept;
+	size_t M = 0;
+	for (auto& C : MSH2->Children)
+		if (C.Header != "MODL" || !Removed.at(M++))
+			Kept.push_back(C);
+	MSH2->Children = Kept;
+
+	RenumberModels(*MSH2);
+
+	std::cout << "\n RemoveSubtree: " << FileName << ": " << GetModelName(Root) << " and "
+		<< Subtree.size() - 1 << " model(s) under it removed";
+
+	RebuildMSH(Tree);
+}
+
+// Removes one model, moving its children up to its parent, renumbering MNDX (and ENVL) of the rest
+inline void MSH::RemoveModel(size_t Selected)
+{
+	CommitEdits();
+	if (Selected >= Models.size())
+	{
+		std::cout << "\n RemoveModel: " << FileName << ": there is no model " << Selected;
+		return;
+	}
+
+	if (Models.size() == 1)
+	{
+		std::cout << "\n RemoveModel: " << FileName << ": can't remove the only model";
+		return;
+	}
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	std::vector<Chunk*> MODLs;
+	for (auto& Child : MSH2->Children)
+		if (Child.Header == "MODL")
+			MODLs.push_back(&Child);
+	if (MODLs.size() != Models.size())
+		return;
+
+	// Skins that stay can't lose their bones
+	std::vector<char> Removed(Models.size(), 0);
+	Removed.at(Selected) = 1;
+	long long Skinned = FindSkinnedToRemoved(*MSH2, Removed);
+	if (Skinned != -1)
+	{
+		std::cout << "\n RemoveModel: " << FileName << ": " << GetModelName(static_cast<size_t>(Skinned))
+			<< " is skinned to " << GetModelName(Selected) << ", nothing removed";
+		return;
+	}
+
+	// Children move up to the parent of the removed model (or become roots)
+	long long Parent = Graph.Parents.at(Selected);
+	for (size_t Child : Graph.Children.at(Selected))
+	{
+		Chunk& MODL = *MODLs.at(Child);
+		MODL.Children.erase(std::remove_if(MODL.Children.begin(), MODL.Children.end(),
+			[](const Chunk& C) { return C.Header == "PRNT"; }), MODL.Children.end());
+
+		if (Parent != -1)
+		{
+			Chunk PRNT;
+			PRNT.Header = "PRNT";
+			SetChunkString(PRNT, GetModelName(static_cast<size_t>(Parent)));
+
+			auto Name = std::find_if(MODL.Children.begin(), MODL.Children.end(), [](const Chunk& C) { return C.Header == "NAME"; });
+			MODL.Children.insert(Name == MODL.Children.end() ? Name : Name + 1, PRNT);
+		}
+	}
+
+	std::string Name = GetModelName(Selected);
+	size_t Moved = Graph.Children.at(Selected).size();
+
+	std::vector<Chunk> Kept;
+	size_t M = 0;
+	for (auto& C : MSH2->Children)
+		if (C.Header != "MODL" || M++ != Selected)
+			Kept.push_back(C);
+	MSH2->Children = Kept;
+
+	RenumberModels(*MSH2);
+
+	std::cout << "\n RemoveModel: " << FileName << ": " << Name << " removed, " << Moved << " child model(s) moved up";
+
+	RebuildMSH(Tree);
+}
+
+// Moves a model and everything under it to a new parent (-1 for a root), keeping parents before children in the file
+inline void MSH::ReparentSubtree(size_t Root, long long NewParent)
+{
+	CommitEdits();
+	if (Root >= Models.size() || NewParent >= static_cast<long long>(Models.size()) || NewParent < -1)
+	{
+		std::cout << "\n ReparentSubtree: " << FileName << ": there is no such model";
+		return;
+	}
+
+	if (NewParent != -1 && Graph.IsDescendant(static_cast<size_t>(NewParent), Root))
+	{
+		std::cout << "\n ReparentSubtree: " << FileName << ": " << GetModelName(Root) << " can't go under itself";
+		return;
+	}
+
+	std::vector<size_t> Subtree = Graph.Subtree(Root);
+	std::vector<char> Moving(Models.size(), 0);
+	for (size_t M : Subtree)
+		Moving.at(M) = 1;
+
+	// The subtree goes after the last model of the new parent's hierarchy (or after the last model for a root)
+	long long After = -1;
+	if (NewParent != -1)
+	{
+		for (size_t M : Graph.Subtree(static_cast<size_t>(NewParent)))
+			if (!Moving.at(M))
+				After = std::max(After, static_cast<long long>(M));
+	}
+	else
+	{
+		for (size_t M = 0; M < Models.size(); M++)
+			if (!Moving.at(M))
+				After = static_cast<long long>(M);
+	}
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	std::vector<Chunk> Moved;
+	std::vector<Chunk> Rest;
+	size_t M = 0;
+	for (auto& C : MSH2->Children)
+	{
+		if (C.Header != "MODL")
+		{
+			Rest.push_back(C);
+			continue;
+		}
+
+		if (!Moving.at(M))
+			Rest.push_back(C);
+		else
+		{
+			Moved.push_back(C);
+
+			// Only the root of the subtree changes parent, PRNT goes right after NAME
+			if (M == Root)
+			{
+				Chunk& MODL = Moved.back();
+				MODL.Children.erase(std::remove_if(MODL.Children.begin(), MODL.Children.end(),
+					[](const Chunk& Child) { return Child.Header == "PRNT"; }), MODL.Children.end());
+
+				if (NewParent != -1)
+				{
+					Chunk PRNT;
+					PRNT.Header = "PRNT";
+					SetChunkString(PRNT, GetModelName(static_cast<size_t>(NewParent)));
+
+					auto Name = std::find_if(MODL.Children.begin(), MODL.Children.end(), [](const Chunk& Child) { return Child.Header == "NAME"; });
+					MODL.Children.insert(Name == MODL.Children.end() ? Name : Name + 1, PRNT);
+				}
+			}
+		}
+		M++;
+	}
+
+	MSH2->Children.clear();
+	M = 0;
+	bool Placed = false;
+	for (auto& C : Rest)
+	{
+		MSH2->Children.push_back(C);
+		if (C.Header != "MODL")
+			continue;
+
+		while (M < Models.size() && Moving.at(M))
+			M++;
+		if (static_cast<long long>(M++) == After)
+		{
+			MSH2->Children.insert(MSH2->Children.end(), Moved.begin(), Moved.end());
+			Placed = true;
+		}
+	}
+
+	// Nothing else left to go after (the subtree was the whole file)
+	if (!Placed)
+		MSH2->Children.insert(MSH2->Children.end(), Moved.begin(), Moved.end());
+
+	RenumberModels(*MSH2);
+
+	std::cout << "\n ReparentSubtree: " << FileName << ": " << GetModelName(Root) << " and " << Subtree.size() - 1
+		<< " model(s) under it moved " << (NewParent != -1 ? "under " + GetModelName(static_cast<size_t>(NewParent)) : "to the top");
+
+	RebuildMSH(Tree);
+}
+
+// Hides a model and everything under it
+inline void MSH::HideSubtree(size_t Root)
+{
+	CommitEdits();
+	if (Root >= Models.size())
+	{
+		std::cout << "\n HideSubtree: " << FileName << ": there is no model " << Root;
+		return;
+	}
+
+	std::vector<char> Hiding(Models.size(), 0);
+	for (size_t M : Graph.Subtree(Root))
+		Hiding.at(M) = 1;
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	size_t Hidden = 0;
+	size_t M = 0;
+	for (auto& MODL : MSH2->Children)
+	{
+		if (MODL.Header != "MODL" || !Hiding.at(M++))
+			continue;
+
+		if (Chunk* Existing = FindChild(MODL, "FLGS"))
+		{
+			uint32_t Flags = GetChunkValue(*Existing);
+			if (Flags & 1)
+				continue;
+
+			*Existing = DetachChunk(*Existing);
+			SetChunkValue(*Existing, Flags | 1);
+		}
+		else
+		{
+			// FLGS goes before TRAN and the geometry
+			Chunk FLGS;
+			FLGS.Header = "FLGS";
+			SetChunkValue(FLGS, 1);
+
+			auto Place = std::find_if(MODL.Children.begin(), MODL.Children.end(), [](const Chunk& Child)
+				{ return Child.Header == "TRAN" || Child.Header == "GEOM" || Child.Header == "SWCI"; });
+			MODL.Children.insert(Place, FLGS);
+		}
+		Hidden++;
+	}
+
+	std::cout << "\n HideSubtree: " << FileName << ": " << Hidden << " model(s) under " << GetModelName(Root) << " hidden";
+
+	if (Hidden > 0)
+		RebuildMSH(Tree);
+}
+
+// CRC of a name the way skeleton and animation chunks refer to models (lower case, polynomial 0x04C11DB7)
+inline uint32_t MSH::NameCRC(const std::string& Name)
+{
+	static const std::array<uint32_t, 256> Table = []
+	{
+		std::array<uint32_t, 256> T{};
+		for (uint32_t I = 0; I < 256; I++)
+		{
+			uint32_t CRC = I << 24;
+			for (int Bit = 0; Bit < 8; Bit++)
+				CRC = (CRC & 0x80000000u) ? (CRC << 1) ^ 0x04C11DB7u : CRC << 1;
+			T.at(I) = CRC;
+		}
+		return T;
+	}();
+
+	uint32_t CRC = 0xFFFFFFFFu;
+	for (char ch : Name)
+		CRC = (CRC << 8) ^ Table.at(((CRC >> 24) ^ static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(ch)))) & 0xFF);
+
+	return ~CRC;
+}
+
+// Flags the models the skeleton, blend and animation chunks under HEDR refer to,
+// false if there are such chunks but they match no model (so it can't be told)
+inline bool MSH::GetAnimatedModels(const Chunk& HEDR, std::vector<char>& Animated)
+{
+	// Skeleton, blend and animation chunks refer to models by the CRC of their name
+	// Every word in them is taken as a possible CRC, which can only flag more models than needed
+	std::vector<uint32_t> Words;
+	std::vector<const Chunk*> Pending;
+	for (auto& C : HEDR.Children)
+		if (C.Header == "SKL2" || C.Header == "BLN2" || C.Header == "ANM2")
+			Pending.push_back(&C);
+	bool HasAnimation = !Pending.empty();
+
+	while (!Pending.empty())
+	{
+		const Chunk* C = Pending.back();
+		Pending.pop_back();
+		for (auto& Child : C->Children)
+			Pending.push_back(&Child);
+
+		std::string_view Payload = C->Children.empty() ? GetPayload(*C) : std::string_view();
+		for (size_t W = 0; W + 4 <= Payload.size(); W += 4)
+		{
+			uint32_t Word = 0;
+			std::memcpy(&Word, Payload.data() + W, 4);
+			Words.push_back(Word);
+		}
+	}
+	std::sort(Words.begin(), Words.end());
+
+	Animated.assign(Models.size(), 0);
+	bool AnyAnimated = false;
+	for (size_t M = 0; M < Models.size(); M++)
+	{
+		Animated.at(M) = std::binary_search(Words.begin(), Words.end(), NameCRC(GetModelName(M)));
+		AnyAnimated = AnyAnimated || Animated.at(M);
+	}
+
+	// Animation that matches no model at all means the names were hashed some other way
+	return !HasAnimation || AnyAnimated;
+}
+
+// Flags the models an ENVL refers to (the bones of the skins)
+inline std::vector<char> MSH::GetEnvelopedModels(const std::vector<Chunk*>& MODLs)
+{
+	std::vector<uint32_t> Bones;
+	for (auto* MODL : MODLs)
+		if (Chunk* GEOM = FindChild(*MODL, "GEOM"))
+			if (Chunk* ENVL = FindChild(*GEOM, "ENVL"))
+				for (uint32_t E = 0; E < GetChunkValue(*ENVL); E++)
+					Bones.push_back(GetChunkValue(*ENVL, 4 + 4 * size_t(E)));
+
+	std::vector<char> Enveloped(MODLs.size(), 0);
+	for (size_t M = 0; M < MODLs.size(); M++)
+		if (Chunk* MNDX = FindChild(*MODLs.at(M), "MNDX"))
+			Enveloped.at(M) = std::find(Bones.begin(), Bones.end(), GetChunkValue(*MNDX)) != Bones.end();
+
+	return Enveloped;
+}
+
+// Folds null models nothing refers to (by ENVL, animation or special name) into their children and removes them
+inline void MSH::Flatten()
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	std::vector<Chunk*> MODLs;
+	for (auto& Child : MSH2->Children)
+		if (Child.Header == "MODL")
+			MODLs.push_back(&Child);
+	if (MODLs.size() != Models.size())
+		return;
+
+	std::vector<char> Animated;
+	if (!GetAnimatedModels(Tree.front(), Animated))
+	{
+		std::cout << "\n Flatten: " << FileName << ": can't tell which models are animated, nothing folded";
+		return;
+	}
+	std::vector<char> Enveloped = GetEnvelopedModels(MODLs);
+
+	std::vector<long long> Parent = Graph.Parents;
+	std::vector<std::vector<size_t>> Children = Graph.Children;
+	std::vector<Matrix> Local(Models.size());
+	std::vector<std::array<float, 10>> NewTRAN(Models.size());
+	for (size_t M = 0; M < Models.size(); M++)
+		Local.at(M) = GetLocalTransform(M);
+
+	std::vector<char> Removed(Models.size(), 0);
+	std::vector<char> Moved(Models.size(), 0);
+	size_t Folded = 0;
+	size_t Kept = 0;
+
+	// Parents before children, so a chain of nulls folds down one at a time
+	for (size_t Root = 0; Root < Models.size(); Root++)
+	{
+		if (Graph.Parents.at(Root) != -1)
+			continue;
+
+		for (size_t M : Graph.Subtree(Root))
+		{
+			// Roots stay so each hierarchy keeps its root, and childless nulls may be looked up by name in game
+			if (Parent.at(M) == -1 || Children.at(M).empty() || Models.at(M).MTYP != 0 || FindChild(*MODLs.at(M), "GEOM") != nullptr
+				|| FindChild(*MODLs.at(M), "SWCI") != nullptr || Animated.at(M) || Enveloped.at(M) || IsSpecialModel(GetModelName(M)))
+				continue;
+
+			// Animated children are keyed relative to the null, and the combined transforms have to fit in a TRAN
+			bool Foldable = true;
+			std::vector<std::array<float, 10>> Combined(Children.at(M).size());
+			for (size_t C = 0; C < Children.at(M).size() && Foldable; C++)
+				Foldable = !Animated.at(Children.at(M).at(C)) && (Local.at(M) * Local.at(Children.at(M).at(C))).ToTRAN(Combined.at(C).data());
+
+			if (!Foldable)
+			{
+				Kept++;
+				continue;
+			}
+
+			size_t Up = static_cast<size_t>(Parent.at(M));
+			for (size_t C = 0; C < Children.at(M).size(); C++)
+			{
+				size_t Child = Children.at(M).at(C);
+				NewTRAN.at(Child) = Combined.at(C);
+				Local.at(Child) = Matrix::FromTRAN(Combined.at(C).data());
+				Parent.at(Child) = static_cast<long long>(Up);
+				Children.at(Up).push_back(Child);
+				Moved.at(Child) = 1;
+			}
+
+			Children.at(Up).erase(std::remove(Children.at(Up).begin(), Children.at(Up).end(), M), Children.at(Up).end());
+			Children.at(M).clear();
+			Removed.at(M) = 1;
+			Folded++;
+		}
+	}
+
+	std::cout << "\n Flatten: " << FileName << ": " << Folded << " null model(s) folded away, " << Kept
+		<< " kept (animated children or transforms a TRAN can't hold)";
+
+	if (Folded == 0)
+		return;
+
+	// Moved children get their new parent and transform, TRAN going before the geometry if they had none
+	for (size_t M = 0; M < Models.size(); M++)
+	{
+		if (!Moved.at(M) || Removed.at(M))
+			continue;
+
+		Chunk& MODL = *MODLs.at(M);
+		if (Chunk* PRNT = FindChild(MODL, "PRNT"))
+			SetChunkString(*PRNT, GetModelName(static_cast<size_t>(Parent.at(M))));
+
+		Chunk TRAN;
+		TRAN.Header = "TRAN";
+		TRAN.Payload.assign(reinterpret_cast<unsigned char*>(NewTRAN.at(M).data()), reinterpret_cast<unsigned char*>(NewTRAN.at(M).data()) + sizeof(float) * 10);
+		TRAN.Size = static_cast<uint32_t>(TRAN.Payload.size());
+		TRAN.Owned = true;
+
+		if (Chunk* Existing = FindChild(MODL, "TRAN"))
+			*Existing = TRAN;
+		else
+			MODL.Children.insert(std::find_if(MODL.Children.begin(), MODL.Children.end(), [](const Chunk& Child)
+				{ return Child.Header == "GEOM" || Child.Header == "SWCI"; }), TRAN);
+	}
+
+	std::vector<Chunk> Rest;
+	size_t M = 0;
+	for (auto& C : MSH2->Children)
+		if (C.Header != "MODL" || !Removed.at(M++))
+			Rest.push_back(C);
+	MSH2->Children = Rest;
+
+	RenumberModels(*MSH2);
+	RebuildMSH(Tree);
+}
+
+// Cuts every skinned vertex down to MaxInfluences bones of at least Epsilon (renormalized), then drops the
+// ENVL entries no vertex uses any more
+inline void MSH::LimitWeights(size_t MaxInfluences, float Epsilon)
+{
+	CommitEdits();
+
+	std::vector<Chunk> Tree = Chunks;
+	Chunk* MSH2 = Tree.empty() ? nullptr : FindChild(Tree.front(), "MSH2");
+	if (MSH2 == nullptr)
+		return;
+
+	// Every segment with weights, and the GEOM it belongs to
+	std::vector<Chunk*> GEOMs;
+	std::vector<Chunk*> SEGMs;
+	std::vector<size_t> Owner;
+	std::vector<Geometry> Decoded;
+	std::vector<char> Undecoded;
+	for (auto& MODL : MSH2->Children)
+	{
+		Chunk* GEOM = MODL.Header == "MODL" ? FindChild(MODL, "GEOM") : nullptr;
+		if (GEOM == nullptr)
+			continue;
+
+		bool Skinned = false;
+		bool Failed = false;
+		for (auto& SEGM : GEOM->Children)
+		{
+			Geometry Geo;
+			if (SEGM.Header != "SEGM" || FindChild(SEGM, "WGHT") == nullptr)
+				continue;
+
+			if (!DecodeSegment(SEGM, Geo) || !Geo.HasWeights)
+			{
+				Failed = true;
+				continue;
+			}
+
+			SEGMs.push_back(&SEGM);
+			Owner.push_back(GEOMs.size());
+			Decoded.push_back(Geo);
+			Skinned = true;
+		}
+
+		if (Skinned)
+		{
+			GEOMs.push_back(GEOM);
+			Undecoded.push_back(Failed);
+		}
+	}
+
+	std::vector<size_t> Changed(Decoded.size(), 0);
+	{
+		ThreadPool Pool(std::thread::hardware_concurrency());
+		for (size_t S = 0; S < Decoded.size(); S++)
+			Pool.Submit([&Decoded, &Changed, MaxInfluences, Epsilon, S] { Changed.at(S) = Decoded.at(S).LimitWeights(MaxInfluences, Epsilon); });
+	}
+
+	size_t Vertices = 0;
+	size_t Limited = 0;
+	size_t Dropped = 0;
+	size_t Rewritten = 0;
+	for (size_t G = 0; G < GEOMs.size(); G++)
+	{
+		// Which ENVL entries the weights that are left still use
+		Chunk* ENVL = FindChild(*GEOMs.at(G), "ENVL");
+		uint32_t Count = ENVL ? GetChunkValue(*ENVL) : 0;
+		std::vector<char> Used(Count, 0);
+		size_t ModelVertices = 0;
+		size_t ModelLimited = 0;
+		for (size_t S = 0; S < Decoded.size(); S++)
+		{
+			if (Owner.at(S) != G)
+				continue;
+
+			ModelVertices += Decoded.at(S).Vertices.size();
+			ModelLimited += Changed.at(S);
+			for (auto& V : Decoded.at(S).Vertices)
+				for (size_t W = 0; W < 4; W++)
+					if (V.Weights[W] > 0.0f && V.Bones[W] < Count)
+						Used.at(V.Bones[W]) = 1;
+		}
+
+		// Compact ENVL and point the weights at the new entries (empty slots at the first)
+		std::vector<uint32_t> Map(Count, 0);
+		uint32_t Next = 0;
+		for (uint32_t E = 0; E < Count; E++)
+			if (Used.at(E))
+				Map.at(E) = Next++;
+
+		// Weights we couldn't decode may still use any entry, so ENVL stays as it is
+		bool Compacted = Next > 0 && Next < Count && !Undecoded.at(G);
+		if (Compacted)
+		{
+			std::vector<uint32_t> Entries = { Next };
+			for (uint32_t E = 0; E < Count; E++)
+				if (Used.at(E))
+					Entries.push_back(GetChunkValue(*ENVL, 4 + 4 * size_t(E)));
+
+			*ENVL = DetachChunk(*ENVL);
+			ENVL->Payload.assign(reinterpret_cast<unsigned char*>(Entries.data()), reinterpret_cast<unsigned char*>(Entries.data()) + 4 * Entries.size());
+			ENVL->Size = static_cast<uint32_t>(ENVL->Payload.size());
+			Dropped += Count - Next;
+		}
+
+		for (size_t S = 0; S < Decoded.size(); S++)
+		{
+			if (Owner.at(S) != G)
+				continue;
+
+			if (Compacted)
+				for (auto& V : Decoded.at(S).Vertices)
+					for (size_t W = 0; W < 4; W++)
+						V.Bones[W] = V.Weights[W] > 0.0f ? (V.Bones[W] < Count ? Map.at(V.Bones[W]) : V.Bones[W]) : 0;
+
+			// Only WGHT changes, the rest of the segment stays as it was
+			Chunk* WGHT = FindChild(*SEGMs.at(S), "WGHT");
+			std::vector<unsigned char> Payload = Decoded.at(S).EncodeWeights();
+			std::string_view Old = GetPayload(*WGHT);
+			if (Payload.size() == Old.size() && std::memcmp(Payload.data(), Old.data(), Old.size()) == 0)
+				continue;
+
+			WGHT->Payload = Payload;
+			WGHT->Size = static_cast<uint32_t>(WGHT->Payload.size());
+			WGHT->Owned = true;
+			Rewritten++;
+		}
+
+		if (ModelLimited > 0 || Compacted)
+		{
+			Chunk* Name = nullptr;
+			for (auto& MODL : MSH2->Children)
+				if (MODL.Header == "MODL" && FindChild(MODL, "GEOM") == GEOMs.at(G))
+					Name = FindChild(MODL, "NAME");
+
+			std::cout << "\n LimitWeights: " << (Name ? GetChunkString(*Name) : std::string("?")) << ": " << ModelLimited << " of "
+				<< ModelVertices << " vertices changed influences, " << (Compacted ? Count - Next : 0) << " ENVL entries dropped";
+		}
+
+		Vertices += ModelVertices;
+		Limited += ModelLimited;
+	}
+
+	std::cout << "\n LimitWeights: " << FileName << ": " << Limited << " of " << Vertices << " skinned vertices changed influences, "
+		<< Dropped << " ENVL entries dropped";
+
+	if (Rewritten > 0 || Dropped > 0)
+		RebuildMSH(Tree);
+}
@@ -3,6 +3,7 @@
 // Bool because I hate macros
 static bool DEBUG = false;
 static bool ADVANCEDMODELS = false;
+static bool CACHE = false;
 
 // Object containing all required data on a material
 class Material
@@ -1,5 +1,9 @@
 #pragma once
+#include <algorithm>
 #include <bitset>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 // A cluster in a model
 class Segment
@@ -126,6 +130,12 @@ private:
 	// Position of FLGS chunk
 	size_t FLGS_Position = 0;
 
+	// TRAN as stored: scale XYZ, rotation quaternion XYZW, translation XYZ
+	float TRAN[10] = { 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f };
+
+	// Position of TRAN chunk (0 if there isn't one)
+	size_t TRAN_Position = 0;
+
 	// Cloth texture name size
 	unsigned int CTEX_Size = 0;
 
@@ -143,4 +153,114 @@ private:
 	// For editing purposes
 	friend class MSH;
 	friend class View;
-};
\ No newline at end of file
+};
+
+// Parent and child links between the models of an MSH (by model index, in file order)
+class Hierarchy
+{
+public:
+
+	// Parent of each model, or -1 for roots (no PRNT, or one that doesn't exist)
+	std::vector<long long> Parents;
+
+	// Children of each model in file order
+	std::vector<std::vector<size_t>> Children;
+
+	// Model of each name (the last one if names repeat)
+	std::unordered_map<std::string, size_t> Index;
+
+	// Links the models up by the names of their parents
+	inline void Build(const std::vector<std::string>& Names, const std::vector<std::string>& ParentNames)
+	{
+		Parents.assign(Names.size(), -1);
+		Children.assign(Names.size(), {});
+		Index.clear();
+		for (size_t M = 0; M < Names.size(); M++)
+			Index[Names.at(M)] = M;
+
+		for (size_t M = 0; M < Names.size(); M++)
+		{
+			long long P = ParentNames.at(M).empty() ? -1 : Find(ParentNames.at(M));
+			if (P != -1 && static_cast<size_t>(P) != M)
+			{
+				Parents.at(M) = P;
+				Children.at(static_cast<size_t>(P)).push_back(M);
+			}
+		}
+	}
+
+	// Returns the model with this name, or -1
+	inline long long Find(const std::string& Name) const
+	{
+		auto It = Index.find(Name);
+		return It == Index.end() ? -1 : static_cast<long long>(It->second);
+	}
+
+	// Returns whether Model is Ancestor or somewhere under it
+	inline bool IsDescendant(size_t Model, size_t Ancestor) const
+	{
+		// Parent loops are possible in broken files, so never walk further than there are models
+		long long M = static_cast<long long>(Model);
+		for (size_t Steps = 0; M != -1 && Steps <= Parents.size(); Steps++)
+		{
+			if (static_cast<size_t>(M) == Ancestor)
+				return true;
+			M = Parents.at(static_cast<size_t>(M));
+		}
+
+		return false;
+	}
+
+	// Moves Model under Parent (-1 makes it a root), false if that would make a loop
+	inline bool SetParent(size_t Model, long long Parent)
+	{
+		if (Parent != -1 && IsDescendant(static_cast<size_t>(Parent), Model))
+			return false;
+
+		if (Parents.at(Model) != -1)
+		{
+			std::vector<size_t>& Siblings = Children.at(static_cast<size_t>(Parents.at(Model)));
+			Siblings.erase(std::remove(Siblings.begin(), Siblings.end(), Model), Siblings.end());
+		}
+
+		Parents.at(Model) = Parent;
+		if (Parent != -1)
+		{
+			std::vector<size_t>& Siblings = Children.at(static_cast<size_t>(Parent));
+			Siblings.insert(std::upper_bound(Siblings.begin(), Siblings.end(), Model), Model);
+		}
+
+		return true;
+	}
+
+	// Changes the name a model is found by
+	inline void Rename(size_t Model, const std::string& Old, const std::string& New)
+	{
+		auto It = Index.find(Old);
+		if (It != Index.end() && It->second == Model)
+			Index.erase(It);
+		Index[New] = Model;
+	}
+
+	// Returns Root and everything under it, parents before their children
+	inline std::vector<size_t> Subtree(size_t Root) const
+	{
+		std::vector<size_t> Found;
+		std::vector<char> Seen(Parents.size(), 0);
+		std::vector<size_t> Pending = { Root };
+		while (!Pending.empty())
+		{
+			size_t M = Pending.back();
+			Pending.pop_back();
+			if (Seen.at(M))
+				continue;
+
+			Seen.at(M) = 1;
+			Found.push_back(M);
+			for (auto C = Children.at(M).rbegin(); C != Children.at(M).rend(); ++C)
+				Pending.push_back(*C);
+		}
+
+		return Found;
+	}
+};
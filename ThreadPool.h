@@ -0,0 +1,86 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+
+// A fixed set of worker threads that run queued jobs
+class ThreadPool
+{
+public:
+
+    // Starts the workers (at least one)
+    ThreadPool(size_t Count)
+    {
+        if (Count == 0)
+            Count = 1;
+
+        for (size_t T = 0; T < Count; T++)
+            Workers.emplace_back([this] { Work(); });
+    }
+
+    // Finishes the queued jobs, then stops the workers
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            Stopping = true;
+        }
+
+        Wake.notify_all();
+        for (std::thread& Worker : Workers)
+            Worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Queues a job for the next free worker
+    void Submit(std::function<void()> Job)
+    {
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            Jobs.push(std::move(Job));
+        }
+
+        Wake.notify_one();
+    }
+
+private:
+
+    // Worker loop, sleeps until there's a job or the pool is stopping
+    void Work()
+    {
+        while (true)
+        {
+            std::function<void()> Job;
+            {
+                std::unique_lock<std::mutex> Lock(Mutex);
+                Wake.wait(Lock, [this] { return Stopping || !Jobs.empty(); });
+                if (Jobs.empty())
+                    return;
+
+                Job = std::move(Jobs.front());
+                Jobs.pop();
+            }
+
+            Job();
+        }
+    }
+
+    // Worker threads
+    std::vector<std::thread> Workers;
+
+    // Jobs waiting for a worker
+    std::queue<std::function<void()>> Jobs;
+
+    // Guards Jobs and Stopping
+    std::mutex Mutex;
+
+    // Signalled when a job is queued or the pool stops
+    std::condition_variable Wake;
+
+    // Set when the pool is shutting down
+    bool Stopping = false;
+};
@@ -594,43 +594,8 @@ public:
 
                             if (response == 'y')
                             {
-                                // remove modl and reassign indices for modls after the selected
-                                for (unsigned short f = Selected; f < MSHFile.ModelCount; f++)
-                                    MSHFile.Models.at(f).MNDX--;
-
-                                std::cout << "\n Model " << MSHFile.Models.at(Selected).Name << " deleted!";
-
-                                // Reassign any children MODLS to the first MODL
-                                if (MSHFile.ModelCount > 2)
-                                {
-                                    for (unsigned short g = 0; g < MSHFile.ModelCount; g++)
-                                        if (MSHFile.Models.at(g).PRNT_Index == Selected)
-                                        {
-                                            MSHFile.Models.at(g).PRNT_Index = 1;
-                                            MSHFile.Models.at(g).PRNT = MSHFile.Models.at(1).Name;
-                                            MSHFile.Models.at(g).PRNT_Size = MSHFile.Models.at(1).Name_Size;
-                                        }
-                                }
-                                else
-                                {
-                                    // If there are only two MODLs, remove PRNT chunk from other
-                                    if (Selected == 1)
-                                    {
-                                        MSHFile.Models.at(2).PRNT = "";
-                                        MSHFile.Models.at(2).PRNT_Index = 1;
-                                        MSHFile.Models.at(2).PRNT_Size = 0;
-                                    }
-                                    else
-                                    {
-                                        MSHFile.Models.at(1).PRNT = "";
-                                        MSHFile.Models.at(1).PRNT_Index = 1;
-                                        MSHFile.Models.at(1).PRNT_Size = 0;
-                                    }
-                                }
-
-                                // Ok now actually do it
-                                MSHFile.Models.erase(MSHFile.Models.begin() + Selected);
-                                MSHFile.ModelCount--;
+                                // Children move up, MNDX and ENVL of the rest are renumbered (refused if a skin uses it as a bone)
+                                MSHFile.RemoveModel(Selected);
                                 IsGood = true;
                             }
                             else